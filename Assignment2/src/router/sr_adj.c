@@ -0,0 +1,184 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.c
+ *
+ * Description:
+ *
+ * Adjacency table with prebuilt Ethernet headers, see sr_adj.h.
+ *
+ * The hash index is open addressed with linear probing and keyed by the
+ * next hop only, so every adjacency of one neighbour sits in the same
+ * probe run. Nothing is ever removed, which is what lets lookups run
+ * without the writer's lock: a slot is filled once and published after
+ * the adjacency it points to.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_adj.h"
+#include "sr_protocol.h"
+
+typedef char sr_adj_hdr_check[(SR_ADJ_HDR_LEN == sizeof(sr_ethernet_hdr_t)) ? 1 : -1];
+
+static inline uint32_t adj_hash(uint32_t ip)
+{
+    ip ^= ip >> 16;
+    ip *= 0x85ebca6b;
+    ip ^= ip >> 13;
+    ip *= 0xc2b2ae35;
+    ip ^= ip >> 16;
+    return ip;
+}
+
+int sr_adj_init(struct sr_adj_table* table, uint32_t capacity)
+{
+    uint64_t nslots = 16;
+
+    /* -- keep the load factor at or below 1/2; the mask is 32 bit -- */
+    while ( nslots < 2 * (uint64_t)capacity )
+    { nslots <<= 1; }
+    if ( nslots > (1ull << 32) )
+    {
+        fprintf(stderr, "sr_adj_init: %u adjacencies are too many\n", capacity);
+        return -1;
+    }
+
+    table->adjs = (struct sr_adj*)calloc(capacity, sizeof(struct sr_adj));
+    table->slots = (struct sr_adj_slot*)calloc(nslots, sizeof(struct sr_adj_slot));
+    if ( !table->adjs || !table->slots )
+    {
+        fprintf(stderr, "sr_adj_init: out of memory for %u adjacencies\n",
+                capacity);
+        sr_adj_destroy(table);
+        return -1;
+    }
+    table->count = 0;
+    table->capacity = capacity;
+    table->slot_mask = (uint32_t)(nslots - 1);
+    return 0;
+} /* -- sr_adj_init -- */
+
+void sr_adj_destroy(struct sr_adj_table* table)
+{
+    free(table->adjs);
+    free(table->slots);
+    table->adjs = 0;
+    table->slots = 0;
+    table->count = table->capacity = 0;
+} /* -- sr_adj_destroy -- */
+
+struct sr_adj* sr_adj_find(const struct sr_adj_table* table,
+                           uint32_t ip, int iface)
+{
+    uint32_t i = adj_hash(ip) & table->slot_mask;
+    uint32_t n;
+
+    for ( n = 0; n <= table->slot_mask; n++, i = (i + 1) & table->slot_mask )
+    {
+        uint32_t idx = __atomic_load_n(&table->slots[i].idx, __ATOMIC_ACQUIRE);
+        struct sr_adj* adj;
+
+        if ( idx == 0 )
+        { return 0; }
+        adj = &table->adjs[idx - 1];
+        if ( adj->ip == ip && adj->iface == iface )
+        { return adj; }
+    }
+    return 0;
+} /* -- sr_adj_find -- */
+
+struct sr_adj* sr_adj_add(struct sr_adj_table* table, uint32_t ip, int iface,
+                          const uint8_t* shost)
+{
+    uint32_t i = adj_hash(ip) & table->slot_mask;
+    struct sr_adj* adj;
+    sr_ethernet_hdr_t* eth;
+
+    while ( table->slots[i].idx )
+    {
+        adj = &table->adjs[table->slots[i].idx - 1];
+        if ( adj->ip == ip && adj->iface == iface )
+        { return adj; }
+        i = (i + 1) & table->slot_mask;
+    }
+    if ( table->count == table->capacity )
+    { return 0; }
+
+    adj = &table->adjs[table->count];
+    /* -- read without the lock to tell a full table -- */
+    __atomic_store_n(&table->count, table->count + 1, __ATOMIC_RELAXED);
+    adj->seq = 0;
+    adj->ip = ip;
+    adj->iface = iface;
+    adj->resolved = 0;
+    adj->used = 0;
+    eth = (sr_ethernet_hdr_t*)adj->hdr;
+    memset(eth->ether_dhost, 0, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, shost, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    table->slots[i].ip = ip;
+    __atomic_store_n(&table->slots[i].idx, (uint32_t)(adj - table->adjs) + 1,
+                     __ATOMIC_RELEASE);
+    return adj;
+} /* -- sr_adj_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: adj_set(..)
+ * Scope: Local
+ *
+ * Rewrite the destination MAC of every adjacency of ip, or mark them
+ * unresolved when mac is NULL, inside each one's write section. Either
+ * way they start out unused again.
+ *
+ *---------------------------------------------------------------------*/
+
+static void adj_set(struct sr_adj_table* table, uint32_t ip, const uint8_t* mac)
+{
+    uint32_t i = adj_hash(ip) & table->slot_mask;
+
+    while ( table->slots[i].idx )
+    {
+        struct sr_adj* adj = &table->adjs[table->slots[i].idx - 1];
+
+        if ( adj->ip == ip )
+        {
+            __atomic_store_n(&adj->seq, adj->seq + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            if ( mac )
+            { memcpy(adj->hdr, mac, ETHER_ADDR_LEN); }
+            __atomic_store_n(&adj->resolved, mac != 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&adj->used, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&adj->seq, adj->seq + 1, __ATOMIC_RELEASE);
+        }
+        i = (i + 1) & table->slot_mask;
+    }
+} /* -- adj_set -- */
+
+void sr_adj_resolve(struct sr_adj_table* table, uint32_t ip,
+                    const uint8_t* mac)
+{
+    adj_set(table, ip, mac);
+} /* -- sr_adj_resolve -- */
+
+void sr_adj_unresolve(struct sr_adj_table* table, uint32_t ip)
+{
+    adj_set(table, ip, 0);
+} /* -- sr_adj_unresolve -- */
+
+int sr_adj_used(const struct sr_adj_table* table, uint32_t ip)
+{
+    uint32_t i = adj_hash(ip) & table->slot_mask;
+
+    while ( table->slots[i].idx )
+    {
+        const struct sr_adj* adj = &table->adjs[table->slots[i].idx - 1];
+
+        if ( adj->ip == ip && __atomic_load_n(&adj->used, __ATOMIC_RELAXED) )
+        { return adj->iface; }
+        i = (i + 1) & table->slot_mask;
+    }
+    return -1;
+} /* -- sr_adj_used -- */
@@ -0,0 +1,128 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.h
+ * Description:
+ *
+ * Adjacency table. An adjacency is a (next hop, outgoing interface) pair
+ * together with the 14-byte Ethernet header every frame sent to that next
+ * hop carries: the neighbour's MAC, the interface's MAC and the IP
+ * ethertype. Once the next hop is resolved, forwarding a frame is a route
+ * lookup, a copy of that header over the frame's and a send.
+ *
+ * Routes with a gateway keep a pointer to their adjacency (sr_rt.h);
+ * destinations on a directly connected network are found by hashing the
+ * destination and the interface, and only get one once ARP has resolved
+ * them. Adjacencies are never freed or moved, so those pointers stay good
+ * for the life of the table; once it is full, new next hops go through
+ * the ARP cache instead. The ARP cache owns
+ * the table and rewrites the destination MAC in place when a neighbour is
+ * learned, refreshed or expires (sr_arpcache.h).
+ *
+ * Writers are serialized by the owner. Readers take no lock: every
+ * adjacency has its own sequence counter, odd while its header is being
+ * changed, and a reader copies the header again if the counter moved.
+ *
+ * Forwarding marks an adjacency used (sr_adj_touch) the first time it
+ * sends through it after the neighbour was resolved, so the ARP cache
+ * can tell the neighbours that carry traffic from the idle ones and
+ * refresh only the former before they expire.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_ADJ_H
+#define sr_ADJ_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <string.h>
+
+#define SR_ADJ_HDR_LEN 14   /* sizeof(sr_ethernet_hdr_t) */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_adj
+ *
+ * hdr is laid out exactly like sr_ethernet_hdr_t. It is only meaningful
+ * while resolved is set.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_adj
+{
+    uint32_t seq;                   /* odd while hdr/resolved change */
+    uint32_t ip;                    /* next hop, network byte order */
+    int      iface;                 /* outgoing interface id */
+    uint8_t  resolved;              /* the neighbour's MAC is known */
+    uint8_t  used;                  /* sent through since it was resolved */
+    uint8_t  hdr[SR_ADJ_HDR_LEN];   /* dhost, shost, ethertype */
+};
+
+struct sr_adj_slot
+{
+    uint32_t ip;                    /* key, network byte order */
+    uint32_t idx;                   /* adjs[] index + 1, 0 if the slot is empty */
+};
+
+struct sr_adj_table
+{
+    struct sr_adj*      adjs;       /* capacity adjacencies, never move */
+    uint32_t            count;      /* adjs[] handed out so far, read unlocked */
+    uint32_t            capacity;
+    struct sr_adj_slot* slots;      /* hash index, power-of-two size */
+    uint32_t            slot_mask;
+};
+
+int  sr_adj_init(struct sr_adj_table* table, uint32_t capacity);
+void sr_adj_destroy(struct sr_adj_table* table);
+
+/* Adjacency for next hop ip out of interface iface, or NULL. Lock free. */
+struct sr_adj* sr_adj_find(const struct sr_adj_table* table,
+                           uint32_t ip, int iface);
+
+/* Find or create the adjacency; a new one starts unresolved with shost
+   as its source MAC. Returns NULL when the table is full. Writer side. */
+struct sr_adj* sr_adj_add(struct sr_adj_table* table, uint32_t ip, int iface,
+                          const uint8_t* shost);
+
+/* Set or clear the neighbour's MAC in every adjacency whose next hop is
+   ip, whatever the interface. Writer side. */
+void sr_adj_resolve(struct sr_adj_table* table, uint32_t ip,
+                    const uint8_t* mac);
+void sr_adj_unresolve(struct sr_adj_table* table, uint32_t ip);
+
+/* Interface of an adjacency of ip that has been used since ip was last
+   resolved, or -1 if none has. Writer side. */
+int  sr_adj_used(const struct sr_adj_table* table, uint32_t ip);
+
+/* Mark the adjacency used. Stores only the first time, so the line is
+   written once per resolution however much traffic goes through. */
+static inline void sr_adj_touch(struct sr_adj* adj)
+{
+    if ( !__atomic_load_n(&adj->used, __ATOMIC_RELAXED) )
+    { __atomic_store_n(&adj->used, 1, __ATOMIC_RELAXED); }
+}
+
+/* Copy the adjacency's header over the Ethernet header of frame. Returns
+   0, leaving the frame alone, if the next hop is not resolved. */
+static inline int sr_adj_rewrite(const struct sr_adj* adj, uint8_t* frame)
+{
+    uint32_t seq;
+
+    do
+    {
+        while ( (seq = __atomic_load_n(&adj->seq, __ATOMIC_ACQUIRE)) & 1 )
+        { }
+        if ( !__atomic_load_n(&adj->resolved, __ATOMIC_RELAXED) )
+        { return 0; }
+        memcpy(frame, adj->hdr, SR_ADJ_HDR_LEN);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ( __atomic_load_n(&adj->seq, __ATOMIC_RELAXED) != seq );
+
+    return 1;
+}
+
+#endif  /* --  sr_ADJ_H -- */
@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <netinet/in.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -10,95 +12,345 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_pool.h"
+#include "sr_stats.h"
+
+/* -- a queued frame must keep sr_send_packet_inplace's headroom -- */
+typedef char sr_arpq_layout_check[(sizeof(struct sr_packet) +
+                                   SR_PACKET_HEADROOM <= SR_ARPQ_FRAME_OFF) ? 1 : -1];
+
+/* Spread the address over the whole word before masking; the low bits of
+   an address in network byte order are its first octet. */
+static inline uint32_t sr_arpcache_hash(uint32_t ip) {
+    ip ^= ip >> 16;
+    ip *= 0x85ebca6b;
+    ip ^= ip >> 13;
+    ip *= 0xc2b2ae35;
+    ip ^= ip >> 16;
+    return ip;
+}
+
+/* Retry timer of a request: time to resend it, or to give up. Runs from
+   sr_arpcache_timeout with the cache lock held. */
+static void sr_arpreq_retry(struct sr_timer *timer, void *sr_ptr) {
+    struct sr_arpreq *request = (struct sr_arpreq *)
+        ((char *)timer - offsetof(struct sr_arpreq, retry));
+    handle_arpreq((struct sr_instance *)sr_ptr, request);
+}
+
+/*
+  Sends an ARP request for ip out of interface iface: broadcast, or to
+  dhost when refreshing a mapping we already have. The frame is built
+  once per interface, the first time it asks, and only its target changes
+  between sends; the send copies it out. Nothing comes from the pool: an
+  exhausted pool must not stop the retries that eventually free it. Must
+  hold the cache lock.
+*/
+static void sr_arpcache_send_request(struct sr_instance *sr, int iface,
+                                     uint32_t ip, const unsigned char *dhost) {
+    struct sr_arpcache *cache = &(sr->cache);
+    uint8_t *packet = cache->req_frame[iface];
+    sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet;
+    sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+
+    if (!(cache->req_frames & (1u << iface))) {
+        struct sr_if *interface = sr_get_interface_by_id(sr, iface);
+        eth_hdr->ether_type = htons(ethertype_arp);
+        memcpy(eth_hdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
+        arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
+        arp_hdr->ar_pro = htons(ethertype_ip);
+        arp_hdr->ar_hln = ETHER_ADDR_LEN;
+        arp_hdr->ar_pln = 4;
+        arp_hdr->ar_op = htons(arp_op_request);
+        memcpy(arp_hdr->ar_sha, interface->addr, ETHER_ADDR_LEN);
+        arp_hdr->ar_sip = interface->ip;
+        memset(arp_hdr->ar_tha, 0, ETHER_ADDR_LEN);
+        cache->req_frames |= 1u << iface;
+    }
+    if (dhost)
+        memcpy(eth_hdr->ether_dhost, dhost, ETHER_ADDR_LEN);
+    else
+        memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    arp_hdr->ar_tip = ip;
+    sr_send_packet_id(sr, packet, sizeof(cache->req_frame[iface]), iface);
+}
+
+static uint64_t sr_arpcache_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
 /*
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
+  The request scheduler: may a request to ip go out now? Returns 0 if
+  so, otherwise the milliseconds to wait. Unless ip was asked too
+  recently the send is booked, now or after the wait, and the target's
+  next request waits SR_ARPREQ_INTERVAL_MS from it. Targets are counted in ticks of the
+  timer wheel that drives the retries, so a retry armed at a send is
+  allowed when it fires; targets that collide in the table forget each
+  other's last send. If booked is not NULL the send also takes a slot of
+  the request bucket, the next free one if the bucket is empty, and
+  *booked says the wait is for that slot: the request must go out when
+  its timer fires without asking again. Must hold the cache lock.
 */
-void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-    struct sr_arpreq *req_walker = sr->cache.requests;
-    while (req_walker) {
-        struct sr_arpreq *next = req_walker->next;
-        handle_arpreq(sr, req_walker);
-        req_walker = next;
+static uint32_t sr_arpcache_schedule(struct sr_arpcache *cache, uint32_t ip,
+                                     int *booked) {
+    struct sr_arptarget *t = &(cache->targets[sr_arpcache_hash(ip) & cache->slot_mask]);
+    uint64_t now = cache->timers.now;
+    uint32_t wait = 0;
+
+    if (t->ip == ip && t->next > now)
+        return (uint32_t)(t->next - now) * SR_TIMER_TICK_MS;
+    if (booked && cache->req_interval) {
+        uint64_t ns = sr_arpcache_now_ns();
+        uint64_t slot = cache->req_full_at > ns ? cache->req_full_at : ns;
+
+        cache->req_full_at = slot + cache->req_interval;
+        if (slot - ns > cache->req_slack)
+            wait = (uint32_t)((slot - ns - cache->req_slack + 999999) / 1000000);
+        *booked = wait != 0;
     }
+    t->ip = ip;
+    t->next = now + (wait + SR_ARPREQ_INTERVAL_MS + SR_TIMER_TICK_MS - 1) / SR_TIMER_TICK_MS;
+    return wait;
 }
 
+/*
+  Sends the ARP request for a queued next hop, or gives up after 5 tries.
+  The first call sends right away if the scheduler lets it; later sends
+  are driven by the request's retry timer, so packets queued on a pending
+  request don't trigger extra requests. Must hold the cache lock.
+*/
 void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *request) {
-    time_t now = time(NULL);
-    if (difftime(now, request->sent)>=1.0) {
-        if (request->times_sent >= 5) {
-            struct sr_packet *packet_walker = request->packets;
-            while (packet_walker) {
-                sr_send_icmp_packet(sr, packet_walker->buf, packet_walker->len, packet_walker->iface, 3, 1);
-                packet_walker = packet_walker->next;
-            }
-            sr_arpreq_destroy(&(sr->cache), request);
-        } else {
-            uint8_t *packet = (uint8_t *)malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
-            sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet;
-            sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-            struct sr_if *interface = sr_get_interface(sr, request->packets->iface);
-            eth_hdr->ether_type = htons(ethertype_arp);
-            memcpy(eth_hdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
-            memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
-            arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
-            arp_hdr->ar_pro = htons(ethertype_ip);
-            arp_hdr->ar_hln = ETHER_ADDR_LEN;
-            arp_hdr->ar_pln = 4;
-            arp_hdr->ar_op = htons(arp_op_request);
-            memcpy(arp_hdr->ar_sha, interface->addr, ETHER_ADDR_LEN);
-            arp_hdr->ar_sip = interface->ip;
-            memset(arp_hdr->ar_tha, 0, ETHER_ADDR_LEN);
-            arp_hdr->ar_tip = request->ip;
-            sr_send_packet(sr, packet, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t), interface->name);
-            request->sent = now;
-            request->times_sent++;
-            free(packet);
-        } 
-    } 
+    uint32_t wait;
+
+    if (sr_timer_pending(&(request->retry)))
+        return;
+    if (!request->retry.fn)
+        sr_timer_init(&(request->retry), sr_arpreq_retry, sr);
+
+    if (request->times_sent >= 5) {
+        struct sr_packet *packet_walker = request->packets;
+        /* The error goes back the way the packet came; the IP packet
+           follows the frame's own Ethernet header */
+        while (packet_walker) {
+            sr_stats_add(SR_STAT_DROP_ARP_TIMEOUT, 1);
+            if (packet_walker->len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+                sr_send_icmp_packet(sr, packet_walker->buf + sizeof(sr_ethernet_hdr_t),
+                                    packet_walker->len - sizeof(sr_ethernet_hdr_t),
+                                    packet_walker->in_iface, 3, 1);
+            packet_walker = packet_walker->next;
+        }
+        sr_arpreq_destroy(&(sr->cache), request);
+    } else if (!request->booked &&
+               (wait = sr_arpcache_schedule(&(sr->cache), request->ip, &(request->booked))) != 0) {
+        sr_stats_add(SR_STAT_ARP_DEFERRED, 1);
+        sr_timer_add(&(sr->cache.timers), &(request->retry), wait);
+    } else {
+        request->booked = 0;
+        sr_arpcache_send_request(sr, request->iface, request->ip, NULL);
+        sr_stats_add(SR_STAT_ARP_REQUEST, 1);
+        request->sent = time(NULL);
+        request->times_sent++;
+        sr_timer_add(&(sr->cache.timers), &(request->retry), SR_ARPREQ_INTERVAL_MS);
+    }
 }
 
 /* You should not need to touch the rest of this code. */
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+/* Seqlock read side: wait out an active writer, then remember the counter. */
+static inline uint32_t sr_arpcache_read_begin(struct sr_arpcache *cache) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+    return seq;
+}
 
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+/* Nonzero if a writer ran since sr_arpcache_read_begin returned seq. */
+static inline int sr_arpcache_read_retry(struct sr_arpcache *cache, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) != seq;
+}
+
+/* Seqlock write side. Must hold cache->lock. */
+static inline void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+static inline void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Probe for ip and copy its entry out. Safe without the lock inside a read
+   section: the probe is bounded and indices always stay in range, and the
+   caller discards the result if a writer interfered. */
+static int sr_arpcache_find(struct sr_arpcache *cache, uint32_t ip,
+                            struct sr_arpentry *out) {
+    uint32_t i = sr_arpcache_hash(ip) & cache->slot_mask;
+    uint32_t n;
+
+    for (n = 0; n <= cache->slot_mask; n++, i = (i + 1) & cache->slot_mask) {
+        uint32_t idx = __atomic_load_n(&(cache->slots[i].idx), __ATOMIC_RELAXED);
+        if (idx == 0)
+            return 0;
+        if (__atomic_load_n(&(cache->slots[i].ip), __ATOMIC_RELAXED) == ip) {
+            memcpy(out, &(cache->entries[idx - 1]), sizeof(struct sr_arpentry));
+            out->valid = 1;
+            return 1;
         }
     }
+    return 0;
+}
 
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+/* Slot holding ip, or -1. Must hold cache->lock. */
+static long sr_arpcache_slot(struct sr_arpcache *cache, uint32_t ip) {
+    uint32_t i = sr_arpcache_hash(ip) & cache->slot_mask;
+
+    while (cache->slots[i].idx) {
+        if (cache->slots[i].ip == ip)
+            return i;
+        i = (i + 1) & cache->slot_mask;
+    }
+    return -1;
+}
+
+/* Remove the entry in slot i and close the gap by shifting later members of
+   the probe run back. Must hold cache->lock inside a write section. */
+static void sr_arpcache_remove_slot(struct sr_arpcache *cache, uint32_t i) {
+    uint32_t j = i;
+    uint32_t idx = cache->slots[i].idx - 1;
+
+    cache->entries[idx].valid = 0;
+    cache->free_entries[cache->nfree++] = idx;
+    sr_timer_cancel(&(cache->timers), &(cache->expiry[idx]));
+    sr_timer_cancel(&(cache->timers), &(cache->refresh[idx]));
+
+    while (1) {
+        uint32_t home;
+        j = (j + 1) & cache->slot_mask;
+        if (cache->slots[j].idx == 0)
+            break;
+        home = sr_arpcache_hash(cache->slots[j].ip) & cache->slot_mask;
+        /* slot j may fill the hole only if its home is not in (i, j] */
+        if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j)) {
+            cache->slots[i] = cache->slots[j];
+            i = j;
+        }
+    }
+    cache->slots[i].idx = 0;
+}
+
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   Returns 1 and copies the entry into *entry if found, 0 otherwise. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       struct sr_arpentry *entry) {
+    uint32_t seq;
+    int found;
+
+    do {
+        seq = sr_arpcache_read_begin(cache);
+        found = sr_arpcache_find(cache, ip, entry);
+    } while (sr_arpcache_read_retry(cache, seq));
+
+    return found;
+}
+
+/* Looks up n IPs in one read-side critical section. Results are returned by
+   value: out[i].valid is nonzero when ip[i] is in the cache. */
+void sr_arpcache_lookup_burst(struct sr_arpcache *cache,
+                              const uint32_t *ip,
+                              struct sr_arpentry *out,
+                              unsigned int n)
+{
+    uint32_t seq;
+    unsigned int k;
+
+    do {
+        seq = sr_arpcache_read_begin(cache);
+        for (k = 0; k < n; k++) {
+            if (!sr_arpcache_find(cache, ip[k], &out[k]))
+                out[k].valid = 0;
+        }
+    } while (sr_arpcache_read_retry(cache, seq));
+}
+
+/* Adjacency for next hop ip out of interface iface, created and resolved
+   from the cache on first use. NULL if the adjacency table is full, or
+   ip is unresolved and resolved_only set. Misses that can't create
+   anything are answered without the lock. */
+struct sr_adj *sr_arpcache_adjacency(struct sr_arpcache *cache,
+                                     uint32_t ip,
+                                     int iface,
+                                     const uint8_t *shost,
+                                     int resolved_only)
+{
+    struct sr_adj *adj = sr_adj_find(&(cache->adj), ip, iface);
+    struct sr_arpentry entry;
+
+    if (adj)
+        return adj;
+    if (__atomic_load_n(&(cache->adj.count), __ATOMIC_RELAXED) == cache->adj.capacity)
+        return NULL;
+    if (resolved_only && !sr_arpcache_lookup(cache, ip, &entry))
+        return NULL;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    adj = sr_adj_add(&(cache->adj), ip, iface, shost);
+    if (adj && !adj->resolved) {
+        long slot = sr_arpcache_slot(cache, ip);
+        if (slot >= 0)
+            sr_adj_resolve(&(cache->adj), ip,
+                           cache->entries[cache->slots[slot].idx - 1].mac);
     }
 
     pthread_mutex_unlock(&(cache->lock));
 
-    return copy;
+    return adj;
+}
+
+/* Unlink the oldest packet of req and give its buffer back. Must hold
+   cache->lock. */
+static void sr_arpreq_drop_head(struct sr_arpcache *cache, struct sr_arpreq *req) {
+    struct sr_packet *pkt = req->packets;
+
+    req->packets = pkt->next;
+    if (!req->packets)
+        req->tail = NULL;
+    req->npackets--;
+    req->nbytes -= pkt->len;
+    cache->qstats.pkts--;
+    cache->qstats.bytes -= pkt->len;
+    sr_pool_put((uint8_t *)pkt);
+}
+
+/* Nonzero if a packet of len bytes would put req or the whole queue over
+   a limit. */
+static int sr_arpq_over(struct sr_arpcache *cache, struct sr_arpreq *req,
+                        unsigned int len) {
+    const struct sr_arpq_limits *l = &(cache->limits);
+
+    return (l->req_pkts && req->npackets + 1 > l->req_pkts) ||
+           (l->req_bytes && req->nbytes + len > l->req_bytes) ||
+           (l->pkts && cache->qstats.pkts + 1 > l->pkts) ||
+           (l->bytes && cache->qstats.bytes + len > l->bytes);
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. You should free the passed *packet.
+   that corresponds to this ARP request. The packet is copied.
 
    A pointer to the ARP request is returned; it should not be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   NULL if every request is in use. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       int iface,
+                                       int in_iface)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -111,23 +363,62 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 
     /* If the IP wasn't found, add it */
     if (!req) {
-        req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+        if (!cache->free_reqs) {
+            if (packet && packet_len) {
+                cache->qstats.no_request++;
+                sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+            }
+            pthread_mutex_unlock(&(cache->lock));
+            return NULL;
+        }
+        req = cache->free_reqs;
+        cache->free_reqs = req->next;
+        memset(req, 0, sizeof(*req));
         req->ip = ip;
+        req->iface = iface;
         req->next = cache->requests;
         cache->requests = req;
     }
 
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+    /* Add the packet to the end of the list of packets for this request */
+    if (packet && packet_len && iface >= 0) {
+        uint8_t *pb = NULL;
+
+        if (cache->limits.policy == SR_ARPQ_HEAD_DROP) {
+            while (req->packets && sr_arpq_over(cache, req, packet_len)) {
+                sr_arpreq_drop_head(cache, req);
+                cache->qstats.head_drops++;
+                sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+            }
+        }
+        if (packet_len <= SR_POOL_BUF_SZ - SR_ARPQ_FRAME_OFF &&
+            !sr_arpq_over(cache, req, packet_len))
+            pb = sr_pool_get();
+
+        if (pb) {
+            struct sr_packet *new_pkt = (struct sr_packet *)pb;
+
+            new_pkt->buf = pb + SR_ARPQ_FRAME_OFF;
+            memcpy(new_pkt->buf, packet, packet_len);
+            new_pkt->len = packet_len;
+            new_pkt->iface = iface;
+            new_pkt->in_iface = in_iface;
+            new_pkt->next = NULL;
+            if (req->tail)
+                req->tail->next = new_pkt;
+            else
+                req->packets = new_pkt;
+            req->tail = new_pkt;
+            req->npackets++;
+            req->nbytes += packet_len;
+            cache->qstats.queued++;
+            cache->qstats.bytes += packet_len;
+            if (++cache->qstats.pkts > cache->qstats.high_water)
+                cache->qstats.high_water = cache->qstats.pkts;
+        } else {
+            cache->qstats.tail_drops++;
+            sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+        }
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -157,22 +448,49 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                 cache->requests = next;
             }
 
+            /* No more sends once the reply is in */
+            sr_timer_cancel(&(cache->timers), &(req->retry));
             break;
         }
         prev = req;
     }
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
-    }
+    long slot = sr_arpcache_slot(cache, ip);
+    uint32_t idx = 0;
+    int stored = 1;
 
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
+    sr_arpcache_write_begin(cache);
+    if (slot >= 0) {
+        /* Already known: refresh the mapping in place */
+        idx = cache->slots[slot].idx - 1;
+        memcpy(cache->entries[idx].mac, mac, 6);
+        cache->entries[idx].added = time(NULL);
+    }
+    else if (cache->nfree > 0) {
+        uint32_t i = sr_arpcache_hash(ip) & cache->slot_mask;
+
+        idx = cache->free_entries[--cache->nfree];
+        memcpy(cache->entries[idx].mac, mac, 6);
+        cache->entries[idx].ip = ip;
+        cache->entries[idx].added = time(NULL);
+        cache->entries[idx].valid = 1;
+
+        while (cache->slots[i].idx)
+            i = (i + 1) & cache->slot_mask;
+        cache->slots[i].ip = ip;
+        cache->slots[i].idx = idx + 1;
+    }
+    else
+        stored = 0;
+    sr_arpcache_write_end(cache);
+
+    /* (Re)start the entry's lifetime and point its adjacencies at it */
+    if (stored) {
+        sr_timer_add(&(cache->timers), &(cache->expiry[idx]),
+                     (uint32_t)(SR_ARPCACHE_TO * 1000));
+        sr_timer_add(&(cache->timers), &(cache->refresh[idx]),
+                     (uint32_t)(SR_ARPCACHE_TO * SR_ARPCACHE_REFRESH * 1000));
+        sr_adj_resolve(&(cache->adj), ip, mac);
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -203,18 +521,13 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
             prev = req;
         }
 
-        struct sr_packet *pkt, *nxt;
+        sr_timer_cancel(&(cache->timers), &(entry->retry));
 
-        for (pkt = entry->packets; pkt; pkt = nxt) {
-            nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
-        }
+        while (entry->packets)
+            sr_arpreq_drop_head(cache, entry);
 
-        free(entry);
+        entry->next = cache->free_reqs;
+        cache->free_reqs = entry;
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -225,24 +538,212 @@ void sr_arpcache_dump(struct sr_arpcache *cache) {
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    pthread_mutex_lock(&(cache->lock));
+
+    uint32_t i;
+    for (i = 0; i < cache->capacity; i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
+        if (!cur->valid)
+            continue;
         unsigned char *mac = cur->mac;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
 
+    pthread_mutex_unlock(&(cache->lock));
+
     fprintf(stderr, "\n");
 }
 
+/* Expiry timer of an entry: drop it from the table. Runs from
+   sr_arpcache_timeout with the cache lock held. */
+static void sr_arpcache_expire(struct sr_timer *timer, void *cache_ptr) {
+    struct sr_arpcache *cache = cache_ptr;
+    uint32_t idx = timer - cache->expiry;
+
+    /* Only happens to a busy neighbour if it stopped answering refreshes */
+    if (sr_adj_used(&(cache->adj), cache->entries[idx].ip) >= 0)
+        sr_stats_add(SR_STAT_ARP_EXPIRED_USED, 1);
+    sr_adj_unresolve(&(cache->adj), cache->entries[idx].ip);
+    sr_arpcache_write_begin(cache);
+    sr_arpcache_remove_slot(cache, sr_arpcache_slot(cache, cache->entries[idx].ip));
+    sr_arpcache_write_end(cache);
+}
+
+int sr_arpcache_parse_capacity(unsigned int *capacity, const char *s) {
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(s, &end, 10);
+    if (*s == '-' || end == s || *end || errno || v == 0 || v > SR_ARPCACHE_MAX) {
+        fprintf(stderr, "ARP cache entries %s: not between 1 and %u\n", s, SR_ARPCACHE_MAX);
+        return -1;
+    }
+    *capacity = (unsigned int)v;
+    return 0;
+}
+
+void sr_arpq_default_limits(struct sr_arpq_limits *limits) {
+    limits->pkts = SR_ARPQ_PKTS;
+    limits->bytes = SR_ARPQ_BYTES;
+    limits->req_pkts = SR_ARPQ_REQ_PKTS;
+    limits->req_bytes = SR_ARPQ_REQ_BYTES;
+    limits->policy = SR_ARPQ_TAIL_DROP;
+    limits->arp_rate = SR_ARPREQ_RATE;
+    limits->arp_burst = SR_ARPREQ_BURST;
+}
+
+static uint32_t sr_arpq_parse_size(const char *s) {
+    char *end;
+    unsigned long v = strtoul(s, &end, 10);
+
+    if (*end == 'k' || *end == 'K')
+        v <<= 10;
+    else if (*end == 'm' || *end == 'M')
+        v <<= 20;
+    return (uint32_t)v;
+}
+
+int sr_arpq_parse_limits(struct sr_arpq_limits *limits, const char *spec) {
+    char *copy = strdup(spec), *save = 0, *item;
+    int ret = 0;
+
+    for (item = strtok_r(copy, ",", &save); item; item = strtok_r(0, ",", &save)) {
+        if (strncmp(item, "pkts=", 5) == 0)
+            limits->pkts = strtoul(item + 5, 0, 10);
+        else if (strncmp(item, "bytes=", 6) == 0)
+            limits->bytes = sr_arpq_parse_size(item + 6);
+        else if (strncmp(item, "reqpkts=", 8) == 0)
+            limits->req_pkts = strtoul(item + 8, 0, 10);
+        else if (strncmp(item, "reqbytes=", 9) == 0)
+            limits->req_bytes = sr_arpq_parse_size(item + 9);
+        else if (strcmp(item, "taildrop") == 0)
+            limits->policy = SR_ARPQ_TAIL_DROP;
+        else if (strcmp(item, "headdrop") == 0)
+            limits->policy = SR_ARPQ_HEAD_DROP;
+        else if (strncmp(item, "arprate=", 8) == 0)
+            limits->arp_rate = strtoul(item + 8, 0, 10);
+        else if (strncmp(item, "arpburst=", 9) == 0)
+            limits->arp_burst = strtoul(item + 9, 0, 10);
+        else {
+            fprintf(stderr, "sr_arpq: unknown option %s\n", item);
+            ret = -1;
+        }
+    }
+    free(copy);
+    return ret;
+}
+
+void sr_arpcache_get_queue_stats(struct sr_arpcache *cache, struct sr_arpq_stats *stats) {
+    pthread_mutex_lock(&(cache->lock));
+    *stats = cache->qstats;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+void sr_arpcache_print_queue_stats(struct sr_arpcache *cache, FILE *fp) {
+    struct sr_arpq_stats st;
+
+    sr_arpcache_get_queue_stats(cache, &st);
+    fprintf(fp, "ARP queue: %u packets (%u bytes) waiting (high water %u), "
+            "%llu queued, %llu tail drops, %llu head drops, %llu without a request\n",
+            st.pkts, st.bytes, st.high_water, (unsigned long long)st.queued,
+            (unsigned long long)st.tail_drops, (unsigned long long)st.head_drops,
+            (unsigned long long)st.no_request);
+}
+
+/* Refresh timer of an entry, SR_ARPCACHE_REFRESH into its lifetime: if
+   traffic went to the neighbour since it was resolved, ask it again,
+   directly, and keep asking every SR_ARPREQ_INTERVAL_MS until it answers
+   (sr_arpcache_insert restarts both timers) or the entry expires. Idle
+   entries are left to expire, and so is a refresh the scheduler holds
+   back past the expiry. Runs from sr_arpcache_timeout with the cache
+   lock held. */
+static void sr_arpcache_refresh(struct sr_timer *timer, void *cache_ptr) {
+    struct sr_arpcache *cache = cache_ptr;
+    uint32_t idx = timer - cache->refresh;
+    struct sr_arpentry *entry = &(cache->entries[idx]);
+    uint64_t left = cache->expiry[idx].expires - cache->timers.now;
+    uint32_t wait;
+    int iface;
+
+    if (!cache->sr || (iface = sr_adj_used(&(cache->adj), entry->ip)) < 0)
+        return;
+    /* Unicast, one per busy neighbour: no slot of the broadcast budget */
+    if ((wait = sr_arpcache_schedule(cache, entry->ip, NULL)) != 0) {
+        sr_stats_add(SR_STAT_ARP_DEFERRED, 1);
+    } else {
+        sr_arpcache_send_request(cache->sr, iface, entry->ip, entry->mac);
+        sr_stats_add(SR_STAT_ARP_REFRESH, 1);
+        wait = SR_ARPREQ_INTERVAL_MS;
+    }
+    if (left * SR_TIMER_TICK_MS > wait)
+        sr_timer_add(&(cache->timers), timer, wait);
+}
+
 /* Initialize table + table lock. Returns 0 on success. */
-int sr_arpcache_init(struct sr_arpcache *cache) {
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
+int sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity,
+                     const struct sr_arpq_limits *limits) {
+    uint64_t nslots = 16;
+    uint32_t i;
+
+    if (capacity == 0)
+        capacity = SR_ARPCACHE_SZ;
+    if (capacity > SR_ARPCACHE_MAX) {
+        fprintf(stderr, "sr_arpcache_init: %u entries is more than %u\n",
+                capacity, SR_ARPCACHE_MAX);
+        return -1;
+    }
 
-    /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+    /* Keep the load factor at or below 1/2 so probe runs stay short */
+    while (nslots < 2 * (uint64_t)capacity)
+        nslots <<= 1;
+
+    cache->capacity = capacity;
+    cache->entries = (struct sr_arpentry *) calloc(capacity, sizeof(struct sr_arpentry));
+    cache->free_entries = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+    cache->slots = (struct sr_arpslot *) calloc(nslots, sizeof(struct sr_arpslot));
+    cache->expiry = (struct sr_timer *) malloc(capacity * sizeof(struct sr_timer));
+    cache->refresh = (struct sr_timer *) malloc(capacity * sizeof(struct sr_timer));
+    cache->req_store = (struct sr_arpreq *) calloc(capacity, sizeof(struct sr_arpreq));
+    cache->targets = (struct sr_arptarget *) calloc(nslots, sizeof(struct sr_arptarget));
+    if (!cache->entries || !cache->free_entries || !cache->slots || !cache->expiry ||
+        !cache->refresh || !cache->req_store || !cache->targets) {
+        fprintf(stderr, "sr_arpcache_init: out of memory for %u entries\n", capacity);
+        return -1;
+    }
+    /* Room for each neighbour on two interfaces, or for stale next hops */
+    if (sr_adj_init(&(cache->adj), 2 * capacity) != 0)
+        return -1;
+    cache->slot_mask = (uint32_t)(nslots - 1);
+    cache->seq = 0;
+
+    /* Hand out low indices first */
+    for (i = 0; i < capacity; i++) {
+        cache->free_entries[i] = capacity - 1 - i;
+        sr_timer_init(&(cache->expiry[i]), sr_arpcache_expire, cache);
+        sr_timer_init(&(cache->refresh[i]), sr_arpcache_refresh, cache);
+    }
+    cache->nfree = capacity;
+
+    /* One request per neighbour the cache could take in */
     cache->requests = NULL;
+    cache->free_reqs = NULL;
+    for (i = capacity; i-- > 0; ) {
+        cache->req_store[i].next = cache->free_reqs;
+        cache->free_reqs = &(cache->req_store[i]);
+    }
+    if (limits)
+        cache->limits = *limits;
+    else
+        sr_arpq_default_limits(&(cache->limits));
+    memset(&(cache->qstats), 0, sizeof(cache->qstats));
+    cache->req_full_at = 0;
+    cache->req_interval = cache->limits.arp_rate ? 1000000000ull / cache->limits.arp_rate : 0;
+    cache->req_slack = (cache->limits.arp_burst ? cache->limits.arp_burst - 1 : 0) *
+                       cache->req_interval;
+    cache->req_frames = 0;
+    cache->sr = NULL;
+    sr_timer_wheel_init(&(cache->timers));
 
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -254,32 +755,33 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    free(cache->entries);
+    free(cache->free_entries);
+    free(cache->slots);
+    free(cache->expiry);
+    free(cache->refresh);
+    free(cache->req_store);
+    free(cache->targets);
+    sr_adj_destroy(&(cache->adj));
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Thread which runs the cache's timer wheel: entries expire SR_ARPCACHE_TO
+   seconds after they were last added, and pending ARP requests are resent
+   or given up on. Each tick only visits the timers that are due. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
 
     while (1) {
-        sleep(1.0);
+        usleep(SR_TIMER_TICK_MS * 1000);
 
         pthread_mutex_lock(&(cache->lock));
-
-        time_t curtime = time(NULL);
-
-        int i;
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
-
-        sr_arpcache_sweepreqs(sr);
-
+        sr_timer_advance(&(cache->timers), sr_timer_now());
         pthread_mutex_unlock(&(cache->lock));
+
+        /* Nothing else flushes what the timers sent */
+        sr_send_flush(sr);
     }
 
     return NULL;
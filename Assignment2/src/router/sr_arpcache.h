@@ -4,16 +4,19 @@
    to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
    are timed out every SR_ARPCACHE_TO seconds.
 
+   The entries are indexed by an open-addressed (linear probing) hash table
+   keyed by IP. Lookups never take the cache lock: writers hold the lock and
+   bump a sequence counter around every change, and readers retry if the
+   counter moved while they were reading (a seqlock). Lookups copy the entry
+   out by value, so nothing is allocated on the forwarding path.
+
    Pseudocode for use of these structures follows.
 
    --
 
    # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
-
-   if entry:
+   if arpcache_lookup(next_hop_ip, &entry):
        use next_hop_ip->mac mapping in entry to send the packet
-       free entry
    else:
        req = arpcache_queuereq(next_hop_ip, packet, len)
        handle_arpreq(req)
@@ -24,15 +27,19 @@
    handle sending ARP requests if necessary:
 
    function handle_arpreq(req):
-       if difftime(now, req->sent) > 1.0
-           if req->times_sent >= 5:
-               send icmp host unreachable to source addr of all pkts waiting
-                 on this request
-               arpreq_destroy(req)
-           else:
-               send arp request
-               req->sent = now
-               req->times_sent++
+       if req->retry is pending:
+           return                      # the timer will resend it
+       if req->times_sent >= 5:
+           send icmp host unreachable to source addr of all pkts waiting
+             on this request
+           arpreq_destroy(req)
+       else if the scheduler holds req->ip back:
+           schedule req->retry for when it may go
+       else:
+           send arp request
+           req->sent = now
+           req->times_sent++
+           schedule req->retry in SR_ARPREQ_INTERVAL_MS
 
    --
 
@@ -48,19 +55,45 @@
 
    --
 
-   To meet the guidelines in the assignment (ARP requests are sent every second
-   until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
-
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
-
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   Nothing is swept periodically. Every entry carries an expiry timer that
+   is re-armed whenever the mapping is refreshed, and every pending request
+   carries a retry timer that calls handle_arpreq again when it fires. Both
+   live on a timer wheel (sr_timer.h) that sr_arpcache_timeout advances under
+   the cache lock, so each tick only touches the timers that are due.
+
+   An entry whose neighbour has carried traffic since it was resolved
+   (sr_adj_touch) does not wait to expire: SR_ARPCACHE_REFRESH into its
+   lifetime its refresh timer sends the neighbour a unicast request, and
+   the reply restarts the lifetime before anything is unresolved. Busy
+   neighbours so stay resolved as long as they answer; idle ones expire.
+
+   Every ARP request the router sends, first tries, retries and refreshes
+   alike, goes through one scheduler. It sends at most one request to a
+   target every SR_ARPREQ_INTERVAL_MS, remembered per target address so
+   that a request given up and started again right away still waits its
+   turn. Broadcast requests also share a token bucket of arp_rate a
+   second (struct sr_arpq_limits), so a scan of a directly connected
+   subnet can't turn into a broadcast storm: a request that finds the
+   bucket empty books the next free send slot and its retry timer sends
+   it then, so waiting requests go out in order without polling.
+   Requests are sent from a frame prebuilt for each interface; only the
+   target is filled in.
+
+   The cache also owns the adjacency table (sr_adj.h). Inserting a mapping
+   resolves every adjacency of that neighbour and expiring it unresolves
+   them, so the prebuilt headers the forwarding path copies always agree
+   with the cache.
+
+   handle_arpreq and the request queue must be used with the cache lock held;
+   the lock is recursive, so the sr_arpcache_* calls can be made inside it.
+
+   The request queue has a fixed size. Requests are preallocated, one per
+   neighbour the cache can hold, and queued packets are capped in number
+   and bytes both per request and across all of them (struct
+   sr_arpq_limits). A packet over a limit is dropped (tail drop) or pushes
+   out the oldest packets of its own request (head drop). Either way a
+   neighbour that stops answering under load ties up a bounded number of
+   pool buffers until its request gives up.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -69,15 +102,60 @@
 #include <inttypes.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdio.h>
 #include "sr_if.h"
+#include "sr_timer.h"
+#include "sr_adj.h"
 
-#define SR_ARPCACHE_SZ    100
+#define SR_ARPCACHE_SZ    100     /* default capacity, see sr_arpcache_init */
+#define SR_ARPCACHE_MAX   (1u << 24)  /* largest capacity */
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_REFRESH 0.8   /* of SR_ARPCACHE_TO, when entries in use are refreshed */
+#define SR_ARPREQ_INTERVAL_MS 1000
+#define SR_ARPREQ_RATE    100     /* default requests a second, all targets together */
+#define SR_ARPREQ_BURST   50
+
+/* A queued packet lives in a single pool buffer (sr_pool.h): the struct
+   sr_packet, then the frame at this offset, which leaves room in front of
+   it to be sent in place. */
+#define SR_ARPQ_FRAME_OFF 128
+
+/* Default limits on queued packets */
+#define SR_ARPQ_PKTS      512           /* all requests together */
+#define SR_ARPQ_BYTES     (512 * 1024)
+#define SR_ARPQ_REQ_PKTS  64            /* one request */
+#define SR_ARPQ_REQ_BYTES (64 * 1024)
+
+enum sr_arpq_policy {
+    SR_ARPQ_TAIL_DROP,          /* drop the packet that doesn't fit */
+    SR_ARPQ_HEAD_DROP           /* drop the oldest of its request instead */
+};
+
+struct sr_arpq_limits {
+    uint32_t pkts;              /* 0 anywhere: no limit */
+    uint32_t bytes;
+    uint32_t req_pkts;
+    uint32_t req_bytes;
+    enum sr_arpq_policy policy;
+    uint32_t arp_rate;          /* ARP requests a second, 0: no limit */
+    uint32_t arp_burst;
+};
+
+struct sr_arpq_stats {
+    uint32_t pkts;              /* queued now */
+    uint32_t bytes;
+    uint32_t high_water;        /* most packets ever queued */
+    uint64_t queued;            /* packets ever queued */
+    uint64_t tail_drops;        /* packets refused */
+    uint64_t head_drops;        /* packets pushed out by newer ones */
+    uint64_t no_request;        /* packets refused because every request was in use */
+};
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    int iface;                  /* Id of the outgoing interface */
+    int in_iface;               /* and of the one it came in on */
     struct sr_packet *next;
 };
 
@@ -90,25 +168,87 @@ struct sr_arpentry {
 
 struct sr_arpreq {
     uint32_t ip;
+    int iface;                  /* Id of the interface to ask on */
     time_t sent;                /* Last time this ARP request was sent. You
                                    should update this. If the ARP request was
                                    never sent, will be 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You
                                    should update this. */
-    struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    int booked;                 /* holds a send slot of the request bucket */
+    struct sr_packet *packets;  /* List of pkts waiting on this req to finish,
+                                   oldest first */
+    struct sr_packet *tail;
+    uint32_t npackets;
+    uint32_t nbytes;
+    struct sr_timer retry;      /* Fires handle_arpreq for the next send */
     struct sr_arpreq *next;
 };
 
+/* When a request may next be sent to ip */
+struct sr_arptarget {
+    uint32_t ip;
+    uint64_t next;              /* tick of cache->timers */
+};
+
+struct sr_arpslot {
+    uint32_t ip;                /* key, network byte order */
+    uint32_t idx;               /* entries[] index + 1, 0 if the slot is empty */
+};
+
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arpentry *entries;    /* capacity entries, never move */
+    struct sr_timer *expiry;        /* expiry timer of each entries[] slot */
+    struct sr_timer *refresh;       /* and refresh timer */
+    uint32_t *free_entries;         /* stack of unused entries[] indices */
+    uint32_t nfree;
+    uint32_t capacity;
+    struct sr_arpslot *slots;       /* hash index, power-of-two size */
+    uint32_t slot_mask;
+    uint32_t seq;                   /* odd while a writer is changing the table */
     struct sr_arpreq *requests;
-    pthread_mutex_t lock;
+    struct sr_arpreq *req_store;    /* capacity requests, never move */
+    struct sr_arpreq *free_reqs;
+    struct sr_arpq_limits limits;
+    struct sr_arpq_stats qstats;
+    struct sr_arptarget *targets;   /* slot_mask + 1 of them, by hash */
+    uint64_t req_full_at;           /* request bucket, ns, see sr_ratelimit.c */
+    uint64_t req_interval;          /* ns per request, 0: no limit */
+    uint64_t req_slack;
+    uint8_t req_frame[SR_IF_MAX][sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    uint32_t req_frames;            /* bit per interface whose frame is built */
+    struct sr_timer_wheel timers;   /* entry expiry and request retries */
+    struct sr_adj_table adj;        /* next hops with prebuilt headers */
+    pthread_mutex_t lock;           /* serializes writers, the request queue
+                                       and the timer wheel */
     pthread_mutexattr_t attr;
+    struct sr_instance *sr;         /* sends refreshes; none are sent while NULL */
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
+   Returns 1 and copies the entry into *entry if found, 0 otherwise. Never
+   blocks on the cache lock. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       struct sr_arpentry *entry);
+
+/* Looks up n IPs in one read-side critical section. Results are returned by
+   value: out[i].valid is nonzero when ip[i] is in the cache. */
+void sr_arpcache_lookup_burst(struct sr_arpcache *cache,
+                              const uint32_t *ip,
+                              struct sr_arpentry *out,
+                              unsigned int n);
+
+/* Adjacency for next hop ip out of interface iface, created on first use
+   with shost (the interface's MAC) as its source and resolved right away
+   if ip is already in the cache. With resolved_only it is only created
+   once ip is in the cache: adjacencies are never reclaimed, so hosts on a
+   connected network that never answer must not take them. Only takes
+   the cache lock to create it. Returns NULL if there is none and none is
+   created, the table being full or ip unresolved. */
+struct sr_adj *sr_arpcache_adjacency(struct sr_arpcache *cache,
+                                     uint32_t ip,
+                                     int iface,
+                                     const uint8_t *shost,
+                                     int resolved_only);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
@@ -116,12 +256,18 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
    freed by the caller.
 
    A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   The copy comes from the packet pool. If the pool is exhausted or the
+   packet is over the queue limits it may be dropped, but the request is
+   still returned. NULL if there is no request for ip and none is free:
+   the packet is dropped too. in_iface is the interface the packet came
+   in on, where an error about it goes. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         int iface,
+                         int in_iface);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -140,14 +286,27 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
-
-int   sr_arpcache_init(struct sr_arpcache *cache);
+   a destructor, and the timeout thread runs the timer wheel, which expires
+   cache entries after 15 seconds and retransmits ARP requests. capacity is the number of neighbours the cache can hold
+   (SR_ARPCACHE_SZ if 0, at most SR_ARPCACHE_MAX), limits those of the
+   request queue (the defaults if NULL). init returns -1 if the tables
+   can't be had. */
+
+int   sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity,
+                       const struct sr_arpq_limits *limits);
+/* A capacity from the command line, 1 to SR_ARPCACHE_MAX. 0 on success. */
+int   sr_arpcache_parse_capacity(unsigned int *capacity, const char *s);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 void handle_arpreq(struct sr_instance *, struct sr_arpreq *);
 
+/* "pkts=N,bytes=N,reqpkts=N,reqbytes=N,taildrop|headdrop,arprate=N,
+   arpburst=N", any of them; byte counts may end in k or m. */
+void sr_arpq_default_limits(struct sr_arpq_limits *limits);
+int  sr_arpq_parse_limits(struct sr_arpq_limits *limits, const char *spec);
+void sr_arpcache_get_queue_stats(struct sr_arpcache *cache, struct sr_arpq_stats *stats);
+void sr_arpcache_print_queue_stats(struct sr_arpcache *cache, FILE *fp);
+
 /* IMPORTANT: To avoid circular dependencies, do a forward declaration of any
 methods from other files that you need to use. For example, if your sr_arpcache
 needs to use methods from sr_router, declare those methods here too.
@@ -160,7 +319,10 @@ since sr_router already imports sr_arpcache.h! - KM */
 
 /* sr_router.h */
 /* list any declarations that you need here */
-void sr_send_icmp_packet(struct sr_instance *, uint8_t *, unsigned int, char *, uint8_t, uint8_t);
+void sr_send_icmp_packet(struct sr_instance *, uint8_t *, unsigned int, int, uint8_t, uint8_t);
+/* sr_vns_comm.c */
+int sr_send_flush(struct sr_instance *);
+int sr_send_packet_id(struct sr_instance *, uint8_t *, unsigned int, int);
 /* sr_if.h */
 struct sr_if *sr_get_interface(struct sr_instance *, const char *);
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
@@ -0,0 +1,711 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Offline replay of a capture through the router, without VNS. Reads a
+ * pcap or pcapng file (as written by -l, see sr_dumper.h), a routing
+ * table and an interface list, then hands every frame to sr_handlepacket
+ * (or sr_handlepacket_burst with -b) and reports packets per second,
+ * nanoseconds per packet and allocations per packet.
+ *
+ * Frames the router sends go to a counting sink, optionally also to a
+ * capture file (-o). The sink answers the router's ARP requests, so the
+ * next hops resolve as they would on a live network; static entries can
+ * be given as well, and one neighbour can be made silent (-D) to see
+ * what a dead next hop costs. The ingress interface of a frame is the one whose MAC
+ * is its destination, or the first interface.
+ *
+ * The interface file has one interface per line, and optionally static
+ * ARP entries:
+ *
+ *     eth1 192.168.2.1 02:00:00:00:00:01
+ *     eth2 172.64.3.1  02:00:00:00:00:02
+ *     arp  192.168.2.2 00:22:22:22:22:22
+ *
+ * With -u, a second thread keeps changing the routes while the frames
+ * are replayed: it deletes a batch of routes in one update and adds them
+ * back in the next, and the route update rate is reported next to the
+ * forwarding rate, which shows what the updates cost the data path.
+ * ICMP errors are rate limited, and the ARP queue capped and its requests
+ * paced, as in the router, with the same -E and -Q.
+ * With -m, the counters go into a shared memory segment of that name,
+ * so sr_stat can watch the replay as it would a router.
+ *
+ * Usage: sr_bench -c iffile [-r rtable] [-n passes] [-b burst] [-o out]
+ *                 [-F engine] [-a arp entries] [-u update batch]
+ *                 [-m segment] [-E icmp limits] [-Q arp queue limits]
+ *                 [-D silent neighbour]
+ *                 [-L level] capture
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _SOLARIS_
+#define __EXTENSIONS__
+#endif /* _SOLARIS_ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_dumper.h"
+#include "sr_pool.h"
+#include "sr_flow.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+
+#define BENCH_MAX_REPLIES 64   /* ARP answers waiting to be delivered */
+
+struct bench_frame
+{
+    uint32_t len;
+    int      iface;            /* ingress interface id */
+    uint8_t* data;
+};
+
+struct bench_trace
+{
+    struct bench_frame* frames;
+    uint32_t            n;
+    uint32_t            cap;
+    uint32_t            maxlen;
+};
+
+struct bench_reply
+{
+    int      iface;
+    uint32_t len;
+    uint8_t  buf[SR_PACKET_HEADROOM + sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+};
+
+/* -- the sink -- */
+static uint64_t sent_frames;
+static uint64_t sent_bytes;
+static uint64_t arp_requests;
+static struct sr_capture* out_cap;
+static struct bench_reply replies[BENCH_MAX_REPLIES];
+static unsigned int nreplies;
+static uint32_t silent_ip;          /* -D: never answered */
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*---------------------------------------------------------------------
+ * Allocation counting. With -DSR_BENCH_COUNT_MALLOC the Makefile links
+ * with --wrap for malloc, calloc and realloc, which land here.
+ *---------------------------------------------------------------------*/
+
+static volatile int counting;
+static __thread int uncounted;      /* set in the route updater thread */
+static uint64_t nallocs;
+
+#ifdef SR_BENCH_COUNT_MALLOC
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+
+void* __wrap_malloc(size_t n)
+{
+    if (counting && !uncounted) __atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(n);
+}
+
+void* __wrap_calloc(size_t m, size_t n)
+{
+    if (counting && !uncounted) __atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(m, n);
+}
+
+void* __wrap_realloc(void* p, size_t n)
+{
+    if (counting && !uncounted) __atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(p, n);
+}
+#endif /* SR_BENCH_COUNT_MALLOC */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* MAC the sink answers with for ip: 02:5e followed by the address */
+static void neighbour_mac(uint32_t ip, uint8_t* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x5e;
+    memcpy(mac + 2, &ip, 4);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sink_arp(..)
+ * Scope: Local
+ *
+ * Queue the answer to an ARP request the router sent. It is delivered
+ * once the frame being handled is done, since the request goes out with
+ * the ARP cache lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sink_arp(const uint8_t* buf, unsigned int len, int iface)
+{
+    const sr_arp_hdr_t* req = (const sr_arp_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    struct bench_reply* r;
+    sr_ethernet_hdr_t* eth;
+    sr_arp_hdr_t* arp;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) ||
+        req->ar_op != htons(arp_op_request))
+    { return; }
+
+    pthread_mutex_lock(&sink_lock);
+    arp_requests++;
+    if (nreplies < BENCH_MAX_REPLIES && req->ar_tip != silent_ip)
+    {
+        r = &replies[nreplies++];
+        r->iface = iface;
+        r->len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+        eth = (sr_ethernet_hdr_t*)(r->buf + SR_PACKET_HEADROOM);
+        arp = (sr_arp_hdr_t*)(eth + 1);
+        *arp = *req;
+        arp->ar_op = htons(arp_op_reply);
+        neighbour_mac(req->ar_tip, arp->ar_sha);
+        arp->ar_sip = req->ar_tip;
+        memcpy(arp->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+        arp->ar_tip = req->ar_sip;
+        memcpy(eth->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+        memcpy(eth->ether_shost, arp->ar_sha, ETHER_ADDR_LEN);
+        eth->ether_type = htons(ethertype_arp);
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+/*---------------------------------------------------------------------
+ * Stubs for sr_vns_comm.c: everything the router sends ends up here.
+ *---------------------------------------------------------------------*/
+
+int sr_send_packet_id(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      int iface)
+{
+    if (iface < 0 || iface >= sr->if_count)
+    { return -1; }
+    __atomic_add_fetch(&sent_frames, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sent_bytes, len, __ATOMIC_RELAXED);
+    sr_stats_tx(iface, len);
+    if (out_cap)
+    { sr_capture_packet(out_cap, buf, len); }
+    if (len >= sizeof(sr_ethernet_hdr_t) && ethertype(buf) == ethertype_arp)
+    { sink_arp(buf, len, iface); }
+    return 0;
+}
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    return sr_send_packet_id(sr, buf, len, sr_interface_id(sr, iface));
+}
+
+int sr_send_packet_inplace(struct sr_instance* sr, uint8_t* buf,
+                           unsigned int len, int iface)
+{
+    return sr_send_packet_id(sr, buf, len, iface);
+}
+
+int sr_send_flush(struct sr_instance* sr)
+{
+    return 0;
+}
+
+/* Hand the queued ARP answers to the router. */
+static void deliver_replies(struct sr_instance* sr)
+{
+    struct bench_reply pending[BENCH_MAX_REPLIES];
+    unsigned int i, n;
+
+    pthread_mutex_lock(&sink_lock);
+    n = nreplies;
+    memcpy(pending, replies, n * sizeof(pending[0]));
+    nreplies = 0;
+    pthread_mutex_unlock(&sink_lock);
+
+    for (i = 0; i < n; i++)
+    {
+        uint8_t* frame = pending[i].buf + SR_PACKET_HEADROOM;
+        sr_handlepacket_burst(sr, &frame, &pending[i].len, &pending[i].iface, 1);
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Capture reader
+ *---------------------------------------------------------------------*/
+
+static uint32_t rd32(const uint8_t* p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static void trace_add(struct bench_trace* t, const uint8_t* data, uint32_t len)
+{
+    struct bench_frame* f;
+
+    if (t->n == t->cap)
+    {
+        t->cap = t->cap ? 2 * t->cap : 1024;
+        t->frames = realloc(t->frames, t->cap * sizeof(struct bench_frame));
+        if (!t->frames)
+        { fprintf(stderr, "out of memory for %u frames\n", t->cap); exit(1); }
+    }
+    f = &t->frames[t->n++];
+    f->len = len;
+    f->iface = -1;
+    f->data = malloc(len ? len : 1);
+    if (!f->data)
+    { fprintf(stderr, "out of memory\n"); exit(1); }
+    memcpy(f->data, data, len);
+    if (len > t->maxlen)
+    { t->maxlen = len; }
+}
+
+/*---------------------------------------------------------------------
+ * Method: read_capture(..)
+ * Scope: Local
+ *
+ * Load every Ethernet frame of a pcap file (either byte order, micro or
+ * nanosecond) or a pcapng file (enhanced and simple packet blocks).
+ * Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+static int read_capture(const char* path, struct bench_trace* t)
+{
+    FILE* fp = fopen(path, "rb");
+    uint8_t hdr[24];
+    uint8_t* buf = 0;
+    uint32_t bufsz = 0;
+    uint32_t magic;
+    int swap;
+
+    if (!fp)
+    { perror(path); return -1; }
+    if (fread(hdr, 1, 24, fp) != 24)
+    { fprintf(stderr, "%s: too short for a capture\n", path); fclose(fp); return -1; }
+    memcpy(&magic, hdr, 4);
+
+    if (magic == PCAPNG_SHB)
+    {
+        uint32_t type, blen;
+
+        swap = 0;
+        if (fseek(fp, 0, SEEK_SET) != 0)
+        { fclose(fp); return -1; }
+        while (fread(hdr, 1, 8, fp) == 8)
+        {
+            type = rd32(hdr, swap);
+            if (type == PCAPNG_SHB)
+            {
+                /* -- a new section may change the byte order -- */
+                if (fread(hdr + 8, 1, 4, fp) != 4)
+                { break; }
+                swap = rd32(hdr + 8, 0) != PCAPNG_BOM;
+            }
+            blen = rd32(hdr + 4, swap);
+            if (blen < 12 || blen > (1 << 24))
+            { fprintf(stderr, "%s: bad pcapng block\n", path); break; }
+            if (blen - 8 > bufsz)
+            { bufsz = blen - 8; buf = realloc(buf, bufsz); }
+            if (type == PCAPNG_SHB)
+            {
+                if (fread(buf, 1, blen - 12, fp) != blen - 12)
+                { break; }
+                continue;
+            }
+            if (fread(buf, 1, blen - 8, fp) != blen - 8)
+            { break; }
+            if (type == PCAPNG_EPB && blen >= 32)
+            {
+                uint32_t caplen = rd32(buf + 12, swap);
+                if (caplen <= blen - 32)
+                { trace_add(t, buf + 20, caplen); }
+            }
+            else if (type == 3 && blen >= 16)   /* simple packet block */
+            {
+                uint32_t caplen = rd32(buf, swap);
+                if (caplen > blen - 16)
+                { caplen = blen - 16; }
+                trace_add(t, buf + 4, caplen);
+            }
+        }
+    }
+    else if (magic == TCPDUMP_MAGIC || magic == 0xa1b23c4d ||
+             magic == __builtin_bswap32(TCPDUMP_MAGIC) ||
+             magic == __builtin_bswap32(0xa1b23c4d))
+    {
+        uint8_t rec[16];
+
+        swap = magic != TCPDUMP_MAGIC && magic != 0xa1b23c4d;
+        if (rd32(hdr + 20, swap) != LINKTYPE_ETHERNET)
+        { fprintf(stderr, "%s: not an Ethernet capture\n", path); fclose(fp); return -1; }
+        while (fread(rec, 1, 16, fp) == 16)
+        {
+            uint32_t caplen = rd32(rec + 8, swap);
+            if (caplen > (1 << 24))
+            { fprintf(stderr, "%s: bad record\n", path); break; }
+            if (caplen > bufsz)
+            { bufsz = caplen; buf = realloc(buf, bufsz); }
+            if (fread(buf, 1, caplen, fp) != caplen)
+            { break; }
+            trace_add(t, buf, caplen);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s: not a pcap or pcapng file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    free(buf);
+    fclose(fp);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: read_ifconfig(..)
+ * Scope: Local
+ *
+ * Add the interfaces of the file to sr. Static ARP entries are added to
+ * the cache, so this runs after sr_init. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+static int parse_mac(const char* s, unsigned char* mac)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i;
+
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    { return -1; }
+    for (i = 0; i < ETHER_ADDR_LEN; i++)
+    { mac[i] = (unsigned char)b[i]; }
+    return 0;
+}
+
+static int read_ifconfig(struct sr_instance* sr, const char* path, int arp)
+{
+    FILE* fp = fopen(path, "r");
+    char line[256], name[64], ip[64], macs[64];
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    int lineno = 0;
+
+    if (!fp)
+    { perror(path); return -1; }
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if (sscanf(line, "%63s", name) != 1 || name[0] == '#')
+        { continue; }
+        if (sscanf(line, "%63s %63s %63s", name, ip, macs) != 3 ||
+            inet_aton(ip, &addr) == 0 || parse_mac(macs, mac) != 0)
+        {
+            fprintf(stderr, "%s:%d: expected \"name ip mac\"\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+        if (!strcmp(name, "arp"))
+        {
+            if (arp)
+            { sr_arpcache_insert(&sr->cache, mac, addr.s_addr); }
+        }
+        else if (!arp)
+        {
+            if (sr->if_count == SR_IF_MAX)
+            { fprintf(stderr, "%s: more than %d interfaces\n", path, SR_IF_MAX); fclose(fp); return -1; }
+            sr_add_interface(sr, name);
+            sr_set_ether_addr(sr, mac);
+            sr_set_ether_ip(sr, addr.s_addr);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Route updates during the replay (-u)
+ *---------------------------------------------------------------------*/
+
+struct bench_updater
+{
+    struct sr_instance*  sr;
+    struct sr_rt_change* del;
+    struct sr_rt_change* add;
+    unsigned int         batch;
+    volatile int         stop;
+    uint64_t             batches;
+    double               secs;
+};
+
+static void* bench_update_main(void* arg)
+{
+    struct bench_updater* u = arg;
+    double t0 = now_sec();
+
+    uncounted = 1;
+    while (!u->stop)
+    {
+        if (sr_rt_update(u->sr, (u->batches & 1) ? u->add : u->del, u->batch) < 0)
+        { break; }
+        u->batches++;
+    }
+    u->secs = now_sec() - t0;
+    return 0;
+}
+
+/* batch routes with a gateway, spread over the table */
+static int bench_update_init(struct sr_instance* sr, struct bench_updater* u,
+                             unsigned int batch)
+{
+    struct sr_rt* rt_walker;
+    unsigned int n = 0, step, i = 0;
+
+    memset(u, 0, sizeof(*u));
+    u->sr = sr;
+    for (rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    { n += rt_walker->gw.s_addr != 0; }
+    if (batch > n)
+    { batch = n; }
+    if (batch == 0)
+    { fprintf(stderr, "no routes with a gateway to update\n"); return -1; }
+    step = n / batch;
+
+    u->del = calloc(batch, sizeof(struct sr_rt_change));
+    u->add = calloc(batch, sizeof(struct sr_rt_change));
+    for (rt_walker = sr->routing_table, n = 0; rt_walker && i < batch;
+         rt_walker = rt_walker->next)
+    {
+        if (!rt_walker->gw.s_addr || n++ % step)
+        { continue; }
+        u->add[i].op = SR_RT_ADD;
+        u->add[i].dest = rt_walker->dest;
+        u->add[i].gw = rt_walker->gw;
+        u->add[i].mask = rt_walker->mask;
+        memcpy(u->add[i].interface, rt_walker->interface, sr_IFACE_NAMELEN);
+        u->del[i] = u->add[i];
+        u->del[i].op = SR_RT_DEL;
+        i++;
+    }
+    u->batch = i;
+    return 0;
+}
+
+static void usage(char* argv0)
+{
+    printf("Offline router benchmark\n");
+    printf("Format: %s -c interface file [-r routing table] [-n passes] \n", argv0);
+    printf("           [-b burst] [-o output capture] [-F list|poptrie|dir24-8]\n");
+    printf("           [-a arp cache entries] [-u route update batch]\n");
+    printf("           [-m counters segment, for sr_stat]\n");
+    printf("           [-E ICMP errors: rate=N,burst=N,src=N,srcburst=N]\n");
+    printf("           [-Q ARP queue: pkts=N,bytes=N,reqpkts=N,reqbytes=N,taildrop|headdrop,\n");
+    printf("               arprate=N,arpburst=N]\n");
+    printf("           [-D neighbour that never answers ARP]\n");
+    printf("           [-L error|warn|info|debug] capture\n");
+}
+
+int main(int argc, char** argv)
+{
+    char* rtable = "rtable";
+    char* ifconfig = 0;
+    char* output = 0;
+    char* stats = 0;
+    unsigned int passes = 10, burst = 1, update_batch = 0;
+    struct bench_updater updater;
+    pthread_t update_thread;
+    static struct sr_instance sr;  /* the ARP timer thread outlives main */
+    struct bench_trace trace;
+    struct sr_capture_opts capture_opts;
+    struct sr_ratelimit_opts icmp_opts;
+    uint8_t** bufs;
+    uint8_t* packets[SR_BURST_MAX];
+    unsigned int lens[SR_BURST_MAX];
+    int ifaces[SR_BURST_MAX];
+    uint64_t total;
+    double t0, t;
+    uint32_t i, p;
+    int c;
+
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    sr.fib_engine = SR_FIB_ENGINE_DEFAULT;
+    sr.arp_capacity = SR_ARPCACHE_SZ;
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    sr_log_level = SR_LOG_WARN;
+    sr_ratelimit_default_opts(&icmp_opts);
+    sr_arpq_default_limits(&sr.arpq_limits);
+
+    while ((c = getopt(argc, argv, "hc:r:n:b:o:F:a:u:m:E:Q:D:L:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'c': ifconfig = optarg; break;
+            case 'r': rtable = optarg; break;
+            case 'n': passes = atoi(optarg); break;
+            case 'b': burst = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 'a':
+                if (sr_arpcache_parse_capacity(&sr.arp_capacity, optarg) != 0)
+                { return 1; }
+                break;
+            case 'u': update_batch = atoi(optarg); break;
+            case 'm': stats = optarg; break;
+            case 'E':
+                if (sr_ratelimit_parse_opts(&icmp_opts, optarg) != 0)
+                { return 1; }
+                break;
+            case 'Q':
+                if (sr_arpq_parse_limits(&sr.arpq_limits, optarg) != 0)
+                { return 1; }
+                break;
+            case 'D':
+                if (inet_pton(AF_INET, optarg, &silent_ip) != 1)
+                { fprintf(stderr, "Bad address %s\n", optarg); return 1; }
+                break;
+            case 'F':
+                if ((c = sr_fib_engine_parse(optarg)) < 0)
+                { fprintf(stderr, "Unknown FIB engine %s\n", optarg); return 1; }
+                sr.fib_engine = c;
+                break;
+            case 'L':
+                if ((sr_log_level = sr_log_parse_level(optarg)) < 0)
+                { fprintf(stderr, "Unknown log level %s\n", optarg); return 1; }
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!ifconfig || optind != argc - 1)
+    { usage(argv[0]); return 1; }
+    if (burst < 1 || burst > SR_BURST_MAX)
+    { fprintf(stderr, "burst must be 1..%d\n", SR_BURST_MAX); return 1; }
+
+    if ((stats && sr_stats_open(stats) != 0) ||
+        sr_ratelimit_init(&sr.icmp_limit, &icmp_opts) != 0)
+    { return 1; }
+
+    /* -- interfaces first, so the routes bind to them as they load -- */
+    memset(&trace, 0, sizeof(trace));
+    if (read_ifconfig(&sr, ifconfig, 0) != 0 || sr.if_count == 0 ||
+        sr_load_rt(&sr, rtable) != 0 || read_capture(argv[optind], &trace) != 0)
+    { return 1; }
+    if (trace.n == 0)
+    { fprintf(stderr, "%s: no frames\n", argv[optind]); return 1; }
+    sr_init(&sr);
+    if (read_ifconfig(&sr, ifconfig, 1) != 0)
+    { return 1; }
+
+    for (i = 0; i < trace.n; i++)
+    {
+        struct sr_if* in = 0;
+        if (trace.frames[i].len >= ETHER_ADDR_LEN)
+        { in = get_interface_from_eth(&sr, trace.frames[i].data); }
+        trace.frames[i].iface = in ? in->id : 0;
+    }
+
+    if (output)
+    {
+        sr_capture_default_opts(&capture_opts, 65535);
+        if ((out_cap = sr_capture_open(output, &capture_opts)) == 0)
+        { fprintf(stderr, "Error opening %s\n", output); return 1; }
+    }
+
+    /* -- the router rewrites frames in place: work on copies -- */
+    bufs = malloc(burst * sizeof(uint8_t*));
+    for (i = 0; i < burst; i++)
+    { bufs[i] = malloc(SR_PACKET_HEADROOM + trace.maxlen + 1); }
+
+    printf("%u frames, %u passes, %s, burst %u, %s FIB\n", trace.n, passes,
+           argv[optind], burst, sr_fib_engine_name(sr.fib_engine));
+
+    if (update_batch)
+    {
+        if (bench_update_init(&sr, &updater, update_batch) != 0 ||
+            pthread_create(&update_thread, 0, bench_update_main, &updater) != 0)
+        { return 1; }
+    }
+
+    counting = 1;
+    t0 = now_sec();
+    for (p = 0; p < passes; p++)
+    {
+        for (i = 0; i < trace.n; i += burst)
+        {
+            unsigned int k, n = trace.n - i < burst ? trace.n - i : burst;
+
+            for (k = 0; k < n; k++)
+            {
+                struct bench_frame* f = &trace.frames[i + k];
+                packets[k] = bufs[k] + SR_PACKET_HEADROOM;
+                memcpy(packets[k], f->data, f->len);
+                lens[k] = f->len;
+                ifaces[k] = f->iface;
+            }
+            if (burst == 1)
+            { sr_handlepacket(&sr, packets[0], lens[0], sr.if_table[ifaces[0]]->name); }
+            else
+            { sr_handlepacket_burst(&sr, packets, lens, ifaces, n); }
+            if (nreplies)
+            { deliver_replies(&sr); }
+        }
+    }
+    t = now_sec() - t0;
+    counting = 0;
+    if (update_batch)
+    {
+        updater.stop = 1;
+        pthread_join(update_thread, 0);
+    }
+
+    total = (uint64_t)trace.n * passes;
+    printf("%llu packets in %.3f s: %.0f pkts/s, %.1f ns/pkt\n",
+           (unsigned long long)total, t, total / t, t * 1e9 / total);
+#ifdef SR_BENCH_COUNT_MALLOC
+    printf("%.4f allocations/pkt (%llu)\n", (double)nallocs / total,
+           (unsigned long long)nallocs);
+#else
+    printf("allocations/pkt: not counted on this platform\n");
+#endif
+    printf("sent %llu frames, %llu bytes; %llu ARP requests seen\n",
+           (unsigned long long)sent_frames, (unsigned long long)sent_bytes,
+           (unsigned long long)arp_requests);
+    if (update_batch)
+    {
+        printf("route updates: %llu batches of %u, %.0f routes/s, %.2f ms/batch\n",
+               (unsigned long long)updater.batches, updater.batch,
+               updater.batches * updater.batch / updater.secs,
+               updater.batches ? updater.secs * 1e3 / updater.batches : 0.0);
+    }
+    sr_pool_print_stats(stdout);
+    sr_flow_print_stats(stdout);
+    sr_arpcache_print_queue_stats(&sr.cache, stdout);
+    sr_stats_print(stdout);
+    sr_stats_close();
+
+    if (out_cap)
+    { sr_capture_close(out_cap); }
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.c
+ *
+ * Description:
+ *
+ * Internet checksum, see sr_cksum.h. All versions return the checksum
+ * ready to be stored in a header, and never return 0 (0xffff instead),
+ * exactly like the byte-at-a-time loop they replace.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_cksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SR_CKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+/* Ones' complement sum of len bytes, host order, not yet folded. */
+static uint64_t sum_words(const uint8_t* data, size_t len, uint64_t acc)
+{
+    uint64_t w;
+    uint32_t w32;
+    uint16_t w16;
+
+    while ( len >= 8 )
+    {
+        memcpy(&w, data, 8);
+        acc += (w & 0xffffffffu) + (w >> 32);
+        data += 8;
+        len -= 8;
+    }
+    if ( len >= 4 )
+    {
+        memcpy(&w32, data, 4);
+        acc += w32;
+        data += 4;
+        len -= 4;
+    }
+    if ( len >= 2 )
+    {
+        memcpy(&w16, data, 2);
+        acc += w16;
+        data += 2;
+        len -= 2;
+    }
+    if ( len )
+    {
+        /* -- the odd byte is the first of a zero-padded word -- */
+        w16 = 0;
+        memcpy(&w16, data, 1);
+        acc += w16;
+    }
+    return acc;
+}
+
+static uint16_t fold(uint64_t acc)
+{
+    acc = (acc >> 32) + (acc & 0xffffffffu);
+    acc = (acc >> 32) + (acc & 0xffffffffu);
+    acc = (acc >> 16) + (acc & 0xffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+    return (uint16_t)acc;
+}
+
+static uint16_t finish(uint64_t acc)
+{
+    uint16_t sum = ~fold(acc);
+    return sum ? sum : 0xffff;
+}
+
+uint16_t cksum_generic(const void* data, int len)
+{
+    return finish(sum_words(data, len, 0));
+} /* -- cksum_generic -- */
+
+#ifdef SR_CKSUM_X86
+
+/*---------------------------------------------------------------------
+ * Method: sum_avx2(..)
+ * Scope: Local
+ *
+ * 32 bytes per step: the 16-bit words are widened into 32-bit lanes and
+ * added, and the lanes are emptied into the 64-bit total often enough
+ * that they cannot overflow.
+ *
+ *---------------------------------------------------------------------*/
+
+__attribute__ ((target ("avx2")))
+static uint64_t sum_avx2(const uint8_t* data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t acc = 0;
+
+    while ( len >= 32 )
+    {
+        __m256i lanes = _mm256_setzero_si256();
+        uint32_t part[8];
+        size_t steps = len / 32;
+        size_t i;
+
+        if ( steps > 16384 )
+        { steps = 16384; }  /* 2 * 0xffff per lane per step */
+        for ( i = 0; i < steps; i++ )
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)data);
+            lanes = _mm256_add_epi32(lanes, _mm256_unpacklo_epi16(v, zero));
+            lanes = _mm256_add_epi32(lanes, _mm256_unpackhi_epi16(v, zero));
+            data += 32;
+        }
+        len -= steps * 32;
+
+        _mm256_storeu_si256((__m256i*)part, lanes);
+        for ( i = 0; i < 8; i++ )
+        { acc += part[i]; }
+    }
+    return sum_words(data, len, acc);
+}
+
+uint16_t cksum_avx2(const void* data, int len)
+{
+    return finish(sum_avx2(data, len));
+} /* -- cksum_avx2 -- */
+
+int cksum_have_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+uint16_t cksum_avx2(const void* data, int len)
+{
+    return cksum_generic(data, len);
+} /* -- cksum_avx2 -- */
+
+int cksum_have_avx2(void)
+{
+    return 0;
+}
+
+#endif /* SR_CKSUM_X86 */
+
+static uint16_t cksum_select(const void* data, int len);
+
+/* -- set on the first long checksum; workers may get there together, but
+   every thread picks the same, so atomic accesses are all it takes -- */
+static uint16_t (*cksum_long)(const void*, int) = cksum_select;
+
+static uint16_t cksum_select(const void* data, int len)
+{
+    uint16_t (*f)(const void*, int) = cksum_have_avx2() ? cksum_avx2 : cksum_generic;
+
+    __atomic_store_n(&cksum_long, f, __ATOMIC_RELAXED);
+    return f(data, len);
+}
+
+const char* cksum_impl_name(void)
+{
+    return cksum_have_avx2() ? "avx2" : "generic";
+}
+
+/*---------------------------------------------------------------------
+ * Method: cksum(..)
+ * Scope: Global
+ *
+ * Headers are too short for the vector loop to pay for itself, so only
+ * longer buffers (ICMP payloads) go through the CPU-specific version.
+ *
+ *---------------------------------------------------------------------*/
+
+uint16_t cksum(const void* _data, int len)
+{
+    if ( len < SR_CKSUM_SIMD_MIN )
+    { return cksum_generic(_data, len); }
+    return __atomic_load_n(&cksum_long, __ATOMIC_RELAXED)(_data, len);
+} /* -- cksum -- */
+
+/*---------------------------------------------------------------------
+ * Method: cksum_ok(..)
+ * Scope: Global
+ *
+ * A header is intact when the sum over it, checksum field included,
+ * is all ones.
+ *
+ *---------------------------------------------------------------------*/
+
+int cksum_ok(const void* data, int len)
+{
+    return fold(sum_words(data, len, 0)) == 0xffff;
+} /* -- cksum_ok -- */
+
+/*---------------------------------------------------------------------
+ * Method: cksum_update16(..)
+ * Scope: Global
+ *
+ * New checksum after one 16-bit word covered by it changes from old_w
+ * to new_w, RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m'). All three values
+ * as they are stored in the packet.
+ *
+ *---------------------------------------------------------------------*/
+
+uint16_t cksum_update16(uint16_t sum, uint16_t old_w, uint16_t new_w)
+{
+    uint32_t acc = (uint16_t)~sum;
+
+    acc += (uint16_t)~old_w;
+    acc += new_w;
+    acc = (acc >> 16) + (acc & 0xffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+    return (uint16_t)~acc;
+} /* -- cksum_update16 -- */
@@ -0,0 +1,33 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.h
+ * Description:
+ *
+ * Internet checksum (RFC 1071) implementations behind cksum() in
+ * sr_utils.h. Words are summed in host byte order, which gives the same
+ * ones' complement result once stored back (RFC 1071 section 2(B)), so
+ * no byte swapping is needed. cksum() picks the AVX2 version at run time
+ * when the CPU has it and the buffer is long enough to benefit.
+ *
+ * The individual versions are exported for cksum_bench.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_CKSUM_H
+#define sr_CKSUM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_CKSUM_SIMD_MIN 64   /* shorter buffers always use the word loop */
+
+uint16_t    cksum_generic(const void* data, int len);   /* 8 bytes at a time */
+uint16_t    cksum_avx2(const void* data, int len);      /* cksum_generic without AVX2 */
+int         cksum_have_avx2(void);
+const char* cksum_impl_name(void);
+
+#endif  /* --  sr_CKSUM_H -- */
@@ -0,0 +1,178 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum_bench.c
+ *
+ * Description:
+ *
+ * Checks every checksum version against the original byte-at-a-time
+ * loop for all lengths 0..1500 at every alignment 0..7, checks the
+ * RFC 1624 update against a full recompute, then times each version.
+ * Exits non-zero on any mismatch. Usage: cksum_bench [iterations]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_cksum.h"
+
+#define MAX_LEN 1500
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* cksum() as it was in sr_utils.c */
+static uint16_t cksum_ref(const void *_data, int len)
+{
+    const uint8_t *data = _data;
+    uint32_t sum;
+
+    for (sum = 0;len >= 2; data += 2, len -= 2)
+        sum += data[0] << 8 | data[1];
+    if (len > 0)
+        sum += data[0] << 8;
+    while (sum > 0xffff)
+        sum = (sum >> 16) + (sum & 0xffff);
+    sum = htons (~sum);
+    return sum ? sum : 0xffff;
+}
+
+struct impl
+{
+    const char* name;
+    uint16_t (*fn)(const void*, int);
+};
+
+static int check(const struct impl* impls, int nimpls)
+{
+    static uint8_t buf[MAX_LEN + 64];
+    int fill, len, off, k, errors = 0;
+
+    for (fill = 0; fill < 3; fill++)
+    {
+        /* -- random bytes, all ones (worst case carries), all zeros -- */
+        for (k = 0; k < (int)sizeof(buf); k++)
+            buf[k] = fill == 0 ? rng() : fill == 1 ? 0xff : 0;
+
+        for (len = 0; len <= MAX_LEN; len++)
+            for (off = 0; off < 8; off++)
+            {
+                uint16_t want = cksum_ref(buf + off, len);
+                for (k = 0; k < nimpls; k++)
+                    if (impls[k].fn(buf + off, len) != want && errors++ < 10)
+                        fprintf(stderr, "MISMATCH %s len %d off %d fill %d: %04x != %04x\n",
+                                impls[k].name, len, off, fill,
+                                impls[k].fn(buf + off, len), want);
+            }
+    }
+    return errors;
+}
+
+/* TTL decrement by RFC 1624 against a full recompute, for random headers */
+static int check_update(void)
+{
+    sr_ip_hdr_t ip;
+    int i, errors = 0;
+
+    for (i = 0; i < 1000000; i++)
+    {
+        uint16_t old_w, new_w, want;
+        uint8_t* b = (uint8_t*)&ip;
+        unsigned k;
+
+        for (k = 0; k < sizeof(ip); k++)
+            b[k] = rng();
+        ip.ip_ttl |= 1;
+        ip.ip_sum = 0;
+        ip.ip_sum = cksum(&ip, sizeof(ip));
+        if (!cksum_ok(&ip, sizeof(ip)))
+        {
+            if (errors++ < 10)
+                fprintf(stderr, "cksum_ok rejected a valid header\n");
+            continue;
+        }
+
+        memcpy(&old_w, &ip.ip_ttl, 2);
+        ip.ip_ttl--;
+        memcpy(&new_w, &ip.ip_ttl, 2);
+        ip.ip_sum = cksum_update16(ip.ip_sum, old_w, new_w);
+        if (!cksum_ok(&ip, sizeof(ip)))
+        {
+            if (errors++ < 10)
+                fprintf(stderr, "incremental update produced a bad header\n");
+            continue;
+        }
+        /* -- equal to a fresh sum, up to the two forms of zero -- */
+        want = ip.ip_sum;
+        ip.ip_sum = 0;
+        ip.ip_sum = cksum(&ip, sizeof(ip));
+        if (want != ip.ip_sum && !(want == 0 && ip.ip_sum == 0xffff) && errors++ < 10)
+            fprintf(stderr, "update %04x != recompute %04x\n", want, ip.ip_sum);
+    }
+    return errors;
+}
+
+static void time_impl(const struct impl* im, const uint8_t* buf, int len, long iters)
+{
+    volatile uint16_t sink = 0;
+    double t0, t1;
+    long i;
+
+    t0 = now_sec();
+    for (i = 0; i < iters; i++)
+        sink += im->fn(buf, len);
+    t1 = now_sec();
+    (void)sink;
+    printf("  %-9s %5d bytes  %7.1f ns/call  %6.2f GB/s\n", im->name, len,
+           (t1 - t0) * 1e9 / iters, (double)len * iters / (t1 - t0) / 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t buf[MAX_LEN];
+    static const int lens[] = { 20, 64, 98, 576, 1500 };
+    struct impl impls[4];
+    long iters = argc > 1 ? atol(argv[1]) : 2000000;
+    int nimpls = 0, i, k, errors;
+
+    impls[nimpls].name = "original"; impls[nimpls++].fn = cksum_ref;
+    impls[nimpls].name = "generic";  impls[nimpls++].fn = cksum_generic;
+    if (cksum_have_avx2())
+    { impls[nimpls].name = "avx2"; impls[nimpls++].fn = cksum_avx2; }
+    impls[nimpls].name = "cksum";    impls[nimpls++].fn = cksum;
+
+    errors = check(impls + 1, nimpls - 1);
+    errors += check_update();
+    printf("differential check (0..%d bytes, 8 alignments): %s\n", MAX_LEN,
+           errors ? "FAILED" : "ok");
+    if (errors)
+        return 1;
+
+    printf("cksum() uses %s for %d bytes and up\n", cksum_impl_name(), SR_CKSUM_SIMD_MIN);
+    for (k = 0; k < MAX_LEN; k++)
+        buf[k] = rng();
+    for (i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++)
+        for (k = 0; k < nimpls; k++)
+            time_impl(&impls[k], buf, lens[i], iters);
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.c
+ *
+ * Description:
+ *
+ * Control socket, see sr_ctl.h. Route changes go into a batch, which is
+ * applied when a line of another kind comes up, when it is full, or when
+ * the client has nothing more queued on the socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_ctl.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_router.h"
+
+#define SR_CTL_BUFSZ 65536
+
+struct sr_ctl
+{
+    struct sr_instance*  sr;
+    int                  listen_fd;
+    int                  fd;            /* current client */
+    struct sr_rt_change* batch;
+    unsigned int         nbatch;
+    int                  gone;          /* the client stopped reading */
+};
+
+static void ctl_reply(struct sr_ctl* ctl, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void ctl_reply(struct sr_ctl* ctl, const char* fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(line))
+    { len = sizeof(line) - 1; }
+    /* -- a client that closed just misses its answers, its changes are
+       still applied; MSG_NOSIGNAL keeps SIGPIPE from killing the router -- */
+    if (ctl->gone)
+    { return; }
+    if (send(ctl->fd, line, len, MSG_NOSIGNAL) < 0 &&
+        (errno == EPIPE || errno == ECONNRESET))
+    { ctl->gone = 1; }
+}
+
+static double ctl_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+static unsigned int ctl_route_count(struct sr_instance* sr, size_t* fib_bytes)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    n = sr->fib ? sr->fib->nroutes - 1 : 0;
+    *fib_bytes = sr_fib_memory(sr->fib);
+    pthread_mutex_unlock(&(sr->rt_lock));
+    return n;
+}
+
+/*---------------------------------------------------------------------
+ * Method: ctl_flush(..)
+ * Scope: Local
+ *
+ * Apply the batched changes and answer for them.
+ *
+ *---------------------------------------------------------------------*/
+
+static void ctl_flush(struct sr_ctl* ctl)
+{
+    double t0;
+    int applied;
+    size_t bytes;
+
+    if (ctl->nbatch == 0)
+    { return; }
+    t0 = ctl_now_ms();
+    applied = sr_rt_update(ctl->sr, ctl->batch, ctl->nbatch);
+    if (applied < 0)
+    { ctl_reply(ctl, "error: %u changes not applied, out of memory\n", ctl->nbatch); }
+    else
+    {
+        double ms = ctl_now_ms() - t0;
+        ctl_reply(ctl, "ok %d of %u changes, %u routes, %.3f ms (%.0f routes/s)\n",
+                  applied, ctl->nbatch, ctl_route_count(ctl->sr, &bytes), ms,
+                  ms > 0 ? ctl->nbatch * 1e3 / ms : 0.0);
+    }
+    ctl->nbatch = 0;
+} /* -- ctl_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: ctl_command(..)
+ * Scope: Local
+ *
+ * Handle one line of input: route changes are added to the batch, any
+ * other command flushes it first.
+ *
+ *---------------------------------------------------------------------*/
+
+static void ctl_command(struct sr_ctl* ctl, char* line)
+{
+    char cmd[16], a[32], b[32], c[32], iface[32];
+    int nf = sscanf(line, "%15s %31s %31s %31s %31s", cmd, a, b, c, iface);
+    struct sr_rt_change* ch = &ctl->batch[ctl->nbatch];
+
+    if (nf <= 0 || cmd[0] == '#')
+    { return; }
+
+    if (!strcmp(cmd, "add") || !strcmp(cmd, "del"))
+    {
+        memset(ch, 0, sizeof(*ch));
+        if (!strcmp(cmd, "add"))
+        {
+            ch->op = SR_RT_ADD;
+            if (nf != 5 || !inet_aton(a, &ch->dest) || !inet_aton(b, &ch->gw) ||
+                !inet_aton(c, &ch->mask))
+            {
+                ctl_flush(ctl);
+                ctl_reply(ctl, "error: usage: add <dest> <gateway> <mask> <interface>\n");
+                return;
+            }
+            snprintf(ch->interface, sizeof(ch->interface), "%s", iface);
+        }
+        else
+        {
+            ch->op = SR_RT_DEL;
+            if (nf != 3 || !inet_aton(a, &ch->dest) || !inet_aton(b, &ch->mask))
+            {
+                ctl_flush(ctl);
+                ctl_reply(ctl, "error: usage: del <dest> <mask>\n");
+                return;
+            }
+        }
+        if (++ctl->nbatch == SR_CTL_BATCH_MAX)
+        { ctl_flush(ctl); }
+        return;
+    }
+
+    ctl_flush(ctl);
+    if (!strcmp(cmd, "load") && nf == 2)
+    {
+        double t0 = ctl_now_ms();
+        size_t bytes;
+
+        if (sr_load_rt(ctl->sr, a) != 0)
+        { ctl_reply(ctl, "error: could not load %s\n", a); }
+        else
+        {
+            ctl_reply(ctl, "ok %u routes, %.3f ms\n",
+                      ctl_route_count(ctl->sr, &bytes), ctl_now_ms() - t0);
+        }
+    }
+    else if (!strcmp(cmd, "show") && nf == 1)
+    {
+        size_t bytes;
+        unsigned int n = ctl_route_count(ctl->sr, &bytes);
+
+        ctl_reply(ctl, "ok %u routes, %s FIB, %.1f KB\n", n,
+                  sr_fib_engine_name(ctl->sr->fib_engine), bytes / 1024.0);
+    }
+    else
+    { ctl_reply(ctl, "error: unknown command %s\n", cmd); }
+} /* -- ctl_command -- */
+
+static void ctl_serve(struct sr_ctl* ctl)
+{
+    static char buf[SR_CTL_BUFSZ + 1];
+    size_t have = 0;
+    ssize_t got;
+
+    for (;;)
+    {
+        char* line = buf;
+        char* eol;
+
+        got = recv(ctl->fd, buf + have, SR_CTL_BUFSZ - have, MSG_DONTWAIT);
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            /* -- nothing more queued behind these lines: answer now -- */
+            ctl_flush(ctl);
+            got = recv(ctl->fd, buf + have, SR_CTL_BUFSZ - have, 0);
+        }
+        if (got < 0 && errno == EINTR)
+        { continue; }
+        if (got <= 0)
+        { break; }
+
+        have += got;
+        buf[have] = 0;
+        while ((eol = memchr(line, '\n', buf + have - line)) != 0)
+        {
+            *eol = 0;
+            ctl_command(ctl, line);
+            line = eol + 1;
+        }
+
+        have -= line - buf;
+        memmove(buf, line, have);
+        if (have == SR_CTL_BUFSZ)
+        {
+            ctl_reply(ctl, "error: line too long\n");
+            have = 0;
+        }
+    }
+    if (have)
+    {
+        buf[have] = 0;
+        ctl_command(ctl, buf);
+    }
+    ctl_flush(ctl);
+}
+
+static void* ctl_main(void* arg)
+{
+    struct sr_ctl* ctl = arg;
+
+    for (;;)
+    {
+        if ((ctl->fd = accept(ctl->listen_fd, 0, 0)) < 0)
+        {
+            if (errno != EINTR)
+            { perror("sr_ctl: accept"); }
+            continue;
+        }
+        ctl->gone = 0;
+        ctl_serve(ctl);
+        close(ctl->fd);
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_start(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_start(struct sr_instance* sr, const char* path)
+{
+    struct sockaddr_un addr;
+    struct sr_ctl* ctl;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "sr_ctl: socket path %s too long\n", path);
+        return -1;
+    }
+    ctl = calloc(1, sizeof(*ctl));
+    if (!ctl || (ctl->batch = malloc(SR_CTL_BATCH_MAX * sizeof(struct sr_rt_change))) == 0)
+    {
+        fprintf(stderr, "sr_ctl: out of memory\n");
+        free(ctl);
+        return -1;
+    }
+    ctl->sr = sr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ((ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(ctl->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(ctl->listen_fd, 4) != 0)
+    {
+        perror("sr_ctl");
+        goto fail;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, ctl_main, ctl) != 0)
+    {
+        perror("sr_ctl: pthread_create");
+        pthread_attr_destroy(&attr);
+        goto fail;
+    }
+    pthread_attr_destroy(&attr);
+    printf("Route control socket on %s\n", path);
+    return 0;
+
+fail:
+    if (ctl->listen_fd >= 0)
+    {
+        close(ctl->listen_fd);
+        unlink(path);
+    }
+    free(ctl->batch);
+    free(ctl);
+    return -1;
+} /* -- sr_ctl_start -- */
@@ -0,0 +1,35 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.h
+ * Description:
+ *
+ * Control socket for changing routes while the router runs (-c path). A
+ * thread listens on a Unix stream socket and takes one command per line:
+ *
+ *     add <dest> <gateway> <mask> <interface>
+ *     del <dest> <mask>
+ *     load <file>          replace the whole table (text or image)
+ *     show                 route count and FIB size
+ *
+ * and answers each with one line starting "ok" or "error". Consecutive
+ * add and del lines that arrive together are applied as one batch (one
+ * sr_rt_update) and answered once, with the time the batch took, so a
+ * client streaming many changes gets them applied at bulk speed, e.g.
+ *
+ *     sed 's/^/add /' rtable.new | nc -U sr.ctl
+ *
+ * Changes never stop the forwarding threads, see sr_rt.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_CTL_H
+#define sr_CTL_H
+
+#define SR_CTL_BATCH_MAX 65536   /* changes applied in one update at most */
+
+struct sr_instance;
+
+/* Listen on path, replacing a stale socket there, and serve clients one
+   at a time from a new thread. Call after sr_init. */
+int sr_ctl_start(struct sr_instance* sr, const char* path);
+
+#endif  /* --  sr_CTL_H -- */
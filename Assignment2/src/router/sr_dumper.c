@@ -1,8 +1,16 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "sr_dumper.h"
+#include "sr_filter.h"
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -69,3 +77,440 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+/* ----------------------------------------------------------------------------
+ * Capture engine, see sr_dumper.h
+ * -------------------------------------------------------------------------- */
+
+#define CAP_FREE    0
+#define CAP_FILLING 1
+#define CAP_FULL    2
+
+struct sr_capture_buf {
+        uint8_t *data;
+        uint32_t used;
+        int      state;
+        uint64_t first_ns;      /* when the first record went in */
+};
+
+struct sr_capture {
+        char    *path;
+        struct sr_capture_opts opts;
+        int      fd;
+        uint64_t file_bytes;
+        uint64_t file_opened_ns;
+        uint32_t file_index;
+
+        pthread_mutex_t lock;   /* guards everything below */
+        pthread_cond_t  wake;
+        struct sr_capture_buf bufs[SR_CAPTURE_BUFS];
+        uint64_t fill_seq;      /* buffer being filled, mod SR_CAPTURE_BUFS */
+        uint64_t write_seq;     /* next buffer to write; fill_seq + 1 once
+                                   the writer has caught up with a full one */
+        int      stop;
+        pthread_t writer;
+        struct sr_capture_stats stats;
+        struct sr_capture_stats wstats; /* writer's own counters, no lock */
+};
+
+static uint64_t
+cap_now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+cap_mono_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+sr_capture_default_opts(struct sr_capture_opts *opts, uint32_t snaplen)
+{
+        memset(opts, 0, sizeof(*opts));
+        opts->format = SR_CAPTURE_PCAP;
+        opts->snaplen = snaplen;
+}
+
+int
+sr_capture_parse_opts(struct sr_capture_opts *opts, const char *spec)
+{
+        char *copy = strdup(spec), *save = 0, *item;
+        int ret = 0;
+
+        for (item = strtok_r(copy, ",", &save); item;
+             item = strtok_r(0, ",", &save)) {
+                char *end;
+                if (strcmp(item, "pcap") == 0)
+                        opts->format = SR_CAPTURE_PCAP;
+                else if (strcmp(item, "pcapng") == 0)
+                        opts->format = SR_CAPTURE_PCAPNG;
+                else if (strncmp(item, "snaplen=", 8) == 0)
+                        opts->snaplen = strtoul(item + 8, 0, 10);
+                else if (strncmp(item, "secs=", 5) == 0)
+                        opts->rotate_secs = strtoul(item + 5, 0, 10);
+                else if (strncmp(item, "size=", 5) == 0) {
+                        opts->rotate_bytes = strtoull(item + 5, &end, 10);
+                        if (*end == 'k' || *end == 'K')
+                                opts->rotate_bytes <<= 10;
+                        else if (*end == 'm' || *end == 'M')
+                                opts->rotate_bytes <<= 20;
+                        else if (*end == 'g' || *end == 'G')
+                                opts->rotate_bytes <<= 30;
+                }
+                else {
+                        fprintf(stderr, "sr_capture: unknown option %s\n", item);
+                        ret = -1;
+                }
+        }
+        free(copy);
+        return ret;
+}
+
+static void
+cap_put32(uint8_t **p, uint32_t v)
+{
+        memcpy(*p, &v, 4);
+        *p += 4;
+}
+
+static void
+cap_put16(uint8_t **p, uint16_t v)
+{
+        memcpy(*p, &v, 2);
+        *p += 2;
+}
+
+/* File header (pcap) or section and interface blocks (pcapng). */
+static uint32_t
+cap_file_header(const struct sr_capture *cap, uint8_t *out)
+{
+        uint8_t *p = out;
+
+        if (cap->opts.format == SR_CAPTURE_PCAP) {
+                struct pcap_file_header hdr;
+
+                hdr.magic = TCPDUMP_MAGIC;
+                hdr.version_major = PCAP_VERSION_MAJOR;
+                hdr.version_minor = PCAP_VERSION_MINOR;
+                hdr.thiszone = 0;
+                hdr.snaplen = cap->opts.snaplen;
+                hdr.sigfigs = 0;
+                hdr.linktype = LINKTYPE_ETHERNET;
+                memcpy(p, &hdr, sizeof(hdr));
+                return sizeof(hdr);
+        }
+
+        /* -- section header block, no options, unknown section length -- */
+        cap_put32(&p, PCAPNG_SHB);
+        cap_put32(&p, 28);
+        cap_put32(&p, PCAPNG_BOM);
+        cap_put16(&p, 1);
+        cap_put16(&p, 0);
+        cap_put32(&p, 0xffffffff);
+        cap_put32(&p, 0xffffffff);
+        cap_put32(&p, 28);
+
+        /* -- one Ethernet interface, timestamps in nanoseconds -- */
+        cap_put32(&p, PCAPNG_IDB);
+        cap_put32(&p, 32);
+        cap_put16(&p, LINKTYPE_ETHERNET);
+        cap_put16(&p, 0);
+        cap_put32(&p, cap->opts.snaplen);
+        cap_put16(&p, PCAPNG_OPT_TSRESOL);
+        cap_put16(&p, 1);
+        *p++ = 9; *p++ = 0; *p++ = 0; *p++ = 0;
+        cap_put32(&p, 0);               /* opt_endofopt */
+        cap_put32(&p, 32);
+        return p - out;
+}
+
+/* Bytes a frame of caplen takes up in the file. */
+static uint32_t
+cap_record_len(const struct sr_capture *cap, uint32_t caplen)
+{
+        if (cap->opts.format == SR_CAPTURE_PCAP)
+                return sizeof(struct pcap_sf_pkthdr) + caplen;
+        return 32 + ((caplen + 3) & ~3u);
+}
+
+static void
+cap_record(const struct sr_capture *cap, uint8_t *p, uint64_t ns,
+           const uint8_t *frame, uint32_t caplen, uint32_t len)
+{
+        if (cap->opts.format == SR_CAPTURE_PCAP) {
+                struct pcap_sf_pkthdr sf_hdr;
+
+                sf_hdr.ts.tv_sec  = ns / 1000000000ULL;
+                sf_hdr.ts.tv_usec = (ns % 1000000000ULL) / 1000;
+                sf_hdr.caplen     = caplen;
+                sf_hdr.len        = len;
+                memcpy(p, &sf_hdr, sizeof(sf_hdr));
+                memcpy(p + sizeof(sf_hdr), frame, caplen);
+        }
+        else {
+                uint32_t total = cap_record_len(cap, caplen);
+
+                cap_put32(&p, PCAPNG_EPB);
+                cap_put32(&p, total);
+                cap_put32(&p, 0);               /* interface id */
+                cap_put32(&p, ns >> 32);
+                cap_put32(&p, (uint32_t)ns);
+                cap_put32(&p, caplen);
+                cap_put32(&p, len);
+                memcpy(p, frame, caplen);
+                memset(p + caplen, 0, ((caplen + 3) & ~3u) - caplen);
+                p += (caplen + 3) & ~3u;
+                cap_put32(&p, total);
+        }
+}
+
+/* Write all of buf; counts an error and gives up on failure. */
+static void
+cap_write(struct sr_capture *cap, const uint8_t *buf, uint32_t len)
+{
+        while (len > 0) {
+                ssize_t w = write(cap->fd, buf, len);
+                if (w < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        cap->wstats.write_errors++;
+                        return;
+                }
+                buf += w;
+                len -= w;
+                cap->file_bytes += w;
+                cap->wstats.bytes += w;
+        }
+}
+
+/*
+ * Open the next output file and write its header. Runs on the writer
+ * thread (and once from sr_capture_open, before it starts).
+ */
+static int
+cap_open_file(struct sr_capture *cap)
+{
+        uint8_t hdr[128];
+        char *name;
+        int rotating = cap->opts.rotate_bytes || cap->opts.rotate_secs;
+
+        if (cap->fd > 1)
+                close(cap->fd);
+        cap->fd = -1;
+
+        if (strcmp(cap->path, "-") == 0)
+                cap->fd = 1;
+        else if (!rotating)
+                cap->fd = open(cap->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        else if (asprintf(&name, "%s.%u", cap->path, cap->file_index) >= 0) {
+                cap->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                free(name);
+        }
+        if (cap->fd < 0) {
+                fprintf(stderr, "sr_capture: can't open %s\n", cap->path);
+                return -1;
+        }
+
+        cap->file_index++;
+        cap->wstats.files++;
+        cap->file_bytes = 0;
+        cap->file_opened_ns = cap_mono_ns();
+        cap_write(cap, hdr, cap_file_header(cap, hdr));
+        return 0;
+}
+
+static int
+cap_should_rotate(const struct sr_capture *cap, uint32_t next_len)
+{
+        if (cap->fd == 1)
+                return 0;
+        if (cap->opts.rotate_secs &&
+            cap_mono_ns() - cap->file_opened_ns >= cap->opts.rotate_secs * 1000000000ULL)
+                return 1;
+        /* -- a file always gets at least one buffer -- */
+        return cap->opts.rotate_bytes && cap->file_bytes > 128 &&
+               cap->file_bytes + next_len > cap->opts.rotate_bytes;
+}
+
+/*
+ * Writer thread. Writes full buffers in the order they were filled,
+ * and hands in the one being filled once it is old enough, so a quiet
+ * link still reaches the disk.
+ */
+static void *
+cap_writer(void *arg)
+{
+        struct sr_capture *cap = arg;
+
+        pthread_mutex_lock(&cap->lock);
+        while (1) {
+                struct sr_capture_buf *b = &cap->bufs[cap->write_seq % SR_CAPTURE_BUFS];
+                struct timespec until;
+
+                if (b->state == CAP_FILLING && b->used &&
+                    (cap->stop || cap_mono_ns() - b->first_ns >=
+                                  SR_CAPTURE_FLUSH_MS * 1000000ULL))
+                        b->state = CAP_FULL;
+
+                if (b->state == CAP_FULL) {
+                        /* -- write without the lock, the buffer is ours -- */
+                        pthread_mutex_unlock(&cap->lock);
+                        if (cap_should_rotate(cap, b->used))
+                                cap_open_file(cap);
+                        if (cap->fd >= 0)
+                                cap_write(cap, b->data, b->used);
+                        else
+                                cap->wstats.write_errors++;
+                        pthread_mutex_lock(&cap->lock);
+                        cap->stats.bytes = cap->wstats.bytes;
+                        cap->stats.files = cap->wstats.files;
+                        cap->stats.write_errors = cap->wstats.write_errors;
+                        b->used = 0;
+                        b->state = CAP_FREE;
+                        cap->write_seq++;
+                        continue;
+                }
+
+                if (cap->stop)
+                        break;
+
+                /* -- time based rotation on an idle link -- */
+                if (cap->opts.rotate_secs && cap_should_rotate(cap, 0)) {
+                        pthread_mutex_unlock(&cap->lock);
+                        cap_open_file(cap);
+                        pthread_mutex_lock(&cap->lock);
+                        cap->stats.files = cap->wstats.files;
+                        continue;
+                }
+
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_nsec += 100 * 1000000L;
+                if (until.tv_nsec >= 1000000000L) {
+                        until.tv_sec++;
+                        until.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&cap->wake, &cap->lock, &until);
+        }
+        pthread_mutex_unlock(&cap->lock);
+        return 0;
+}
+
+struct sr_capture *
+sr_capture_open(const char *path, const struct sr_capture_opts *opts)
+{
+        struct sr_capture *cap = calloc(1, sizeof(struct sr_capture));
+        int i;
+
+        if (cap == NULL)
+                return (NULL);
+        cap->path = strdup(path);
+        cap->opts = *opts;
+        if (cap->opts.snaplen == 0 || cap->opts.snaplen > SR_CAPTURE_BUF_SZ / 2)
+                cap->opts.snaplen = SR_CAPTURE_BUF_SZ / 2;
+        cap->fd = -1;
+        for (i = 0; i < SR_CAPTURE_BUFS; i++) {
+                if ((cap->bufs[i].data = malloc(SR_CAPTURE_BUF_SZ)) == NULL)
+                        goto fail;
+        }
+        if (cap_open_file(cap) != 0)
+                goto fail;
+        cap->stats = cap->wstats;
+
+        pthread_mutex_init(&cap->lock, 0);
+        pthread_cond_init(&cap->wake, 0);
+        if (pthread_create(&cap->writer, 0, cap_writer, cap) != 0)
+                goto fail;
+        return cap;
+
+fail:
+        if (cap->fd > 1)
+                close(cap->fd);
+        for (i = 0; i < SR_CAPTURE_BUFS; i++)
+                free(cap->bufs[i].data);
+        free(cap->path);
+        free(cap);
+        return (NULL);
+}
+
+/*
+ * Copy a frame into the buffer being filled. When it is full it is
+ * handed to the writer and the next one is taken, but only if the
+ * writer is done with it; otherwise the frame is dropped. Buffers are
+ * filled and written in the same order.
+ */
+void
+sr_capture_packet(struct sr_capture *cap, const uint8_t *frame, uint32_t len)
+{
+        uint32_t caplen = min(len, cap->opts.snaplen);
+        uint32_t rec = cap_record_len(cap, caplen);
+        uint64_t ns;
+        struct sr_capture_buf *b;
+
+        if (cap->opts.filter && !sr_filter_match(cap->opts.filter, frame, len))
+                return;
+        ns = cap_now_ns();
+        pthread_mutex_lock(&cap->lock);
+        if (cap->fill_seq < cap->write_seq)
+                cap->fill_seq = cap->write_seq;   /* ours was written */
+        b = &cap->bufs[cap->fill_seq % SR_CAPTURE_BUFS];
+        if (b->state == CAP_FULL || b->used + rec > SR_CAPTURE_BUF_SZ) {
+                if (b->state == CAP_FILLING) {
+                        b->state = CAP_FULL;
+                        pthread_cond_signal(&cap->wake);
+                }
+                if (cap->fill_seq + 1 >= cap->write_seq + SR_CAPTURE_BUFS) {
+                        cap->stats.dropped++;
+                        pthread_mutex_unlock(&cap->lock);
+                        return;
+                }
+                cap->fill_seq++;
+                b = &cap->bufs[cap->fill_seq % SR_CAPTURE_BUFS];
+        }
+        if (b->state == CAP_FREE) {
+                b->state = CAP_FILLING;
+                b->first_ns = cap_mono_ns();
+        }
+        cap_record(cap, b->data + b->used, ns, frame, caplen, len);
+        b->used += rec;
+        cap->stats.packets++;
+        pthread_mutex_unlock(&cap->lock);
+}
+
+void
+sr_capture_get_stats(struct sr_capture *cap, struct sr_capture_stats *stats)
+{
+        pthread_mutex_lock(&cap->lock);
+        *stats = cap->stats;
+        pthread_mutex_unlock(&cap->lock);
+}
+
+void
+sr_capture_close(struct sr_capture *cap)
+{
+        int i;
+
+        if (cap == NULL)
+                return;
+        pthread_mutex_lock(&cap->lock);
+        cap->stop = 1;
+        pthread_cond_signal(&cap->wake);
+        pthread_mutex_unlock(&cap->lock);
+        pthread_join(cap->writer, 0);
+
+        fprintf(stderr, "Capture: %llu packets, %llu dropped, %u files, %u write errors\n",
+                (unsigned long long)cap->stats.packets,
+                (unsigned long long)cap->stats.dropped,
+                cap->wstats.files, cap->wstats.write_errors);
+        if (cap->fd > 1)
+                close(cap->fd);
+        for (i = 0; i < SR_CAPTURE_BUFS; i++)
+                free(cap->bufs[i].data);
+        sr_filter_free(cap->opts.filter);
+        free(cap->path);
+        free(cap);
+}
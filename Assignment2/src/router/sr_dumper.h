@@ -77,3 +77,81 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+/* ----------------------------------------------------------------------------
+ * Capture engine
+ *
+ * sr_capture_packet copies a frame, already framed as a pcap or pcapng
+ * record, into one of SR_CAPTURE_BUFS buffers and returns; a writer
+ * thread writes each buffer out once it is full, or has been filling for
+ * SR_CAPTURE_FLUSH_MS. When every buffer is waiting for the disk the
+ * frame is counted as dropped instead of holding up the caller.
+ *
+ * With rotation, the output goes to <path>.0, <path>.1, ... and a new file
+ * is started once the current one would grow past rotate_bytes or has
+ * been open for rotate_secs, whichever comes first.
+ * -------------------------------------------------------------------------- */
+
+#define SR_CAPTURE_BUFS     4
+#define SR_CAPTURE_BUF_SZ   (1024 * 1024)
+#define SR_CAPTURE_FLUSH_MS 500
+
+/* pcapng block types and options used */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BOM 0x1A2B3C4D
+#define PCAPNG_OPT_TSRESOL 9
+
+enum sr_capture_format
+{
+  SR_CAPTURE_PCAP,      /* classic pcap, microseconds */
+  SR_CAPTURE_PCAPNG     /* pcapng, nanoseconds */
+};
+
+struct sr_filter;
+
+struct sr_capture_opts {
+  enum sr_capture_format format;
+  uint32_t snaplen;         /* bytes kept of each frame */
+  uint64_t rotate_bytes;    /* 0: no size limit */
+  uint32_t rotate_secs;     /* 0: no time limit */
+  struct sr_filter *filter; /* frames it rejects are skipped; 0: keep all */
+};
+
+struct sr_capture_stats {
+  uint64_t packets;         /* frames written to buffers */
+  uint64_t bytes;           /* bytes written to files */
+  uint64_t dropped;         /* frames lost to full buffers */
+  uint32_t files;           /* files opened */
+  uint32_t write_errors;
+};
+
+struct sr_capture;
+
+/**
+ * Defaults (pcap, snaplen, no rotation), then apply a comma separated
+ * list: pcap, pcapng, snaplen=N, size=N[k|m|g], secs=N. Returns -1 on an
+ * unknown item.
+ */
+void sr_capture_default_opts(struct sr_capture_opts *opts, uint32_t snaplen);
+int  sr_capture_parse_opts(struct sr_capture_opts *opts, const char *spec);
+
+/**
+ * Open the first file and start the writer. "-" is stdout (no rotation).
+ * The capture takes over opts->filter and frees it on close.
+ */
+struct sr_capture* sr_capture_open(const char *path, const struct sr_capture_opts *opts);
+
+/**
+ * Record one frame if it passes the filter. Safe from any thread; never
+ * blocks on I/O.
+ */
+void sr_capture_packet(struct sr_capture *cap, const uint8_t *frame, uint32_t len);
+
+/**
+ * Write out everything buffered, stop the writer and close the file.
+ */
+void sr_capture_close(struct sr_capture *cap);
+
+void sr_capture_get_stats(struct sr_capture *cap, struct sr_capture_stats *stats);
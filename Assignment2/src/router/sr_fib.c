@@ -0,0 +1,857 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * Builds and searches the FIB engines described in sr_fib.h.
+ *
+ * Construction sorts the routes by (prefix, length). In that order every
+ * covering prefix comes before the prefixes it covers, so expanding the
+ * routes into a node's 64 slots in order leaves the longest match in each
+ * slot. Routes longer than the node's stride are handed to the child node
+ * for their slot; since the list is sorted they form one contiguous run.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+#include "sr_rt.h"
+
+#define FIB_LEAF    0x80000000u     /* direct entry holds a leaf, not a node */
+#define FIB_LONG    0x80000000u     /* tbl24 entry points at a tbllong block */
+#define FIB_SLOTS   (1 << SR_FIB_STRIDE)
+#define FIB_NDIRECT (1 << SR_FIB_DIRECT_BITS)
+#define FIB_NTBL24  (1 << 24)
+
+/* SR_FIB_STRIDE bits of key starting at bit offset off (from the msb);
+   bits past the end of the address read as zero */
+#define FIB_EXTRACT(key, off) \
+    ((uint32_t)((uint64_t)(key) << (off)) >> (32 - SR_FIB_STRIDE))
+
+struct fib_route
+{
+    uint32_t prefix;    /* host byte order, masked */
+    uint32_t len;
+    uint32_t nh;        /* index into fib->routes */
+};
+
+struct fib_builder
+{
+    struct sr_fib*    fib;
+    struct fib_route* r;
+    uint32_t          nodes_cap;
+    uint32_t          leaves_cap;
+};
+
+static int fib_prefix_len(uint32_t mask)
+{
+    int len = 0;
+
+    while (len < 32 && (mask & (0x80000000u >> len)))
+    { len++; }
+
+    /* -- reject non-contiguous masks -- */
+    if (len < 32 && (mask << len) != 0)
+    { return -1; }
+
+    return len;
+}
+
+static int fib_route_cmp(const void* a, const void* b)
+{
+    const struct fib_route* x = a;
+    const struct fib_route* y = b;
+
+    if (x->prefix != y->prefix)
+    { return x->prefix < y->prefix ? -1 : 1; }
+    if (x->len != y->len)
+    { return x->len < y->len ? -1 : 1; }
+    /* -- equal prefixes: the earlier table entry wins -- */
+    return x->nh < y->nh ? -1 : (x->nh > y->nh);
+}
+
+static int fib_reserve_nodes(struct fib_builder* b, uint32_t n)
+{
+    struct sr_fib* fib = b->fib;
+
+    if (fib->nnodes + n > b->nodes_cap)
+    {
+        uint32_t cap = b->nodes_cap ? b->nodes_cap : 64;
+        struct sr_fib_node* nodes;
+        while (cap < fib->nnodes + n)
+        { cap *= 2; }
+        nodes = realloc(fib->nodes, cap * sizeof(*nodes));
+        if (!nodes)
+        { return -1; }
+        fib->nodes = nodes;
+        b->nodes_cap = cap;
+    }
+    return 0;
+}
+
+static int fib_push_leaf(struct fib_builder* b, uint32_t leaf)
+{
+    struct sr_fib* fib = b->fib;
+
+    if (fib->nleaves == b->leaves_cap)
+    {
+        uint32_t cap = b->leaves_cap ? b->leaves_cap * 2 : 256;
+        uint32_t* leaves = realloc(fib->leaves, cap * sizeof(*leaves));
+        if (!leaves)
+        { return -1; }
+        fib->leaves = leaves;
+        b->leaves_cap = cap;
+    }
+    fib->leaves[fib->nleaves++] = leaf;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: fib_build_node(..)
+ * Scope: Local
+ *
+ * Fill in node idx, which consumes the SR_FIB_STRIDE bits at offset depth,
+ * from routes [lo,hi). Every route in the range lies under this node;
+ * routes of length <= depth were already applied by an ancestor and are
+ * represented by inherit.
+ *
+ *---------------------------------------------------------------------*/
+
+static int fib_build_node(struct fib_builder* b, uint32_t idx, int depth,
+                          uint32_t lo, uint32_t hi, uint32_t inherit)
+{
+    uint32_t slot[FIB_SLOTS];
+    uint32_t child_lo[FIB_SLOTS];
+    uint32_t child_hi[FIB_SLOTS];
+    uint64_t vector = 0, leafvec = 0;
+    uint32_t base0, base1, nchild = 0, prev = 0;
+    int have_prev = 0;
+    uint32_t i;
+    int s;
+
+    for (s = 0; s < FIB_SLOTS; s++)
+    { slot[s] = inherit; }
+
+    for (i = lo; i < hi; i++)
+    {
+        const struct fib_route* r = &b->r[i];
+        uint32_t v;
+
+        if ((int)r->len <= depth)
+        { continue; }
+
+        v = FIB_EXTRACT(r->prefix, depth);
+        if ((int)r->len <= depth + SR_FIB_STRIDE)
+        {
+            uint32_t n = 1u << (depth + SR_FIB_STRIDE - r->len);
+            while (n--)
+            { slot[v + n] = r->nh; }
+        }
+        else
+        {
+            if (!(vector & (1ULL << v)))
+            {
+                vector |= 1ULL << v;
+                child_lo[v] = i;
+            }
+            child_hi[v] = i + 1;
+        }
+    }
+
+    /* -- leaves: one per run of equal values over the leaf slots -- */
+    base0 = b->fib->nleaves;
+    for (s = 0; s < FIB_SLOTS; s++)
+    {
+        if (vector & (1ULL << s))
+        {
+            nchild++;
+            continue;
+        }
+        if (!have_prev || slot[s] != prev)
+        {
+            leafvec |= 1ULL << s;
+            if (fib_push_leaf(b, slot[s]) != 0)
+            { return -1; }
+            prev = slot[s];
+            have_prev = 1;
+        }
+    }
+
+    /* -- children are allocated as one block before recursing -- */
+    if (fib_reserve_nodes(b, nchild) != 0)
+    { return -1; }
+    base1 = b->fib->nnodes;
+    b->fib->nnodes += nchild;
+
+    b->fib->nodes[idx].vector  = vector;
+    b->fib->nodes[idx].leafvec = leafvec;
+    b->fib->nodes[idx].base0   = base0;
+    b->fib->nodes[idx].base1   = base1;
+
+    for (s = 0; s < FIB_SLOTS; s++)
+    {
+        if (!(vector & (1ULL << s)))
+        { continue; }
+        if (fib_build_node(b, base1++, depth + SR_FIB_STRIDE,
+                           child_lo[s], child_hi[s], slot[s]) != 0)
+        { return -1; }
+    }
+
+    return 0;
+} /* -- fib_build_node -- */
+
+/*---------------------------------------------------------------------
+ * Method: fib_collect(..)
+ * Scope: Local
+ *
+ * Fill fib->routes from the list and return the usable routes sorted by
+ * (prefix, length) with duplicate prefixes removed. *n is set to the
+ * number of entries returned.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct fib_route* fib_collect(struct sr_fib* fib,
+                                     struct sr_rt* routing_table,
+                                     uint32_t* n)
+{
+    struct sr_rt* rt_walker;
+    struct fib_route* r;
+    uint32_t nroutes = 0, cnt = 0, i;
+
+    for (rt_walker = routing_table; rt_walker; rt_walker = rt_walker->next)
+    { nroutes++; }
+
+    fib->routes = malloc((nroutes + 1) * sizeof(struct sr_rt*));
+    r = malloc((nroutes + 1) * sizeof(struct fib_route));
+    if (!fib->routes || !r)
+    {
+        free(r);
+        return 0;
+    }
+
+    /* -- gather routes; nh 0 is "no route" -- */
+    fib->routes[0] = 0;
+    fib->nroutes = 1;
+    for (rt_walker = routing_table; rt_walker; rt_walker = rt_walker->next)
+    {
+        uint32_t mask = ntohl(rt_walker->mask.s_addr);
+        uint32_t dest = ntohl(rt_walker->dest.s_addr);
+        int len = fib_prefix_len(mask);
+
+        fib->routes[fib->nroutes] = rt_walker;
+        if (len < 0 || (dest & ~mask) != 0)
+        {
+            /* -- could never match (mask & ip) == dest as written -- */
+            fprintf(stderr, "sr_fib_build: skipping route %s with bad mask\n",
+                    inet_ntoa(rt_walker->dest));
+        }
+        else
+        {
+            r[cnt].prefix = dest;
+            r[cnt].len = len;
+            r[cnt].nh = fib->nroutes;
+            cnt++;
+        }
+        fib->nroutes++;
+    }
+
+    qsort(r, cnt, sizeof(struct fib_route), fib_route_cmp);
+
+    /* -- drop duplicate prefixes, keeping the first table entry -- */
+    if (cnt > 0)
+    {
+        uint32_t out = 1;
+        for (i = 1; i < cnt; i++)
+        {
+            if (r[i].prefix == r[out - 1].prefix &&
+                r[i].len == r[out - 1].len)
+            { continue; }
+            r[out++] = r[i];
+        }
+        cnt = out;
+    }
+
+    *n = cnt;
+    return r;
+} /* -- fib_collect -- */
+
+/*---------------------------------------------------------------------
+ * Method: fib_build_poptrie(..)
+ * Scope: Local
+ *
+ * Direct pointing for the top 16 bits, then one subtree per /16 that
+ * holds longer routes.
+ *
+ *---------------------------------------------------------------------*/
+
+static int fib_build_poptrie(struct sr_fib* fib, struct fib_route* r, uint32_t n)
+{
+    struct fib_builder b;
+    uint32_t* dleaf = 0;
+    uint32_t* group_lo = 0;
+    uint32_t* group_hi = 0;
+    uint32_t i;
+    int ret = -1;
+
+    memset(&b, 0, sizeof(b));
+    b.fib = fib;
+    b.r = r;
+
+    fib->direct = malloc(FIB_NDIRECT * sizeof(uint32_t));
+    dleaf = calloc(FIB_NDIRECT, sizeof(uint32_t));
+    group_lo = malloc(FIB_NDIRECT * sizeof(uint32_t));
+    group_hi = calloc(FIB_NDIRECT, sizeof(uint32_t));
+    if (!fib->direct || !dleaf || !group_lo || !group_hi)
+    { goto done; }
+
+    /* -- expand /0../16 and group the longer routes by their top bits -- */
+    for (i = 0; i < n; i++)
+    {
+        uint32_t top = r[i].prefix >> (32 - SR_FIB_DIRECT_BITS);
+
+        if (r[i].len <= SR_FIB_DIRECT_BITS)
+        {
+            uint32_t cnt = 1u << (SR_FIB_DIRECT_BITS - r[i].len);
+            while (cnt--)
+            { dleaf[top + cnt] = r[i].nh; }
+        }
+        else
+        {
+            if (group_hi[top] == 0)
+            { group_lo[top] = i; }
+            group_hi[top] = i + 1;
+        }
+    }
+
+    for (i = 0; i < FIB_NDIRECT; i++)
+    {
+        if (group_hi[i] == 0)
+        {
+            fib->direct[i] = FIB_LEAF | dleaf[i];
+            continue;
+        }
+        if (fib_reserve_nodes(&b, 1) != 0)
+        { goto done; }
+        fib->direct[i] = fib->nnodes++;
+        if (fib_build_node(&b, fib->direct[i], SR_FIB_DIRECT_BITS,
+                           group_lo[i], group_hi[i], dleaf[i]) != 0)
+        { goto done; }
+    }
+    ret = 0;
+
+done:
+    free(dleaf);
+    free(group_lo);
+    free(group_hi);
+    return ret;
+} /* -- fib_build_poptrie -- */
+
+static int fib_len_cmp(const void* a, const void* b)
+{
+    const struct fib_route* x = a;
+    const struct fib_route* y = b;
+
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/*---------------------------------------------------------------------
+ * Method: fib_build_dir24(..)
+ * Scope: Local
+ *
+ * Routes are applied shortest first so that longer prefixes overwrite
+ * the ranges they refine. Anything longer than /24 gets a 256-entry
+ * block seeded with whatever the first-level entry held before.
+ *
+ *---------------------------------------------------------------------*/
+
+static int fib_build_dir24(struct sr_fib* fib, struct fib_route* r, uint32_t n)
+{
+    uint32_t long_cap = 0;
+    uint32_t i;
+
+    /* -- calloc: untouched first-level pages stay shared zero pages -- */
+    fib->tbl24 = calloc(FIB_NTBL24, sizeof(uint32_t));
+    if (!fib->tbl24)
+    { return -1; }
+
+    qsort(r, n, sizeof(struct fib_route), fib_len_cmp);
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t idx = r[i].prefix >> 8;
+        uint32_t cnt;
+
+        if (r[i].len <= 24)
+        {
+            cnt = 1u << (24 - r[i].len);
+            while (cnt--)
+            { fib->tbl24[idx + cnt] = r[i].nh; }
+            continue;
+        }
+
+        if (!(fib->tbl24[idx] & FIB_LONG))
+        {
+            uint32_t* blk;
+            if (fib->nlong == long_cap)
+            {
+                uint32_t* tbllong;
+                long_cap = long_cap ? long_cap * 2 : 64;
+                tbllong = realloc(fib->tbllong,
+                                  (size_t)long_cap * 256 * sizeof(uint32_t));
+                if (!tbllong)
+                { return -1; }
+                fib->tbllong = tbllong;
+            }
+            blk = &fib->tbllong[(size_t)fib->nlong * 256];
+            for (cnt = 0; cnt < 256; cnt++)
+            { blk[cnt] = fib->tbl24[idx]; }
+            fib->tbl24[idx] = FIB_LONG | fib->nlong++;
+        }
+
+        cnt = 1u << (32 - r[i].len);
+        while (cnt--)
+        {
+            fib->tbllong[(size_t)(fib->tbl24[idx] & ~FIB_LONG) * 256 +
+                         (r[i].prefix & 0xff) + cnt] = r[i].nh;
+        }
+    }
+
+    return 0;
+} /* -- fib_build_dir24 -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_build(..)
+ * Scope: Global
+ *
+ * Compile the routing table list with the requested engine.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_build(struct sr_rt* routing_table,
+                            enum sr_fib_engine engine)
+{
+    struct sr_fib* fib;
+    struct fib_route* r;
+    uint32_t n = 0;
+    int ret = -1;
+
+    fib = calloc(1, sizeof(*fib));
+    if (!fib)
+    { return 0; }
+    fib->engine = engine;
+    fib->list = routing_table;
+
+    if (engine == sr_fib_engine_list)
+    {
+        struct sr_rt* rt_walker;
+        fib->nroutes = 1;
+        for (rt_walker = routing_table; rt_walker; rt_walker = rt_walker->next)
+        { fib->nroutes++; }
+        return fib;
+    }
+
+    if ((r = fib_collect(fib, routing_table, &n)) != 0)
+    {
+        if (engine == sr_fib_engine_dir24)
+        { ret = fib_build_dir24(fib, r, n); }
+        else
+        { ret = fib_build_poptrie(fib, r, n); }
+        free(r);
+    }
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "sr_fib_build: out of memory\n");
+        sr_fib_destroy(fib);
+        return 0;
+    }
+    return fib;
+} /* -- sr_fib_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: fib_check_node(..)
+ * Scope: Local
+ *
+ * Check the subtree of node idx, which consumes the bits at offset off:
+ * every index in range, no node reached twice, and no node below the
+ * last stride that can hold a route.
+ *
+ *---------------------------------------------------------------------*/
+
+static int fib_check_node(const struct sr_fib* fib, uint32_t idx, int off,
+                          uint8_t* seen)
+{
+    const struct sr_fib_node* node;
+    uint32_t nchild, i;
+
+    if (idx >= fib->nnodes || seen[idx])
+    { return -1; }
+    seen[idx] = 1;
+    node = &fib->nodes[idx];
+    nchild = __builtin_popcountll(node->vector);
+
+    /* -- runs start on leaf slots, and one starts at the first of them -- */
+    if ((node->vector & node->leafvec) ||
+        (~node->vector & ~(~node->vector - 1) & ~node->leafvec))
+    { return -1; }
+    if ((uint64_t)node->base0 + __builtin_popcountll(node->leafvec) > fib->nleaves ||
+        (uint64_t)node->base1 + nchild > fib->nnodes)
+    { return -1; }
+    if (nchild && off + SR_FIB_STRIDE >= 32)
+    { return -1; }
+
+    for (i = 0; i < nchild; i++)
+    {
+        if (fib_check_node(fib, node->base1 + i, off + SR_FIB_STRIDE, seen) != 0)
+        { return -1; }
+    }
+    return 0;
+} /* -- fib_check_node -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_attach(..)
+ * Scope: Global
+ *
+ * Wrap saved poptrie arrays in a FIB, see sr_fib.h.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_attach(struct sr_rt* routing_table, uint32_t nroutes,
+                             uint32_t* direct, struct sr_fib_node* nodes,
+                             uint32_t nnodes, uint32_t* leaves,
+                             uint32_t nleaves, void* map, size_t map_len)
+{
+    struct sr_fib* fib;
+    struct sr_rt* rt_walker;
+    uint8_t* seen = 0;
+    uint32_t i;
+
+    fib = calloc(1, sizeof(*fib));
+    if (!fib)
+    { return 0; }
+    fib->engine = sr_fib_engine_poptrie;
+    fib->list = routing_table;
+    fib->direct = direct;
+    fib->nodes = nodes;
+    fib->nnodes = nnodes;
+    fib->leaves = leaves;
+    fib->nleaves = nleaves;
+    fib->map = map;
+    fib->map_len = map_len;
+
+    fib->routes = malloc(((size_t)nroutes + 1) * sizeof(struct sr_rt*));
+    if (!fib->routes)
+    { goto fail; }
+    fib->routes[0] = 0;
+    fib->nroutes = 1;
+    for (rt_walker = routing_table; rt_walker && fib->nroutes <= nroutes;
+         rt_walker = rt_walker->next)
+    { fib->routes[fib->nroutes++] = rt_walker; }
+    if (rt_walker || fib->nroutes != nroutes + 1)
+    { goto fail; }
+
+    /* -- a corrupt image must not send a lookup out of bounds -- */
+    for (i = 0; i < nleaves; i++)
+    {
+        if (leaves[i] >= fib->nroutes)
+        { goto fail; }
+    }
+    if ((seen = calloc(nnodes ? nnodes : 1, 1)) == 0)
+    { goto fail; }
+    for (i = 0; i < FIB_NDIRECT; i++)
+    {
+        if (direct[i] & FIB_LEAF)
+        {
+            if ((direct[i] & ~FIB_LEAF) >= fib->nroutes)
+            { goto fail; }
+        }
+        else if (fib_check_node(fib, direct[i], SR_FIB_DIRECT_BITS, seen) != 0)
+        { goto fail; }
+    }
+    free(seen);
+    return fib;
+
+fail:
+    /* -- the caller keeps the mapping -- */
+    free(seen);
+    fib->map = 0;
+    fib->direct = 0;
+    fib->nodes = 0;
+    fib->leaves = 0;
+    sr_fib_destroy(fib);
+    return 0;
+} /* -- sr_fib_attach -- */
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    if (!fib)
+    { return; }
+    if (fib->map)
+    { munmap(fib->map, fib->map_len); }
+    else
+    {
+        free(fib->direct);
+        free(fib->nodes);
+        free(fib->leaves);
+    }
+    free(fib->tbl24);
+    free(fib->tbllong);
+    free(fib->routes);
+    free(fib);
+} /* -- sr_fib_destroy -- */
+
+static const char* fib_engine_names[] = { "list", "poptrie", "dir24-8" };
+
+const char* sr_fib_engine_name(enum sr_fib_engine engine)
+{
+    return fib_engine_names[engine];
+}
+
+int sr_fib_engine_parse(const char* name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(fib_engine_names) / sizeof(fib_engine_names[0])); i++)
+    {
+        if (strcmp(name, fib_engine_names[i]) == 0)
+        { return i; }
+    }
+    return -1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope: Global
+ *
+ * Longest prefix match. poptrie: one direct read, at most three node
+ * reads and one leaf read. dir24-8: one read, two past /24.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip)
+{
+    const struct sr_fib_node* node;
+    uint32_t key = ntohl(ip);
+    uint32_t d, v;
+    int off = SR_FIB_DIRECT_BITS;
+
+    if (fib->engine == sr_fib_engine_dir24)
+    {
+        d = fib->tbl24[key >> 8];
+        if (d & FIB_LONG)
+        { d = fib->tbllong[(size_t)(d & ~FIB_LONG) * 256 + (key & 0xff)]; }
+        return fib->routes[d];
+    }
+
+    if (fib->engine == sr_fib_engine_list)
+    { return sr_fib_list_lookup(fib->list, ip); }
+
+    d = fib->direct[key >> (32 - SR_FIB_DIRECT_BITS)];
+    if (d & FIB_LEAF)
+    { return fib->routes[d & ~FIB_LEAF]; }
+
+    node = &fib->nodes[d];
+    v = FIB_EXTRACT(key, off);
+    while (node->vector & (1ULL << v))
+    {
+        node = &fib->nodes[node->base1 +
+                           __builtin_popcountll(node->vector & ((2ULL << v) - 1)) - 1];
+        off += SR_FIB_STRIDE;
+        v = FIB_EXTRACT(key, off);
+    }
+
+    return fib->routes[fib->leaves[node->base0 +
+                       __builtin_popcountll(node->leafvec & ((2ULL << v) - 1)) - 1]];
+} /* -- sr_fib_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: fib_burst_dir24(..)
+ * Scope: Local
+ *
+ * Three passes: prefetch the first-level entries, read them and prefetch
+ * any overflow block entry, then resolve.
+ *
+ *---------------------------------------------------------------------*/
+
+static void fib_burst_dir24(const struct sr_fib* fib, const uint32_t* ip,
+                            struct sr_rt** rt, unsigned int n)
+{
+    uint32_t key[SR_FIB_BURST];
+    uint32_t d[SR_FIB_BURST];
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        key[i] = ntohl(ip[i]);
+        __builtin_prefetch(&fib->tbl24[key[i] >> 8]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        d[i] = fib->tbl24[key[i] >> 8];
+        if (d[i] & FIB_LONG)
+        {
+            __builtin_prefetch(&fib->tbllong[(size_t)(d[i] & ~FIB_LONG) * 256 +
+                                             (key[i] & 0xff)]);
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (d[i] & FIB_LONG)
+        { d[i] = fib->tbllong[(size_t)(d[i] & ~FIB_LONG) * 256 + (key[i] & 0xff)]; }
+        rt[i] = fib->routes[d[i]];
+    }
+} /* -- fib_burst_dir24 -- */
+
+/*---------------------------------------------------------------------
+ * Method: fib_burst_poptrie(..)
+ * Scope: Local
+ *
+ * Every pass takes each unfinished lookup one level down the trie and
+ * prefetches where it goes next. Lookups that reach a leaf drop out of
+ * the active set; at most five passes are needed.
+ *
+ *---------------------------------------------------------------------*/
+
+static void fib_burst_poptrie(const struct sr_fib* fib, const uint32_t* ip,
+                              struct sr_rt** rt, unsigned int n)
+{
+    uint32_t key[SR_FIB_BURST];
+    uint32_t pos[SR_FIB_BURST];     /* node index, then leaf index */
+    uint8_t  off[SR_FIB_BURST];
+    uint8_t  active[SR_FIB_BURST];
+    uint32_t leaf[SR_FIB_BURST];
+    unsigned int i, nactive = 0, nleaf = 0, j;
+
+    for (i = 0; i < n; i++)
+    {
+        key[i] = ntohl(ip[i]);
+        __builtin_prefetch(&fib->direct[key[i] >> (32 - SR_FIB_DIRECT_BITS)]);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        uint32_t d = fib->direct[key[i] >> (32 - SR_FIB_DIRECT_BITS)];
+        if (d & FIB_LEAF)
+        {
+            rt[i] = fib->routes[d & ~FIB_LEAF];
+            continue;
+        }
+        pos[i] = d;
+        off[i] = SR_FIB_DIRECT_BITS;
+        active[nactive++] = i;
+        __builtin_prefetch(&fib->nodes[d]);
+    }
+
+    while (nactive)
+    {
+        unsigned int still = 0;
+
+        for (j = 0; j < nactive; j++)
+        {
+            const struct sr_fib_node* node;
+            uint32_t v;
+
+            i = active[j];
+            node = &fib->nodes[pos[i]];
+            v = FIB_EXTRACT(key[i], off[i]);
+            if (node->vector & (1ULL << v))
+            {
+                pos[i] = node->base1 +
+                         __builtin_popcountll(node->vector & ((2ULL << v) - 1)) - 1;
+                off[i] += SR_FIB_STRIDE;
+                active[still++] = i;
+                __builtin_prefetch(&fib->nodes[pos[i]]);
+            }
+            else
+            {
+                pos[i] = node->base0 +
+                         __builtin_popcountll(node->leafvec & ((2ULL << v) - 1)) - 1;
+                leaf[nleaf++] = i;
+                __builtin_prefetch(&fib->leaves[pos[i]]);
+            }
+        }
+        nactive = still;
+    }
+
+    for (j = 0; j < nleaf; j++)
+    {
+        i = leaf[j];
+        rt[i] = fib->routes[fib->leaves[pos[i]]];
+    }
+} /* -- fib_burst_poptrie -- */
+
+void sr_fib_lookup_burst(const struct sr_fib* fib, const uint32_t* ip,
+                         struct sr_rt** rt, unsigned int n)
+{
+    unsigned int i;
+
+    while (n > 0)
+    {
+        unsigned int cnt = n < SR_FIB_BURST ? n : SR_FIB_BURST;
+
+        if (fib->engine == sr_fib_engine_poptrie)
+        { fib_burst_poptrie(fib, ip, rt, cnt); }
+        else if (fib->engine == sr_fib_engine_dir24)
+        { fib_burst_dir24(fib, ip, rt, cnt); }
+        else
+        {
+            for (i = 0; i < cnt; i++)
+            { rt[i] = sr_fib_list_lookup(fib->list, ip[i]); }
+        }
+
+        ip += cnt;
+        rt += cnt;
+        n -= cnt;
+    }
+} /* -- sr_fib_lookup_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_list_lookup(..)
+ * Scope: Global
+ *
+ * Walk the whole list and keep the longest match; the first entry wins
+ * between equal masks.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_list_lookup(struct sr_rt* routing_table, uint32_t ip)
+{
+    struct sr_rt* rt_walker = routing_table;
+    struct sr_rt* best = 0;
+
+    while (rt_walker)
+    {
+        if ((rt_walker->mask.s_addr & ip) == rt_walker->dest.s_addr &&
+            (!best || ntohl(rt_walker->mask.s_addr) > ntohl(best->mask.s_addr)))
+        { best = rt_walker; }
+        rt_walker = rt_walker->next;
+    }
+
+    return best;
+} /* -- sr_fib_list_lookup -- */
+
+size_t sr_fib_memory(const struct sr_fib* fib)
+{
+    size_t bytes;
+
+    if (!fib)
+    { return 0; }
+
+    bytes = fib->routes ? fib->nroutes * sizeof(struct sr_rt*) : 0;
+    if (fib->direct)
+    { bytes += FIB_NDIRECT * sizeof(uint32_t); }
+    if (fib->tbl24)
+    { bytes += FIB_NTBL24 * sizeof(uint32_t); }
+    bytes += fib->nnodes * sizeof(struct sr_fib_node) +
+             fib->nleaves * sizeof(uint32_t) +
+             (size_t)fib->nlong * 256 * sizeof(uint32_t);
+    return bytes;
+} /* -- sr_fib_memory -- */
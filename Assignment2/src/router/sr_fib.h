@@ -0,0 +1,146 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ * Description:
+ *
+ * Forwarding information base compiled from the routing table. The list of
+ * struct sr_rt stays the configuration; the FIB is what the data path reads.
+ *
+ * The lookup structure is a path-compressed multibit trie in the style of
+ * poptrie (Asai & Ohara, SIGCOMM '15): the top 16 bits of the address index
+ * a direct-pointing array, and the remaining bits are consumed 6 at a time by
+ * nodes that hold a 64-bit child bitmap and a 64-bit leaf-run bitmap. Children
+ * and leaves of a node are stored contiguously, so the position of the next
+ * step is found with a popcount instead of a pointer per slot.
+ *
+ * A lookup touches at most one direct entry, three nodes and one leaf no
+ * matter how many routes are loaded.
+ *
+ * Two other engines can be selected instead:
+ *
+ *  - list:    the routing table list itself, walked on every lookup.
+ *  - dir24-8: DIR-24-8 (Gupta, Lin & McKeown, INFOCOM '98). A 16M-entry
+ *             table indexed by the top 24 bits answers every prefix up to
+ *             /24 in a single read; longer prefixes live in 256-entry
+ *             blocks reached through a flagged first-level entry. Costs
+ *             64MB for the first level.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FIB_H
+#define sr_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+struct sr_rt;
+
+#define SR_FIB_DIRECT_BITS 16
+#define SR_FIB_STRIDE      6
+
+enum sr_fib_engine {
+    sr_fib_engine_list = 0,
+    sr_fib_engine_poptrie,
+    sr_fib_engine_dir24,
+};
+
+#define SR_FIB_ENGINE_DEFAULT sr_fib_engine_poptrie
+
+/* Lookups resolved together by sr_fib_lookup_burst */
+#define SR_FIB_BURST 32
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib_node
+ *
+ * Internal trie node covering SR_FIB_STRIDE bits of the address.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib_node
+{
+    uint64_t vector;    /* bit i set: slot i descends into a child node     */
+    uint64_t leafvec;   /* bit i set: slot i starts a new run of leaves     */
+    uint32_t base0;     /* index of this node's first leaf in fib->leaves   */
+    uint32_t base1;     /* index of this node's first child in fib->nodes   */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * Compiled, read-only forwarding table. Leaves of both compiled engines are
+ * indices into routes[]; index 0 is reserved for "no route".
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    enum sr_fib_engine  engine;
+    struct sr_rt*       list;     /* list engine: the routing table itself */
+
+    /* -- poptrie -- */
+    uint32_t*           direct;   /* 1 << SR_FIB_DIRECT_BITS entries */
+    struct sr_fib_node* nodes;
+    uint32_t            nnodes;
+    uint32_t*           leaves;
+    uint32_t            nleaves;
+
+    /* -- dir24-8 -- */
+    uint32_t*           tbl24;    /* 1 << 24 entries */
+    uint32_t*           tbllong;  /* nlong blocks of 256 entries */
+    uint32_t            nlong;
+
+    struct sr_rt**      routes;   /* routes[0] == NULL */
+    uint32_t            nroutes;  /* including the NULL slot */
+
+    /* -- poptrie arrays mapped from a routing table image, see sr_rt.h -- */
+    void*               map;
+    size_t              map_len;
+};
+
+/* Compile the routing table list into a FIB using the given engine.
+   Returns NULL on allocation failure. The FIB keeps pointers into the
+   list, so it must be destroyed before the list is freed. */
+struct sr_fib* sr_fib_build(struct sr_rt* routing_table,
+                            enum sr_fib_engine engine);
+void           sr_fib_destroy(struct sr_fib* fib);
+
+/* A poptrie FIB over arrays that were compiled earlier and saved with the
+   routes (sr_save_rt), instead of compiling them again. Leaves index the
+   routing table list in order, as in a FIB built from it. The arrays are
+   checked before they are used; returns NULL if they don't describe a
+   trie over nroutes routes. Otherwise the FIB owns the mapping
+   [map, map_len) the arrays live in, and sr_fib_destroy unmaps it. */
+struct sr_fib* sr_fib_attach(struct sr_rt* routing_table, uint32_t nroutes,
+                             uint32_t* direct, struct sr_fib_node* nodes,
+                             uint32_t nnodes, uint32_t* leaves,
+                             uint32_t nleaves, void* map, size_t map_len);
+
+/* Engine names as accepted on the command line: "list", "poptrie",
+   "dir24-8". Parse returns -1 for an unknown name. */
+const char*    sr_fib_engine_name(enum sr_fib_engine engine);
+int            sr_fib_engine_parse(const char* name);
+
+/* Longest prefix match. ip is in network byte order. Returns NULL when no
+   route covers the address. */
+struct sr_rt*  sr_fib_lookup(const struct sr_fib* fib, uint32_t ip);
+
+/* Longest prefix match for n addresses at once. The lookups are advanced
+   in lock step and the next memory access of each is prefetched before
+   any of them is dereferenced, so the cache misses of a burst overlap
+   instead of being paid one after another. */
+void           sr_fib_lookup_burst(const struct sr_fib* fib, const uint32_t* ip,
+                                   struct sr_rt** rt, unsigned int n);
+
+/* Reference longest prefix match over the routing table list. */
+struct sr_rt*  sr_fib_list_lookup(struct sr_rt* routing_table, uint32_t ip);
+
+/* Bytes held by the compiled structure. */
+size_t         sr_fib_memory(const struct sr_fib* fib);
+
+#endif  /* --  sr_FIB_H -- */
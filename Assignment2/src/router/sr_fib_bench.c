@@ -0,0 +1,204 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_bench.c
+ *
+ * Description:
+ *
+ * Compares the FIB engines against the routing table list walk on
+ * synthetic tables. Usage: fib_bench [nprefixes ...]
+ * (default 10 10000 1000000).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rt.h"
+#include "sr_fib.h"
+
+#define NKEYS       (1 << 20)
+#define FIB_LOOKUPS 20000000
+#define LIST_WORK   50000000ULL   /* route comparisons per list-walk run */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* roughly the shape of a BGP table: mostly /24, a long tail either side */
+static int random_len(void)
+{
+    uint32_t p = rng() % 100;
+
+    if (p < 55) return 24;
+    if (p < 75) return 22 + rng() % 2;
+    if (p < 95) return 16 + rng() % 6;
+    if (p < 98) return 8 + rng() % 8;
+    return 25 + rng() % 8;
+}
+
+static struct sr_rt* make_table(uint32_t n)
+{
+    struct sr_rt* rt = calloc(n, sizeof(struct sr_rt));
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        int len = random_len();
+        uint32_t mask = len ? 0xffffffffu << (32 - len) : 0;
+        rt[i].dest.s_addr = htonl(rng() & mask);
+        rt[i].mask.s_addr = htonl(mask);
+        rt[i].gw.s_addr = htonl(0x0a000000u | (rng() & 0xffff));
+        snprintf(rt[i].interface, sr_IFACE_NAMELEN, "eth%u", 1 + i % 3);
+        rt[i].next = (i + 1 < n) ? &rt[i + 1] : 0;
+    }
+    return rt;
+}
+
+static void bench_engine(struct sr_rt* table, uint32_t n, const uint32_t* keys,
+                         enum sr_fib_engine engine)
+{
+    struct sr_fib* fib;
+    volatile uintptr_t sink = 0;
+    double t0, build, t;
+    uint32_t i, lookups, nverify, hits = 0;
+
+    t0 = now_sec();
+    fib = sr_fib_build(table, engine);
+    build = now_sec() - t0;
+    if (!fib)
+    {
+        fprintf(stderr, "%s build failed for %u prefixes\n",
+                sr_fib_engine_name(engine), n);
+        exit(1);
+    }
+
+    /* -- differential check against the list walk -- */
+    nverify = (uint32_t)(LIST_WORK / 4 / n);
+    if (nverify > 100000) nverify = 100000;
+    if (nverify < 100) nverify = 100;
+    for (i = 0; i < nverify; i++)
+    {
+        struct sr_rt* a = sr_fib_lookup(fib, keys[i]);
+        if (a != sr_fib_list_lookup(table, keys[i]))
+        {
+            struct in_addr k;
+            k.s_addr = keys[i];
+            fprintf(stderr, "MISMATCH (%s) for %s at %u prefixes\n",
+                    sr_fib_engine_name(engine), inet_ntoa(k), n);
+            exit(1);
+        }
+        hits += a != 0;
+    }
+
+    lookups = FIB_LOOKUPS;
+    if (engine == sr_fib_engine_list)
+    {
+        lookups = (uint32_t)(LIST_WORK / n);
+        if (lookups < 50) lookups = 50;
+    }
+
+    t0 = now_sec();
+    for (i = 0; i < lookups; i++)
+    { sink += (uintptr_t)sr_fib_lookup(fib, keys[i & (NKEYS - 1)]); }
+    t = now_sec() - t0;
+
+    printf("%8u %-8s build %9.2f ms %10.1f KB %10.2f ns/lookup %10.4f Mlookups/s"
+           " (%u/%u keys routed)\n",
+           n, sr_fib_engine_name(engine), build * 1e3,
+           sr_fib_memory(fib) / 1024.0, t * 1e9 / lookups,
+           lookups / t / 1e6, hits, nverify);
+
+    if (engine != sr_fib_engine_list)
+    {
+        struct sr_rt* out[SR_FIB_BURST];
+
+        /* -- the burst path must agree with the scalar one -- */
+        for (i = 0; i + SR_FIB_BURST <= nverify; i += SR_FIB_BURST)
+        {
+            unsigned int k;
+            sr_fib_lookup_burst(fib, &keys[i], out, SR_FIB_BURST);
+            for (k = 0; k < SR_FIB_BURST; k++)
+            {
+                if (out[k] != sr_fib_lookup(fib, keys[i + k]))
+                {
+                    fprintf(stderr, "BURST MISMATCH (%s) at %u prefixes\n",
+                            sr_fib_engine_name(engine), n);
+                    exit(1);
+                }
+            }
+        }
+
+        t0 = now_sec();
+        for (i = 0; i < lookups; i += SR_FIB_BURST)
+        {
+            sr_fib_lookup_burst(fib, &keys[i & (NKEYS - 1)], out, SR_FIB_BURST);
+            sink += (uintptr_t)out[0];
+        }
+        t = now_sec() - t0;
+        printf("%8s %-8s burst %-28s %10.2f ns/lookup %10.4f Mlookups/s\n",
+               "", sr_fib_engine_name(engine), "", t * 1e9 / lookups,
+               lookups / t / 1e6);
+    }
+
+    (void)sink;
+    sr_fib_destroy(fib);
+}
+
+static void bench(uint32_t n)
+{
+    struct sr_rt* table = make_table(n);
+    uint32_t* keys = malloc(NKEYS * sizeof(uint32_t));
+    uint32_t i;
+
+    /* -- half the keys fall inside a loaded prefix, half are uniform -- */
+    for (i = 0; i < NKEYS; i++)
+    {
+        if (i & 1)
+        { keys[i] = htonl(rng()); }
+        else
+        {
+            struct sr_rt* r = &table[rng() % n];
+            keys[i] = r->dest.s_addr | (htonl(rng()) & ~r->mask.s_addr);
+        }
+    }
+
+    bench_engine(table, n, keys, sr_fib_engine_list);
+    bench_engine(table, n, keys, sr_fib_engine_poptrie);
+    bench_engine(table, n, keys, sr_fib_engine_dir24);
+
+    free(keys);
+    free(table);
+}
+
+int main(int argc, char** argv)
+{
+    int i;
+
+    if (argc < 2)
+    {
+        bench(10);
+        bench(10000);
+        bench(1000000);
+        return 0;
+    }
+    for (i = 1; i < argc; i++)
+    { bench((uint32_t)strtoul(argv[i], 0, 10)); }
+    return 0;
+}
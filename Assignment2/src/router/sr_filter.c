@@ -0,0 +1,775 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and interpreter, see sr_filter.h.
+ *
+ * The expression is parsed into a tree whose leaves are single field
+ * tests, so "port 80" is spelled out as (tcp or udp) and not a fragment
+ * and (source port 80 or destination port 80). The tree is then laid
+ * out as a branch program, and tests whose outcome is already known on
+ * every path reaching them (the ethertype check repeated by each
+ * primitive, for example) are jumped over and dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_filter.h"
+
+#define MAX_TOKENS 128
+#define MAX_TOKLEN 64
+#define MAX_NODES  512
+#define MAX_CODE   1024
+#define MAX_FACTS  16
+
+#define ETHER_HDR  14
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+
+enum node_kind { N_TEST, N_AND, N_OR, N_NOT };
+
+struct node
+{
+    int kind;
+    int a, b;                       /* children */
+    struct sr_filter_insn test;     /* N_TEST: jt and jf unused */
+};
+
+/* protocol qualifiers */
+enum { Q_NONE, Q_ETHER, Q_IP, Q_ARP, Q_TCP, Q_UDP, Q_ICMP };
+
+/* direction qualifiers */
+enum { D_ANY, D_SRC, D_DST };
+
+struct parse
+{
+    char tok[MAX_TOKENS][MAX_TOKLEN];
+    int  ntok;
+    int  pos;
+    struct node nodes[MAX_NODES];
+    int  nnodes;
+    int  failed;
+};
+
+/*---------------------------------------------------------------------
+ * Parser
+ *---------------------------------------------------------------------*/
+
+static int fail(struct parse* p, const char* what)
+{
+    if ( !p->failed )
+    {
+        if ( p->pos < p->ntok )
+        { fprintf(stderr, "filter: %s at \"%s\"\n", what, p->tok[p->pos]); }
+        else
+        { fprintf(stderr, "filter: %s at end of expression\n", what); }
+    }
+    p->failed = 1;
+    return -1;
+}
+
+static int tokenize(struct parse* p, const char* s)
+{
+    while ( *s )
+    {
+        int n = 0;
+
+        if ( *s == ' ' || *s == '\t' || *s == '\n' )
+        { s++; continue; }
+        if ( p->ntok == MAX_TOKENS )
+        { fprintf(stderr, "filter: expression too long\n"); return -1; }
+
+        if ( *s == '(' || *s == ')' || (*s == '!' && s[1] != '=') )
+        { p->tok[p->ntok][n++] = *s++; }
+        else if ( (s[0] == '&' && s[1] == '&') || (s[0] == '|' && s[1] == '|') )
+        { p->tok[p->ntok][n++] = *s++; p->tok[p->ntok][n++] = *s++; }
+        else
+        {
+            while ( *s && !strchr(" \t\n()!&|", *s) )
+            {
+                if ( n == MAX_TOKLEN - 1 )
+                { fprintf(stderr, "filter: word too long\n"); return -1; }
+                p->tok[p->ntok][n++] = *s++;
+            }
+            if ( n == 0 )
+            { fprintf(stderr, "filter: unexpected '%c'\n", *s); return -1; }
+        }
+        p->tok[p->ntok++][n] = 0;
+    }
+    return 0;
+}
+
+static const char* peek(struct parse* p)
+{
+    return p->pos < p->ntok ? p->tok[p->pos] : 0;
+}
+
+static int accept_word(struct parse* p, const char* w1, const char* w2)
+{
+    const char* t = peek(p);
+
+    if ( t && (!strcmp(t, w1) || (w2 && !strcmp(t, w2))) )
+    { p->pos++; return 1; }
+    return 0;
+}
+
+static int new_node(struct parse* p, int kind, int a, int b)
+{
+    struct node* n;
+
+    if ( a < 0 || b < 0 )
+    { return -1; }
+    if ( p->nnodes == MAX_NODES )
+    { return fail(p, "expression too complex"); }
+    n = &p->nodes[p->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->a = a;
+    n->b = b;
+    return p->nnodes++;
+}
+
+static int test(struct parse* p, int size, int base, int off, uint32_t mask, uint32_t k)
+{
+    int i = new_node(p, N_TEST, 0, 0);
+
+    if ( i >= 0 )
+    {
+        struct sr_filter_insn* t = &p->nodes[i].test;
+        t->size = size;
+        t->base = base;
+        t->off  = off;
+        t->mask = mask;
+        t->k    = k & mask;
+    }
+    return i;
+}
+
+static int and_(struct parse* p, int a, int b) { return new_node(p, N_AND, a, b); }
+static int or_(struct parse* p, int a, int b)  { return new_node(p, N_OR, a, b); }
+
+/* either or both of a source and a destination test */
+static int by_dir(struct parse* p, int dir, int src, int dst)
+{
+    if ( dir == D_SRC )
+    { return src; }
+    if ( dir == D_DST )
+    { return dst; }
+    return or_(p, src, dst);
+}
+
+static int proto_test(struct parse* p, int q)
+{
+    int ip = test(p, 2, SR_FILTER_LINK, 12, 0xffff, ethertype_ip);
+
+    switch ( q )
+    {
+        case Q_IP:   return ip;
+        case Q_ARP:  return test(p, 2, SR_FILTER_LINK, 12, 0xffff, ethertype_arp);
+        case Q_TCP:  return and_(p, ip, test(p, 1, SR_FILTER_NET, 9, 0xff, IPPROTO_TCP_));
+        case Q_UDP:  return and_(p, ip, test(p, 1, SR_FILTER_NET, 9, 0xff, IPPROTO_UDP_));
+        case Q_ICMP: return and_(p, ip, test(p, 1, SR_FILTER_NET, 9, 0xff, ip_protocol_icmp));
+    }
+    return fail(p, "no such protocol");
+}
+
+static int parse_number(struct parse* p, uint32_t max, uint32_t* out)
+{
+    const char* t = peek(p);
+    char* end;
+    unsigned long v;
+
+    if ( !t )
+    { return fail(p, "number expected"); }
+    v = strtoul(t, &end, 0);
+    if ( *end || end == t || v > max )
+    { return fail(p, "bad number"); }
+    *out = v;
+    p->pos++;
+    return 0;
+}
+
+/* A.B.C.D or A.B.C.D/LEN, in host order */
+static int parse_net(struct parse* p, int need_host, uint32_t* addr, uint32_t* mask)
+{
+    char buf[MAX_TOKLEN];
+    const char* t = peek(p);
+    char* slash;
+    struct in_addr in;
+    unsigned long bits = 32;
+
+    if ( !t )
+    { return fail(p, "address expected"); }
+    strcpy(buf, t);
+    if ( (slash = strchr(buf, '/')) )
+    {
+        char* end;
+
+        *slash = 0;
+        bits = strtoul(slash + 1, &end, 10);
+        if ( need_host || *end || end == slash + 1 || bits > 32 )
+        { return fail(p, "bad prefix length"); }
+    }
+    if ( inet_pton(AF_INET, buf, &in) != 1 )
+    { return fail(p, "bad IPv4 address"); }
+    *addr = ntohl(in.s_addr);
+    *mask = bits ? 0xffffffffu << (32 - bits) : 0;
+    p->pos++;
+    return 0;
+}
+
+static int parse_mac(struct parse* p, uint8_t* mac)
+{
+    const char* t = peek(p);
+    unsigned int b[ETHER_ADDR_LEN];
+    char end;
+    int i;
+
+    if ( !t || sscanf(t, "%x:%x:%x:%x:%x:%x%c",
+                      &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &end) != 6 )
+    { return fail(p, "bad MAC address"); }
+    for ( i = 0; i < ETHER_ADDR_LEN; i++ )
+    {
+        if ( b[i] > 0xff )
+        { return fail(p, "bad MAC address"); }
+        mac[i] = b[i];
+    }
+    p->pos++;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: parse_primitive(..)
+ * Scope: Local
+ *
+ * [proto] [src|dst] host|net|port VALUE, proto N, a bare protocol, or
+ * src|dst ADDR as short for src|dst host ADDR.
+ *
+ *---------------------------------------------------------------------*/
+
+static int parse_primitive(struct parse* p)
+{
+    static const char* protos[] = { 0, "ether", "ip", "arp", "tcp", "udp", "icmp" };
+    int q = Q_NONE, dir = D_ANY, kind = 0, i;
+    const char* t = peek(p);
+
+    if ( !t )
+    { return fail(p, "expression expected"); }
+    for ( i = Q_ETHER; i <= Q_ICMP; i++ )
+    {
+        if ( !strcmp(t, protos[i]) )
+        { q = i; p->pos++; break; }
+    }
+
+    if ( accept_word(p, "src", 0) )
+    { dir = D_SRC; }
+    else if ( accept_word(p, "dst", 0) )
+    { dir = D_DST; }
+
+    if ( accept_word(p, "host", 0) )
+    { kind = 'h'; }
+    else if ( accept_word(p, "net", 0) )
+    { kind = 'n'; }
+    else if ( accept_word(p, "port", 0) )
+    { kind = 'p'; }
+    else if ( dir != D_ANY )
+    { kind = 'h'; }
+    else if ( (q == Q_NONE || q == Q_IP) && accept_word(p, "proto", 0) )
+    {
+        uint32_t proto;
+
+        if ( parse_number(p, 0xff, &proto) )
+        { return -1; }
+        return and_(p, proto_test(p, Q_IP),
+                    test(p, 1, SR_FILTER_NET, 9, 0xff, proto));
+    }
+    else if ( q != Q_NONE && q != Q_ETHER )
+    { return proto_test(p, q); }
+    else
+    { return fail(p, "host, net, port or a protocol expected"); }
+
+    if ( q == Q_ETHER )
+    {
+        uint8_t mac[ETHER_ADDR_LEN];
+        uint32_t hi, lo;
+
+        if ( kind != 'h' )
+        { return fail(p, "only host goes with ether"); }
+        if ( parse_mac(p, mac) )
+        { return -1; }
+        hi = (uint32_t)mac[0] << 24 | mac[1] << 16 | mac[2] << 8 | mac[3];
+        lo = mac[4] << 8 | mac[5];
+        return by_dir(p, dir,
+                      and_(p, test(p, 4, SR_FILTER_LINK, 6, 0xffffffff, hi),
+                              test(p, 2, SR_FILTER_LINK, 10, 0xffff, lo)),
+                      and_(p, test(p, 4, SR_FILTER_LINK, 0, 0xffffffff, hi),
+                              test(p, 2, SR_FILTER_LINK, 4, 0xffff, lo)));
+    }
+
+    if ( kind == 'p' )
+    {
+        uint32_t port;
+        int l4;
+
+        if ( q != Q_NONE && q != Q_TCP && q != Q_UDP )
+        { return fail(p, "port needs tcp or udp"); }
+        if ( parse_number(p, 0xffff, &port) )
+        { return -1; }
+        l4 = q == Q_NONE ? or_(p, proto_test(p, Q_TCP), proto_test(p, Q_UDP))
+                         : proto_test(p, q);
+        /* -- later fragments have no ports -- */
+        l4 = and_(p, l4, test(p, 2, SR_FILTER_NET, 6, IP_OFFMASK, 0));
+        return and_(p, l4, by_dir(p, dir,
+                                  test(p, 2, SR_FILTER_TRANSPORT, 0, 0xffff, port),
+                                  test(p, 2, SR_FILTER_TRANSPORT, 2, 0xffff, port)));
+    }
+
+    /* -- host or net: IP addresses, ARP sender and target addresses -- */
+    {
+        uint32_t addr, mask;
+        int ip = -1, arp = -1;
+
+        if ( parse_net(p, kind == 'h', &addr, &mask) )
+        { return -1; }
+        if ( q != Q_ARP )
+        {
+            ip = and_(p, proto_test(p, q == Q_NONE ? Q_IP : q),
+                      by_dir(p, dir,
+                             test(p, 4, SR_FILTER_NET, 12, mask, addr),
+                             test(p, 4, SR_FILTER_NET, 16, mask, addr)));
+        }
+        if ( q == Q_NONE || q == Q_ARP )
+        {
+            arp = and_(p, proto_test(p, Q_ARP),
+                       by_dir(p, dir,
+                              test(p, 4, SR_FILTER_NET, 14, mask, addr),
+                              test(p, 4, SR_FILTER_NET, 24, mask, addr)));
+        }
+        if ( ip >= 0 && arp >= 0 )
+        { return or_(p, ip, arp); }
+        return ip >= 0 ? ip : arp;
+    }
+}
+
+static int parse_or(struct parse* p);
+
+static int parse_unary(struct parse* p)
+{
+    if ( accept_word(p, "not", "!") )
+    { return new_node(p, N_NOT, parse_unary(p), 0); }
+    if ( accept_word(p, "(", 0) )
+    {
+        int n = parse_or(p);
+
+        if ( n >= 0 && !accept_word(p, ")", 0) )
+        { return fail(p, "')' expected"); }
+        return n;
+    }
+    return parse_primitive(p);
+}
+
+static int parse_and(struct parse* p)
+{
+    int n = parse_unary(p);
+
+    while ( n >= 0 && accept_word(p, "and", "&&") )
+    { n = and_(p, n, parse_unary(p)); }
+    return n;
+}
+
+static int parse_or(struct parse* p)
+{
+    int n = parse_and(p);
+
+    while ( n >= 0 && accept_word(p, "or", "||") )
+    { n = or_(p, n, parse_and(p)); }
+    return n;
+}
+
+/*---------------------------------------------------------------------
+ * Code generation
+ *---------------------------------------------------------------------*/
+
+struct facts;
+
+struct code
+{
+    struct sr_filter_insn insns[MAX_CODE];
+    int n;
+    int label_pc[MAX_CODE];     /* jt/jf hold labels until resolved */
+    int nlabels;
+    int overflow;
+    struct facts* facts;        /* per instruction, for optimize() */
+};
+
+static int new_label(struct code* c)
+{
+    c->label_pc[c->nlabels] = -1;
+    return c->nlabels++;
+}
+
+static void emit(struct code* c, const struct sr_filter_insn* insn, int t, int f)
+{
+    if ( c->n == MAX_CODE - 2 )
+    { c->overflow = 1; return; }
+    c->insns[c->n] = *insn;
+    c->insns[c->n].jt = t;
+    c->insns[c->n].jf = f;
+    c->n++;
+}
+
+/* Code for node n that continues at label t when true, f when false. */
+static void gen(struct parse* p, struct code* c, int n, int t, int f)
+{
+    struct node* nd = &p->nodes[n];
+    int l;
+
+    switch ( nd->kind )
+    {
+        case N_TEST:
+            emit(c, &nd->test, t, f);
+            break;
+        case N_NOT:
+            gen(p, c, nd->a, f, t);
+            break;
+        case N_AND:
+            l = new_label(c);
+            gen(p, c, nd->a, l, f);
+            c->label_pc[l] = c->n;
+            gen(p, c, nd->b, t, f);
+            break;
+        case N_OR:
+            l = new_label(c);
+            gen(p, c, nd->a, t, l);
+            c->label_pc[l] = c->n;
+            gen(p, c, nd->b, t, f);
+            break;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Optimizer
+ *
+ * A fact is "the load of this test, masked, equals (or differs from) k".
+ * The facts holding on entry to an instruction are those holding on
+ * every edge into it. A test decided by them is bypassed: its
+ * predecessors jump straight to where it would have gone.
+ *---------------------------------------------------------------------*/
+
+struct fact
+{
+    struct sr_filter_insn load;   /* size, base, off, mask, k */
+    int eq;
+};
+
+struct facts
+{
+    int reached;
+    int n;
+    struct fact f[MAX_FACTS];
+};
+
+static int same_load(const struct sr_filter_insn* a, const struct sr_filter_insn* b)
+{
+    return a->size == b->size && a->base == b->base && a->off == b->off &&
+           a->mask == b->mask;
+}
+
+static int same_fact(const struct fact* a, const struct fact* b)
+{
+    return same_load(&a->load, &b->load) && a->load.k == b->load.k && a->eq == b->eq;
+}
+
+/* 1 true, 0 false, -1 unknown */
+static int decide(const struct facts* in, const struct sr_filter_insn* insn)
+{
+    int i;
+
+    for ( i = 0; i < in->n; i++ )
+    {
+        const struct fact* f = &in->f[i];
+
+        if ( !same_load(&f->load, insn) )
+        { continue; }
+        if ( f->eq )
+        { return f->load.k == insn->k; }
+        if ( f->load.k == insn->k )
+        { return 0; }
+    }
+    return -1;
+}
+
+static void flow(struct facts* to, const struct facts* from,
+                 const struct sr_filter_insn* insn, int eq)
+{
+    struct facts out = *from;
+    int i, j;
+
+    if ( out.n < MAX_FACTS )
+    {
+        out.f[out.n].load = *insn;
+        out.f[out.n].eq = eq;
+        out.n++;
+    }
+    if ( !to->reached )
+    { *to = out; return; }
+
+    /* -- keep what holds on both paths -- */
+    for ( i = 0, j = 0; i < to->n; i++ )
+    {
+        int k;
+
+        for ( k = 0; k < out.n; k++ )
+        {
+            if ( same_fact(&to->f[i], &out.f[k]) )
+            { to->f[j++] = to->f[i]; break; }
+        }
+    }
+    to->n = j;
+}
+
+/* where a jump to pc ends up once bypassed tests are skipped */
+static int follow(const int* bypass, int pc)
+{
+    while ( bypass[pc] >= 0 )
+    { pc = bypass[pc]; }
+    return pc;
+}
+
+static void optimize(struct code* c)
+{
+    struct facts* facts = c->facts;
+    int bypass[MAX_CODE];
+    int changed = 1;
+    int i;
+
+    while ( changed )
+    {
+        changed = 0;
+        memset(facts, 0, sizeof(facts[0]) * c->n);
+        facts[0].reached = 1;
+
+        for ( i = 0; i < c->n; i++ )
+        {
+            struct sr_filter_insn* in = &c->insns[i];
+            int d;
+
+            bypass[i] = -1;
+            if ( !facts[i].reached || in->size == 0 )
+            { continue; }
+
+            d = in->jt == in->jf ? 1 : decide(&facts[i], in);
+            if ( d >= 0 && i > 0 )
+            {
+                bypass[i] = d ? in->jt : in->jf;
+                flow(&facts[bypass[i]], &facts[i], in, d);
+                changed = 1;
+                continue;
+            }
+            flow(&facts[in->jt], &facts[i], in, 1);
+            flow(&facts[in->jf], &facts[i], in, 0);
+        }
+
+        for ( i = 0; i < c->n; i++ )
+        {
+            c->insns[i].jt = follow(bypass, c->insns[i].jt);
+            c->insns[i].jf = follow(bypass, c->insns[i].jf);
+        }
+    }
+}
+
+/* Drop unreachable instructions and renumber the jumps. */
+static int compact(struct code* c, struct sr_filter* out)
+{
+    int newpc[MAX_CODE];
+    char reached[MAX_CODE];
+    int entry = 0, i;
+
+    /* -- nothing jumps to the first test, so skip it here if it is moot -- */
+    while ( c->insns[entry].size && c->insns[entry].jt == c->insns[entry].jf )
+    { entry = c->insns[entry].jt; }
+    memset(reached, 0, c->n);
+    reached[entry] = 1;
+    out->len = 0;
+    for ( i = 0; i < c->n; i++ )
+    {
+        newpc[i] = -1;
+        if ( !reached[i] )
+        { continue; }
+        if ( c->insns[i].size )
+        { reached[c->insns[i].jt] = reached[c->insns[i].jf] = 1; }
+        if ( out->len == SR_FILTER_MAX_INSNS )
+        { return -1; }
+        newpc[i] = out->len;
+        out->insns[out->len++] = c->insns[i];
+    }
+    for ( i = 0; i < out->len; i++ )
+    {
+        if ( out->insns[i].size )
+        {
+            out->insns[i].jt = newpc[out->insns[i].jt];
+            out->insns[i].jf = newpc[out->insns[i].jf];
+        }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope: Global
+ *
+ * Parse, lay out with the accept and reject returns last, resolve the
+ * labels, optimize, compact.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_filter* sr_filter_compile(const char* expr)
+{
+    struct parse* p = calloc(1, sizeof(struct parse));
+    struct code* c = calloc(1, sizeof(struct code));
+    struct sr_filter* filter = calloc(1, sizeof(struct sr_filter));
+    struct sr_filter_insn ret;
+    int root = -1, acc, rej, i;
+
+    if ( !p || !c || !filter ||
+         !(c->facts = malloc(sizeof(struct facts) * MAX_CODE)) || tokenize(p, expr) )
+    { goto fail; }
+
+    acc = new_label(c);
+    rej = new_label(c);
+    if ( p->ntok > 0 )
+    {
+        root = parse_or(p);
+        if ( root >= 0 && p->pos < p->ntok )
+        { root = fail(p, "and/or expected"); }
+        if ( root < 0 )
+        { goto fail; }
+        gen(p, c, root, acc, rej);
+    }
+
+    memset(&ret, 0, sizeof(ret));
+    c->label_pc[acc] = c->n;
+    ret.k = 1;
+    emit(c, &ret, 0, 0);
+    c->label_pc[rej] = c->n;
+    ret.k = 0;
+    emit(c, &ret, 0, 0);
+    if ( c->overflow )
+    { fprintf(stderr, "filter: expression too complex\n"); goto fail; }
+
+    for ( i = 0; i < c->n; i++ )
+    {
+        if ( c->insns[i].size )
+        {
+            c->insns[i].jt = c->label_pc[c->insns[i].jt];
+            c->insns[i].jf = c->label_pc[c->insns[i].jf];
+        }
+    }
+
+    optimize(c);
+    if ( compact(c, filter) )
+    { fprintf(stderr, "filter: expression too complex\n"); goto fail; }
+
+    free(p);
+    free(c->facts);
+    free(c);
+    return filter;
+
+fail:
+    free(p);
+    if ( c )
+    { free(c->facts); }
+    free(c);
+    free(filter);
+    return 0;
+} /* -- sr_filter_compile -- */
+
+void sr_filter_free(struct sr_filter* filter)
+{
+    free(filter);
+} /* -- sr_filter_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_filter_match(..)
+ * Scope: Global
+ *
+ * Run the program over a frame. The transport offset is worked out the
+ * first time an instruction needs it.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_filter_match(const struct sr_filter* filter, const uint8_t* frame, uint32_t len)
+{
+    const struct sr_filter_insn* insns = filter->insns;
+    const struct sr_filter_insn* in = insns;
+    uint32_t transport = 0;
+
+    for ( ;; )
+    {
+        uint32_t off, v;
+
+        if ( in->size == 0 )
+        { return in->k; }
+
+        off = in->off;
+        if ( in->base == SR_FILTER_NET )
+        { off += ETHER_HDR; }
+        else if ( in->base == SR_FILTER_TRANSPORT )
+        {
+            if ( !transport )
+            {
+                if ( len <= ETHER_HDR )
+                { return 0; }
+                transport = ETHER_HDR + (frame[ETHER_HDR] & 0x0f) * 4;
+            }
+            off += transport;
+        }
+        if ( off + in->size > len )
+        { return 0; }
+
+        switch ( in->size )
+        {
+            case 1:
+                v = frame[off];
+                break;
+            case 2:
+                v = frame[off] << 8 | frame[off + 1];
+                break;
+            default:
+                v = (uint32_t)frame[off] << 24 | frame[off + 1] << 16 |
+                    frame[off + 2] << 8 | frame[off + 3];
+                break;
+        }
+        in = insns + ((v & in->mask) == in->k ? in->jt : in->jf);
+    }
+} /* -- sr_filter_match -- */
+
+void sr_filter_dump(const struct sr_filter* filter, FILE* out)
+{
+    static const char* base[] = { "", "net+", "tp+" };
+    static const char size[] = { 0, 'b', 'h', 0, 'w' };
+    int i;
+
+    for ( i = 0; i < filter->len; i++ )
+    {
+        const struct sr_filter_insn* in = &filter->insns[i];
+
+        if ( in->size == 0 )
+        {
+            fprintf(out, "(%03d) ret  %s\n", i, in->k ? "accept" : "reject");
+            continue;
+        }
+        fprintf(out, "(%03d) ld%c  [%s%u]", i, size[in->size], base[in->base], in->off);
+        if ( in->mask != (in->size == 4 ? 0xffffffffu : (1u << (8 * in->size)) - 1) )
+        { fprintf(out, " & 0x%x", in->mask); }
+        fprintf(out, " == 0x%x  jt %d  jf %d\n", in->k, in->jt, in->jf);
+    }
+} /* -- sr_filter_dump -- */
@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter.h
+ * Description:
+ *
+ * Capture filters (-f). An expression in a subset of the tcpdump syntax
+ * is compiled once into a short program of load-mask-compare-branch
+ * instructions, which sr_filter_match() runs over each frame. Jumps only
+ * go forward, so a frame costs at most one pass over the program.
+ *
+ *   primitive : [ether|ip|arp|tcp|udp|icmp] [src|dst] host ADDR
+ *             | [ip|arp|tcp|udp|icmp] [src|dst] net A.B.C.D[/LEN]
+ *             | [tcp|udp] [src|dst] port N
+ *             | ip | arp | icmp | tcp | udp | proto N
+ *   expr      : primitive | not expr | ( expr )
+ *             | expr and expr | expr or expr      (also ! && ||)
+ *
+ * ADDR is a MAC address after "ether" and an IPv4 address otherwise.
+ * Without a protocol, host and net match the IP addresses and the ARP
+ * sender/target addresses, and port matches TCP and UDP (first fragments
+ * only). A frame too short for a field the program reads is rejected.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FILTER_H
+#define sr_FILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_FILTER_MAX_INSNS 256
+
+/* where an instruction's offset is counted from */
+enum sr_filter_base
+{
+    SR_FILTER_LINK,         /* start of the ethernet header */
+    SR_FILTER_NET,          /* start of the IP/ARP header */
+    SR_FILTER_TRANSPORT     /* past the IP header, by its IHL */
+};
+
+/* ---------------------------------------------------------------------------
+ * struct sr_filter_insn
+ *
+ * size == 0 returns k (1 accept, 0 reject). Otherwise load size bytes
+ * (1, 2 or 4, network order) at base + off and go to jt if
+ * (value & mask) == k, else to jf. jt and jf are indices into the
+ * program and always greater than this instruction's.
+ * -------------------------------------------------------------------------- */
+
+struct sr_filter_insn
+{
+    uint8_t  size;
+    uint8_t  base;
+    uint16_t off;
+    uint16_t jt;
+    uint16_t jf;
+    uint32_t mask;
+    uint32_t k;
+};
+
+struct sr_filter
+{
+    int len;
+    struct sr_filter_insn insns[SR_FILTER_MAX_INSNS];
+};
+
+/* NULL after printing why to stderr. An empty expression accepts all. */
+struct sr_filter* sr_filter_compile(const char* expr);
+void sr_filter_free(struct sr_filter* filter);
+
+/* 1 if the frame matches */
+int  sr_filter_match(const struct sr_filter* filter, const uint8_t* frame, uint32_t len);
+
+/* The program, one instruction per line, like tcpdump -d */
+void sr_filter_dump(const struct sr_filter* filter, FILE* out);
+
+#endif  /* --  sr_FILTER_H -- */
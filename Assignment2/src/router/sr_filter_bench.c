@@ -0,0 +1,336 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_filter_bench.c
+ *
+ * Description:
+ *
+ * Runs a set of capture filters over a mix of synthetic frames (ICMP,
+ * TCP, UDP, fragments, ARP, truncated frames), checks every verdict
+ * against a hand-written C version of the same filter, then reports the
+ * cost of each filter per frame next to the cost of capturing a frame
+ * to /dev/null. Exits non-zero on any mismatch.
+ * Usage: filter_bench [-d] [iterations]   (-d prints the programs)
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_protocol.h"
+#include "sr_dumper.h"
+#include "sr_filter.h"
+
+#define NFRAMES 4096
+#define FRAME_SZ 128
+
+struct frame
+{
+    uint32_t len;
+    uint8_t  data[FRAME_SZ];
+};
+
+static struct frame frames[NFRAMES];
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void put16(uint8_t* p, uint32_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t* p, uint32_t v) { put16(p, v >> 16); put16(p + 2, v); }
+static uint32_t get16(const uint8_t* p) { return p[0] << 8 | p[1]; }
+static uint32_t get32(const uint8_t* p) { return get16(p) << 16 | get16(p + 2); }
+
+/* 10.0.{0..3}.{1..4}, so host and net filters hit some of the time */
+static uint32_t rand_addr(void)
+{
+    return 0x0a000000 | (rng() % 4) << 8 | (1 + rng() % 4);
+}
+
+static void make_frames(void)
+{
+    static const uint32_t ports[] = { 22, 53, 80, 443, 8080 };
+    int i;
+
+    for ( i = 0; i < NFRAMES; i++ )
+    {
+        struct frame* f = &frames[i];
+        uint8_t* d = f->data;
+        int kind = rng() % 8, k;
+
+        for ( k = 0; k < 12; k++ )
+        { d[k] = k < 6 ? 0x10 + rng() % 2 : 0x20 + rng() % 2; }
+
+        if ( kind == 0 )
+        {
+            /* -- ARP -- */
+            put16(d + 12, ethertype_arp);
+            memset(d + 14, 0, 28);
+            put16(d + 14 + 6, 1 + rng() % 2);
+            put32(d + 14 + 14, rand_addr());
+            put32(d + 14 + 24, rand_addr());
+            f->len = 42;
+            continue;
+        }
+
+        put16(d + 12, ethertype_ip);
+        memset(d + 14, 0, FRAME_SZ - 14);
+        d[14] = 0x45;
+        d[14 + 8] = 64;
+        put32(d + 14 + 12, rand_addr());
+        put32(d + 14 + 16, rand_addr());
+        f->len = 14 + 20 + 8 + 32;
+        if ( kind == 1 )
+        {
+            d[14 + 9] = ip_protocol_icmp;
+        }
+        else
+        {
+            d[14 + 9] = kind < 5 ? 6 : 17;
+            if ( kind == 7 && rng() % 2 )
+            { d[14] = 0x46; f->len += 4; }         /* IP options */
+            if ( rng() % 8 == 0 )
+            { put16(d + 14 + 6, 1 + rng() % 100); } /* later fragment */
+            put16(d + 14 + (d[14] & 0xf) * 4, ports[rng() % 5]);
+            put16(d + 14 + (d[14] & 0xf) * 4 + 2, ports[rng() % 5]);
+        }
+        if ( rng() % 32 == 0 )
+        { f->len = 14 + rng() % 30; }               /* truncated */
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Reference verdicts. A field past the end of the frame rejects it,
+ * as in sr_filter_match.
+ *---------------------------------------------------------------------*/
+
+static int is_ip(const struct frame* f)  { return get16(f->data + 12) == ethertype_ip; }
+static int is_arp(const struct frame* f) { return get16(f->data + 12) == ethertype_arp; }
+
+static int ip_proto(const struct frame* f, int proto)
+{
+    return is_ip(f) && f->len >= 24 && f->data[23] == proto;
+}
+
+static int ref_all(const struct frame* f)  { (void)f; return 1; }
+static int ref_icmp(const struct frame* f) { return ip_proto(f, ip_protocol_icmp); }
+
+static int ref_tcp80(const struct frame* f)
+{
+    uint32_t th;
+
+    if ( !ip_proto(f, 6) || f->len < 22 || (get16(f->data + 20) & IP_OFFMASK) )
+    { return 0; }
+    th = 14 + (f->data[14] & 0xf) * 4;
+    if ( f->len < th + 2 )
+    { return 0; }
+    if ( get16(f->data + th) == 80 )
+    { return 1; }
+    return f->len >= th + 4 && get16(f->data + th + 2) == 80;
+}
+
+static int ref_host(const struct frame* f)
+{
+    const uint32_t a = 0x0a000102;   /* 10.0.1.2 */
+
+    if ( is_ip(f) )
+    {
+        if ( f->len < 30 )
+        { return 0; }
+        if ( get32(f->data + 26) == a )
+        { return 1; }
+        return f->len >= 34 && get32(f->data + 30) == a;
+    }
+    if ( is_arp(f) )
+    {
+        if ( f->len < 32 )
+        { return 0; }
+        if ( get32(f->data + 28) == a )
+        { return 1; }
+        return f->len >= 42 && get32(f->data + 38) == a;
+    }
+    return 0;
+}
+
+static int ref_net_not_ssh(const struct frame* f)
+{
+    uint32_t th;
+    int ssh;
+
+    /* -- ip src net 10.0.2.0/24 and not port 22 -- */
+    if ( !is_ip(f) || f->len < 30 || (get32(f->data + 26) >> 8) != 0x0a0002 )
+    { return 0; }
+    if ( f->len < 24 || (f->data[23] != 6 && f->data[23] != 17) )
+    { return 1; }
+    if ( f->len < 22 )
+    { return 0; }
+    if ( get16(f->data + 20) & IP_OFFMASK )
+    { return 1; }
+    th = 14 + (f->data[14] & 0xf) * 4;
+    if ( f->len < th + 2 )
+    { return 0; }
+    ssh = get16(f->data + th) == 22;
+    if ( !ssh )
+    {
+        if ( f->len < th + 4 )
+        { return 0; }
+        ssh = get16(f->data + th + 2) == 22;
+    }
+    return !ssh;
+}
+
+static int ref_arp_or_dns(const struct frame* f)
+{
+    uint32_t th;
+
+    if ( is_arp(f) )
+    { return 1; }
+    if ( !ip_proto(f, 17) || (get16(f->data + 20) & IP_OFFMASK) )
+    { return 0; }
+    th = 14 + (f->data[14] & 0xf) * 4;
+    return f->len >= th + 4 && get16(f->data + th + 2) == 53;
+}
+
+static int ref_ether(const struct frame* f)
+{
+    static const uint8_t mac[] = { 0x11, 0x10, 0x11, 0x10, 0x10, 0x11 };
+    return f->len >= 6 && memcmp(f->data, mac, 6) == 0;
+}
+
+struct filter_case
+{
+    const char* expr;
+    int (*ref)(const struct frame*);
+    struct sr_filter* prog;
+};
+
+static struct filter_case cases[] =
+{
+    { "",                                              ref_all },
+    { "icmp",                                          ref_icmp },
+    { "tcp port 80",                                   ref_tcp80 },
+    { "host 10.0.1.2",                                 ref_host },
+    { "ip src net 10.0.2.0/24 and not port 22",        ref_net_not_ssh },
+    { "arp || (udp && dst port 53)",                   ref_arp_or_dns },
+    { "ether dst host 11:10:11:10:10:11",              ref_ether },
+};
+
+#define NCASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+static int check(struct filter_case* c)
+{
+    int i, errors = 0;
+
+    for ( i = 0; i < NFRAMES; i++ )
+    {
+        int got = sr_filter_match(c->prog, frames[i].data, frames[i].len);
+        int want = c->ref(&frames[i]);
+
+        if ( got != want && errors++ < 5 )
+            fprintf(stderr, "MISMATCH \"%s\" frame %d (len %u): %d != %d\n",
+                    c->expr, i, frames[i].len, got, want);
+    }
+    return errors;
+}
+
+static void time_filter(struct filter_case* c, long iters)
+{
+    volatile int sink = 0;
+    int matched = 0, i;
+    double t0, t1;
+    long n;
+
+    for ( i = 0; i < NFRAMES; i++ )
+    { matched += sr_filter_match(c->prog, frames[i].data, frames[i].len); }
+
+    t0 = now_sec();
+    for ( n = 0; n < iters; n++ )
+        for ( i = 0; i < NFRAMES; i++ )
+        { sink += sr_filter_match(c->prog, frames[i].data, frames[i].len); }
+    t1 = now_sec();
+    (void)sink;
+    printf("  %-42s %3d insns  %5.1f%% match  %6.1f ns/frame\n",
+           c->expr[0] ? c->expr : "(empty)", c->prog->len,
+           100.0 * matched / NFRAMES, (t1 - t0) * 1e9 / iters / NFRAMES);
+}
+
+/* sr_capture_packet to /dev/null, with and without a filter */
+static void time_capture(const char* expr, long iters)
+{
+    struct sr_capture_opts opts;
+    struct sr_capture* cap;
+    struct sr_capture_stats st;
+    double t0, t1;
+    long n;
+    int i;
+
+    sr_capture_default_opts(&opts, 1024);
+    if ( expr )
+    { opts.filter = sr_filter_compile(expr); }
+    if ( !(cap = sr_capture_open("/dev/null", &opts)) )
+    { fprintf(stderr, "can't capture to /dev/null\n"); exit(1); }
+
+    t0 = now_sec();
+    for ( n = 0; n < iters; n++ )
+        for ( i = 0; i < NFRAMES; i++ )
+        { sr_capture_packet(cap, frames[i].data, frames[i].len); }
+    t1 = now_sec();
+    sr_capture_get_stats(cap, &st);
+    printf("  capture, %-33s %6.1f ns/frame  (%llu captured)\n",
+           expr ? expr : "no filter", (t1 - t0) * 1e9 / iters / NFRAMES,
+           (unsigned long long)st.packets);
+    sr_capture_close(cap);
+}
+
+int main(int argc, char** argv)
+{
+    long iters = 500;
+    int dump = 0, errors = 0, i;
+
+    for ( i = 1; i < argc; i++ )
+    {
+        if ( !strcmp(argv[i], "-d") )
+        { dump = 1; }
+        else
+        { iters = atol(argv[i]); }
+    }
+
+    make_frames();
+    for ( i = 0; i < NCASES; i++ )
+    {
+        if ( !(cases[i].prog = sr_filter_compile(cases[i].expr)) )
+        { return 1; }
+        if ( dump )
+        {
+            printf("%s\n", cases[i].expr);
+            sr_filter_dump(cases[i].prog, stdout);
+        }
+        errors += check(&cases[i]);
+    }
+    printf("reference check (%d filters, %d frames): %s\n", NCASES, NFRAMES,
+           errors ? "FAILED" : "ok");
+    if ( errors )
+    { return 1; }
+
+    for ( i = 0; i < NCASES; i++ )
+    { time_filter(&cases[i], iters); }
+    time_capture(0, iters / 10 + 1);
+    time_capture("tcp port 80", iters / 10 + 1);
+
+    for ( i = 0; i < NCASES; i++ )
+    { sr_filter_free(cases[i].prog); }
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.c
+ *
+ * Description:
+ *
+ * Per-thread destination cache, see sr_flow.h.
+ *
+ * Way 0 of a set holds the entry used most recently: a hit in way 1
+ * swaps the two, and an insert pushes way 0 into way 1. A thread's table
+ * is allocated the first time it looks something up and lives as long as
+ * the process, so the statistics can still be read after it exits.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sr_flow.h"
+
+#define SR_FLOW_BURST 32   /* sets prefetched together */
+
+struct sr_flow_set
+{
+    uint32_t       dst[SR_FLOW_WAYS];
+    uint32_t       gen[SR_FLOW_WAYS];
+    struct sr_adj* adj[SR_FLOW_WAYS];   /* NULL while the way is empty */
+};
+
+struct sr_flow_cache
+{
+    struct sr_flow_set    sets[SR_FLOW_SETS];
+    uint64_t              hits;
+    uint64_t              misses;
+    uint64_t              bypassed;
+    uint32_t              window;       /* lookups in the current window */
+    uint32_t              window_hits;
+    uint32_t              bypass;       /* lookups left to bypass */
+    struct sr_flow_cache* next;         /* all caches, for the statistics */
+};
+
+static struct sr_flow_cache* all_caches;
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct sr_flow_cache* my_cache;
+
+/* Fibonacci hashing; the low bits of an address in network byte order
+   are its first octet, so take the set from the top of the product. */
+static inline uint32_t flow_set(uint32_t dst)
+{
+    return (dst * 0x9e3779b1u) >> (32 - SR_FLOW_SET_BITS);
+}
+
+static struct sr_flow_cache* flow_cache(void)
+{
+    if (!my_cache)
+    {
+        if ((my_cache = calloc(1, sizeof(struct sr_flow_cache))) == 0)
+        { return 0; }
+        pthread_mutex_lock(&all_lock);
+        my_cache->next = all_caches;
+        all_caches = my_cache;
+        pthread_mutex_unlock(&all_lock);
+    }
+    return my_cache;
+} /* -- flow_cache -- */
+
+/* -- judge the hit rate once a window is full -- */
+static void flow_account(struct sr_flow_cache* c, unsigned int n, unsigned int hits)
+{
+    __atomic_store_n(&c->hits, c->hits + hits, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->misses, c->misses + n - hits, __ATOMIC_RELAXED);
+    c->window += n;
+    c->window_hits += hits;
+    if (c->window >= SR_FLOW_WINDOW)
+    {
+        if ((uint64_t)c->window_hits * 100 < (uint64_t)c->window * SR_FLOW_MIN_HITS)
+        { c->bypass = SR_FLOW_BYPASS; }
+        c->window = c->window_hits = 0;
+    }
+} /* -- flow_account -- */
+
+unsigned int sr_flow_lookup_burst(const uint32_t* dst, struct sr_adj** adj,
+                                  unsigned int n, uint32_t gen)
+{
+    struct sr_flow_cache* c = flow_cache();
+    struct sr_flow_set* set[SR_FLOW_BURST];
+    unsigned int i, hits = 0, total = 0;
+
+    if (!c || c->bypass)
+    {
+        memset(adj, 0, n * sizeof(adj[0]));
+        if (c)
+        {
+            c->bypass = c->bypass > n ? c->bypass - n : 0;
+            __atomic_store_n(&c->bypassed, c->bypassed + n, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+    while (n > SR_FLOW_BURST)
+    {
+        total += sr_flow_lookup_burst(dst, adj, SR_FLOW_BURST, gen);
+        dst += SR_FLOW_BURST;
+        adj += SR_FLOW_BURST;
+        n -= SR_FLOW_BURST;
+    }
+
+    /* -- touch every set of the burst before comparing any of them -- */
+    for (i = 0; i < n; i++)
+    {
+        set[i] = &c->sets[flow_set(dst[i])];
+        __builtin_prefetch(set[i]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        struct sr_flow_set* s = set[i];
+
+        adj[i] = 0;
+        if (s->adj[0] && s->dst[0] == dst[i] && s->gen[0] == gen)
+        {
+            adj[i] = s->adj[0];
+            hits++;
+        }
+        else if (s->adj[1] && s->dst[1] == dst[i] && s->gen[1] == gen)
+        {
+            /* -- move it to the front -- */
+            adj[i] = s->adj[1];
+            s->dst[1] = s->dst[0];
+            s->gen[1] = s->gen[0];
+            s->adj[1] = s->adj[0];
+            s->dst[0] = dst[i];
+            s->gen[0] = gen;
+            s->adj[0] = adj[i];
+            hits++;
+        }
+    }
+    flow_account(c, n, hits);
+    return total + hits;
+} /* -- sr_flow_lookup_burst -- */
+
+void sr_flow_insert(uint32_t dst, struct sr_adj* adj, uint32_t gen)
+{
+    struct sr_flow_cache* c = flow_cache();
+    struct sr_flow_set* s;
+
+    if (!c || c->bypass)
+    { return; }
+    s = &c->sets[flow_set(dst)];
+    if (!s->adj[0] || s->dst[0] != dst)
+    {
+        /* -- way 0 is the newest, push it back -- */
+        s->dst[1] = s->dst[0];
+        s->gen[1] = s->gen[0];
+        s->adj[1] = s->adj[0];
+    }
+    s->dst[0] = dst;
+    s->gen[0] = gen;
+    s->adj[0] = adj;
+} /* -- sr_flow_insert -- */
+
+void sr_flow_get_stats(struct sr_flow_stats* stats)
+{
+    struct sr_flow_cache* c;
+
+    stats->hits = stats->misses = stats->bypassed = 0;
+    stats->threads = 0;
+    pthread_mutex_lock(&all_lock);
+    for (c = all_caches; c; c = c->next)
+    {
+        stats->hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+        stats->bypassed += __atomic_load_n(&c->bypassed, __ATOMIC_RELAXED);
+        stats->threads++;
+    }
+    pthread_mutex_unlock(&all_lock);
+} /* -- sr_flow_get_stats -- */
+
+void sr_flow_print_stats(FILE* fp)
+{
+    struct sr_flow_stats s;
+    uint64_t total;
+
+    sr_flow_get_stats(&s);
+    total = s.hits + s.misses;
+    fprintf(fp, "Flow cache: %llu hits, %llu misses (%.1f%% hit), "
+            "%llu bypassed in %u threads\n",
+            (unsigned long long)s.hits, (unsigned long long)s.misses,
+            total ? 100.0 * s.hits / total : 0.0,
+            (unsigned long long)s.bypassed, s.threads);
+} /* -- sr_flow_print_stats -- */
@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.h
+ * Description:
+ *
+ * Destination cache in front of the FIB. Each thread that forwards keeps
+ * a small 2-way set-associative table mapping a destination address to
+ * the adjacency (sr_adj.h) its last packet left through, so a destination
+ * seen recently skips the route lookup and the adjacency lookup.
+ *
+ * Entries are tagged with the routing generation (sr->route_gen) they
+ * were filled under, and every change to the routes bumps it, which
+ * invalidates all of them at once. Changes to the ARP cache need no
+ * invalidation: they rewrite the adjacency in place, and an entry whose
+ * adjacency is unresolved simply sends its frame down the ARP path.
+ *
+ * The cache only pays when most packets hit: a miss costs the FIB lookup
+ * and then some. Each thread judges its own hit rate over every
+ * SR_FLOW_WINDOW lookups, and below SR_FLOW_MIN_HITS percent it stops
+ * using the cache for the next SR_FLOW_BYPASS: lookups miss at once and
+ * nothing is inserted. Then it measures again, so traffic that becomes
+ * skewed gets the cache back.
+ *
+ * Lookups and inserts only touch the calling thread's table. Hit and miss
+ * counts are kept per thread and summed by sr_flow_get_stats.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FLOW_H
+#define sr_FLOW_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_FLOW_SET_BITS 12
+#define SR_FLOW_SETS     (1 << SR_FLOW_SET_BITS)
+#define SR_FLOW_WAYS     2
+
+#define SR_FLOW_WINDOW   (1 << 16)  /* lookups the hit rate is judged over */
+#define SR_FLOW_MIN_HITS 85         /* percent, below it the cache is bypassed */
+#define SR_FLOW_BYPASS   (1 << 20)  /* lookups it is bypassed for */
+
+struct sr_adj;
+
+struct sr_flow_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bypassed;      /* lookups made while the cache was bypassed */
+    uint32_t threads;       /* threads that have a cache */
+};
+
+/* Look up n destinations (network byte order) under generation gen.
+   adj[i] is the cached adjacency of dst[i], or NULL on a miss or while
+   the cache is bypassed. Returns the number of hits. */
+unsigned int sr_flow_lookup_burst(const uint32_t* dst, struct sr_adj** adj,
+                                  unsigned int n, uint32_t gen);
+
+/* Remember that dst leaves through adj, as found under generation gen. */
+void sr_flow_insert(uint32_t dst, struct sr_adj* adj, uint32_t gen);
+
+void sr_flow_get_stats(struct sr_flow_stats* stats);
+void sr_flow_print_stats(FILE* fp);
+
+#endif  /* --  sr_FLOW_H -- */
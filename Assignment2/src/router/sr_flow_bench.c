@@ -0,0 +1,259 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow_bench.c
+ *
+ * Description:
+ *
+ * Forwarding decision (route lookup, adjacency, header copy) for bursts
+ * of destinations drawn from a Zipf distribution, with and without the
+ * flow cache in front of the FIB. Checks that both pick the same
+ * adjacency for every packet.
+ * Usage: flow_bench [nprefixes ndests zipf_exponent]
+ * (default: a few mixes of table size, destination count and skew).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_adj.h"
+#include "sr_flow.h"
+
+#define NKEYS   (1 << 20)
+#define PASSES  8
+#define BURST   SR_FIB_BURST
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static struct sr_rt* make_table(uint32_t n)
+{
+    struct sr_rt* rt = calloc(n, sizeof(struct sr_rt));
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        int len = 16 + rng() % 9;
+        uint32_t mask = 0xffffffffu << (32 - len);
+        rt[i].dest.s_addr = htonl(rng() & mask);
+        rt[i].mask.s_addr = htonl(mask);
+        rt[i].gw.s_addr = htonl(0x0a000000u | (rng() & 0xfff));
+        snprintf(rt[i].interface, sr_IFACE_NAMELEN, "eth%u", 1 + i % 3);
+        rt[i].ifid = i % 3;
+        rt[i].next = (i + 1 < n) ? &rt[i + 1] : 0;
+    }
+    return rt;
+}
+
+/* ndests routed addresses, then a trace of NKEYS picks among them where
+   the i-th most popular is chosen with probability ~ 1 / i^s */
+static uint32_t* make_trace(struct sr_rt* table, uint32_t n, uint32_t ndests,
+                            double s)
+{
+    uint32_t* dests = malloc(ndests * sizeof(uint32_t));
+    double* cdf = malloc(ndests * sizeof(double));
+    uint32_t* keys = malloc(NKEYS * sizeof(uint32_t));
+    double sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < ndests; i++)
+    {
+        struct sr_rt* r = &table[rng() % n];
+        dests[i] = r->dest.s_addr | (htonl(rng()) & ~r->mask.s_addr);
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < NKEYS; i++)
+    {
+        double u = (rng() / 4294967296.0 + rng() / 4294967296.0 / 4294967296.0) * sum;
+        uint32_t lo = 0, hi = ndests - 1;
+
+        while (lo < hi)
+        {
+            uint32_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+        }
+        keys[i] = dests[lo];
+    }
+    free(cdf);
+    free(dests);
+    return keys;
+}
+
+static const uint8_t mac[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+static struct sr_adj* route_adjacency(struct sr_adj_table* adjs, struct sr_rt* rt)
+{
+    if (!rt->adj)
+    {
+        rt->adj = sr_adj_add(adjs, rt->gw.s_addr, rt->ifid, mac);
+        sr_adj_resolve(adjs, rt->gw.s_addr, mac);
+    }
+    return rt->adj;
+}
+
+/* -- the forwarding decision for one burst, FIB only -- */
+static void decide_fib(struct sr_fib* fib, struct sr_adj_table* adjs,
+                       const uint32_t* dst, struct sr_adj** out, uint8_t* frames)
+{
+    struct sr_rt* rt[BURST];
+    unsigned int k;
+
+    sr_fib_lookup_burst(fib, dst, rt, BURST);
+    for (k = 0; k < BURST; k++)
+    {
+        out[k] = rt[k] ? route_adjacency(adjs, rt[k]) : 0;
+        if (out[k])
+        { sr_adj_rewrite(out[k], frames + k * 64); }
+    }
+}
+
+/* -- the same with the flow cache in front -- */
+static void decide_flow(struct sr_fib* fib, struct sr_adj_table* adjs,
+                        const uint32_t* dst, struct sr_adj** out, uint8_t* frames,
+                        uint32_t gen)
+{
+    struct sr_rt* rt[BURST];
+    uint32_t mdst[BURST];
+    unsigned int miss[BURST];
+    unsigned int k, m, hits, nmiss = 0;
+
+    hits = sr_flow_lookup_burst(dst, out, BURST, gen);
+    if (!hits)
+    {
+        /* -- all missed, as while the cache is bypassed -- */
+        sr_fib_lookup_burst(fib, dst, rt, BURST);
+        for (k = 0; k < BURST; k++)
+        {
+            if (rt[k] && (out[k] = route_adjacency(adjs, rt[k])))
+            { sr_flow_insert(dst[k], out[k], gen); }
+        }
+    }
+    else if (hits < BURST)
+    {
+        for (k = 0; k < BURST; k++)
+        {
+            if (!out[k])
+            {
+                mdst[nmiss] = dst[k];
+                miss[nmiss++] = k;
+            }
+        }
+        sr_fib_lookup_burst(fib, mdst, rt, nmiss);
+        for (m = 0; m < nmiss; m++)
+        {
+            k = miss[m];
+            if (rt[m] && (out[k] = route_adjacency(adjs, rt[m])))
+            { sr_flow_insert(dst[k], out[k], gen); }
+        }
+    }
+    for (k = 0; k < BURST; k++)
+    {
+        if (out[k])
+        { sr_adj_rewrite(out[k], frames + k * 64); }
+    }
+}
+
+static int bench(uint32_t n, uint32_t ndests, double s)
+{
+    static uint32_t gen;    /* a new table each run, as after a reload */
+    struct sr_rt* table = make_table(n);
+    uint32_t* keys = make_trace(table, n, ndests, s);
+    struct sr_fib* fib = sr_fib_build(table, SR_FIB_ENGINE_DEFAULT);
+    struct sr_adj_table adjs;
+    struct sr_adj* a[BURST];
+    struct sr_adj* b[BURST];
+    struct sr_flow_stats st;
+    static uint8_t frames[BURST * 64];
+    double t0, t_fib, t_flow;
+    uint32_t i, p;
+    unsigned int k;
+
+    gen++;
+    if (!fib || sr_adj_init(&adjs, 2 * n) != 0)
+    {
+        fprintf(stderr, "out of memory for %u prefixes\n", n);
+        return 1;
+    }
+
+    /* -- warm up, and check the cache against the FIB -- */
+    for (i = 0; i < NKEYS; i += BURST)
+    {
+        decide_fib(fib, &adjs, &keys[i], a, frames);
+        decide_flow(fib, &adjs, &keys[i], b, frames, gen);
+        for (k = 0; k < BURST; k++)
+        {
+            if (a[k] != b[k])
+            {
+                fprintf(stderr, "MISMATCH for key %u\n", i + k);
+                return 1;
+            }
+        }
+    }
+
+    t0 = now_sec();
+    for (p = 0; p < PASSES; p++)
+        for (i = 0; i < NKEYS; i += BURST)
+        { decide_fib(fib, &adjs, &keys[i], a, frames); }
+    t_fib = now_sec() - t0;
+
+    sr_flow_get_stats(&st);
+    t0 = now_sec();
+    for (p = 0; p < PASSES; p++)
+        for (i = 0; i < NKEYS; i += BURST)
+        { decide_flow(fib, &adjs, &keys[i], b, frames, gen); }
+    t_flow = now_sec() - t0;
+    {
+        struct sr_flow_stats end;
+        sr_flow_get_stats(&end);
+        st.hits = end.hits - st.hits;
+        st.misses = end.misses - st.misses;
+        st.bypassed = end.bypassed - st.bypassed;
+    }
+
+    printf("%u prefixes, %u destinations, zipf s=%.2f, %u sets x %u ways\n",
+           n, ndests, s, SR_FLOW_SETS, SR_FLOW_WAYS);
+    printf("  %-12s %8.2f ns/pkt\n", "fib", t_fib * 1e9 / PASSES / NKEYS);
+    printf("  %-12s %8.2f ns/pkt  %5.1f%% hits  %5.1f%% bypassed\n",
+           "flow cache", t_flow * 1e9 / PASSES / NKEYS,
+           st.hits + st.misses ? 100.0 * st.hits / (st.hits + st.misses) : 0.0,
+           100.0 * st.bypassed / ((double)PASSES * NKEYS));
+
+    sr_fib_destroy(fib);
+    sr_adj_destroy(&adjs);
+    free(keys);
+    free(table);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 3)
+    { return bench(strtoul(argv[1], 0, 10), strtoul(argv[2], 0, 10), atof(argv[3])); }
+
+    return bench(100000, 10000, 1.0) ||
+           bench(100000, 100000, 1.0) ||
+           bench(1000000, 100000, 1.1) ||
+           bench(100000, 100000, 0.8);
+}
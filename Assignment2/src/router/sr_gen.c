@@ -0,0 +1,448 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_gen.c
+ *
+ * Description:
+ *
+ * Generates reproducible inputs for large-scale benchmarks: a routing
+ * table in the format sr_load_rt reads, the interface file sr_bench
+ * reads, and a pcap trace of UDP frames addressed into the table.
+ *
+ * The table holds one directly connected /24 per interface plus n random
+ * prefixes whose lengths follow a distribution given as a list of
+ * len[-len]:weight items, or one of
+ *
+ *     bgp      24:55,22-23:20,16-21:20,8-15:3,25-32:2   (the default)
+ *     uniform  8-32:1
+ *     long     25-32:1
+ *
+ * Every random prefix goes through one of g gateways on one of the
+ * interfaces' networks. Trace destinations are drawn from the table:
+ *
+ *     uniform       any prefix, any address in it, equally likely
+ *     zipf[:s]      a fixed set of destinations, the i-th most popular
+ *                   sent with probability ~ 1/i^s (s = 1 by default)
+ *     adversarial   only the longest prefixes of the table, the ones a
+ *                   trie has to walk deepest for, and random addresses
+ *                   in them so no cache keeps up
+ *
+ * The same seed always gives the same files.
+ * Usage: sr_gen [-s seed] [-n prefixes] [-l lengths] [-k interfaces]
+ *               [-g gateways] [-r rtable] [-c iffile] [-t trace] [-p packets]
+ *               [-d uniform|zipf[:s]|adversarial] [-u destinations]
+ *               [-z frame size]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_dumper.h"
+
+#define GEN_MAX_IFACES 16
+#define GEN_MAX_FRAME  1514
+#define GEN_ADV_POOL   4096   /* adversarial prefixes wanted */
+
+enum gen_dist { DIST_UNIFORM, DIST_ZIPF, DIST_ADVERSARIAL };
+
+struct gen_prefix
+{
+    uint32_t addr;      /* host byte order */
+    uint8_t  len;
+    uint8_t  iface;     /* 1..k */
+    uint32_t gw;        /* host byte order, 0 for connected */
+};
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 16);
+}
+
+/* Network of interface i (1..k): 100.64.i.0/24, the router at .1 */
+static uint32_t iface_net(int i) { return 0x64400000u | (uint32_t)i << 8; }
+
+/*---------------------------------------------------------------------
+ * Prefix length distribution
+ *---------------------------------------------------------------------*/
+
+static double len_weight[33];
+
+static int parse_lengths(const char* spec)
+{
+    char* copy;
+    char* item;
+    char* save = 0;
+    int lo, hi, l, any = 0;
+    double w;
+
+    if (!strcmp(spec, "bgp"))
+    { spec = "24:55,22-23:20,16-21:20,8-15:3,25-32:2"; }
+    else if (!strcmp(spec, "uniform"))
+    { spec = "8-32:1"; }
+    else if (!strcmp(spec, "long"))
+    { spec = "25-32:1"; }
+
+    memset(len_weight, 0, sizeof(len_weight));
+    copy = strdup(spec);
+    for (item = strtok_r(copy, ",", &save); item; item = strtok_r(0, ",", &save))
+    {
+        if (sscanf(item, "%d-%d:%lf", &lo, &hi, &w) != 3)
+        {
+            if (sscanf(item, "%d:%lf", &lo, &w) != 2)
+            { free(copy); return -1; }
+            hi = lo;
+        }
+        if (lo < 1 || hi > 32 || lo > hi || w < 0)
+        { free(copy); return -1; }
+        /* -- the weight is shared by the lengths of a range -- */
+        for (l = lo; l <= hi; l++)
+        { len_weight[l] += w / (hi - lo + 1); }
+        any |= w > 0;
+    }
+    free(copy);
+    return any ? 0 : -1;
+}
+
+static int random_len(void)
+{
+    double total = 0, u;
+    int l;
+
+    for (l = 1; l <= 32; l++)
+    { total += len_weight[l]; }
+    u = rng() / 4294967296.0 * total;
+    for (l = 1; l < 32; l++)
+    {
+        if (u < len_weight[l])
+        { return l; }
+        u -= len_weight[l];
+    }
+    return 32;
+}
+
+/*---------------------------------------------------------------------
+ * Method: make_table(..)
+ * Scope: Local
+ *
+ * k connected networks, then n distinct random prefixes through g
+ * gateways on each network. A set of
+ * (address, length) keys keeps them distinct.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct gen_prefix* make_table(uint32_t n, int k, int g, uint32_t* count)
+{
+    uint32_t total = n + k;
+    uint32_t nslots = 1024;
+    uint64_t* seen;
+    struct gen_prefix* t;
+    uint32_t i = 0, tries = 0;
+    int j;
+
+    while (nslots < 2 * total)
+    { nslots <<= 1; }
+    seen = calloc(nslots, sizeof(uint64_t));
+    t = malloc(total * sizeof(struct gen_prefix));
+    if (!seen || !t)
+    { fprintf(stderr, "out of memory for %u prefixes\n", total); exit(1); }
+
+    for (j = 1; j <= k; j++)
+    {
+        t[i].addr = iface_net(j);
+        t[i].len = 24;
+        t[i].iface = j;
+        t[i++].gw = 0;
+    }
+    while (i < total)
+    {
+        int len = random_len();
+        uint32_t mask = 0xffffffffu << (32 - len);
+        uint32_t addr = rng() & mask;
+        uint64_t key = (uint64_t)addr << 8 | len;
+        uint32_t h = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (nslots - 1);
+
+        /* -- a small table may not have n distinct prefixes to give -- */
+        if (++tries > 64 * total)
+        {
+            fprintf(stderr, "only %u distinct prefixes with these lengths\n", i - k);
+            break;
+        }
+        while (seen[h] && seen[h] != key + 1)
+        { h = (h + 1) & (nslots - 1); }
+        if (seen[h])
+        { continue; }
+        /* -- keep clear of the interfaces' own networks -- */
+        if ((addr & 0xffc00000u) == 0x64400000u || (iface_net(1) & mask) == addr)
+        { continue; }
+        seen[h] = key + 1;
+
+        t[i].addr = addr;
+        t[i].len = len;
+        t[i].iface = 1 + rng() % k;
+        t[i].gw = iface_net(t[i].iface) | (2 + rng() % g);
+        i++;
+    }
+    free(seen);
+    *count = i;
+    return t;
+}
+
+static void ip_str(uint32_t host, char* buf)
+{
+    struct in_addr a;
+    a.s_addr = htonl(host);
+    strcpy(buf, inet_ntoa(a));
+}
+
+static int write_rtable(const char* path, struct gen_prefix* t, uint32_t n)
+{
+    FILE* fp = fopen(path, "w");
+    char d[16], g[16], m[16];
+    uint32_t i;
+
+    if (!fp)
+    { perror(path); return -1; }
+    for (i = 0; i < n; i++)
+    {
+        ip_str(t[i].addr, d);
+        ip_str(t[i].gw, g);
+        ip_str(t[i].len ? 0xffffffffu << (32 - t[i].len) : 0, m);
+        fprintf(fp, "%-15s %-15s %-15s eth%u\n", d, g, m, t[i].iface);
+    }
+    return fclose(fp);
+}
+
+static int write_ifconfig(const char* path, int k)
+{
+    FILE* fp = fopen(path, "w");
+    char a[16];
+    int i;
+
+    if (!fp)
+    { perror(path); return -1; }
+    for (i = 1; i <= k; i++)
+    {
+        ip_str(iface_net(i) | 1, a);
+        fprintf(fp, "eth%d %s 02:00:00:00:00:%02x\n", i, a, i);
+    }
+    return fclose(fp);
+}
+
+/* a random address inside prefix p, never its network address */
+static uint32_t addr_in(const struct gen_prefix* p)
+{
+    uint32_t host = p->len == 32 ? 0 : rng() & (0xffffffffu >> p->len);
+
+    if (p->len < 31 && host == 0)
+    { host = 1; }
+    return p->addr | host;
+}
+
+/*---------------------------------------------------------------------
+ * Method: write_trace(..)
+ * Scope: Local
+ *
+ * npkts UDP frames arriving on eth1, from hosts on its network, to
+ * destinations drawn from the table as dist says.
+ *
+ *---------------------------------------------------------------------*/
+
+static int write_trace(const char* path, struct gen_prefix* t, uint32_t n,
+                       uint32_t npkts, enum gen_dist dist, double s,
+                       uint32_t ndests, uint32_t fsize)
+{
+    uint8_t frame[GEN_MAX_FRAME];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    uint8_t* udp = (uint8_t*)(ip + 1);
+    uint32_t* dests = 0;
+    double* cdf = 0;
+    uint32_t* pool = 0;
+    uint32_t npool = 0, i;
+    struct pcap_pkthdr h;
+    FILE* fp;
+
+    if (dist == DIST_ZIPF)
+    {
+        double sum = 0;
+
+        dests = malloc(ndests * sizeof(uint32_t));
+        cdf = malloc(ndests * sizeof(double));
+        for (i = 0; i < ndests; i++)
+        {
+            dests[i] = addr_in(&t[rng() % n]);
+            sum += 1.0 / pow(i + 1, s);
+            cdf[i] = sum;
+        }
+    }
+    else if (dist == DIST_ADVERSARIAL)
+    {
+        uint32_t bylen[33] = { 0 };
+        uint32_t want = n < GEN_ADV_POOL ? n : GEN_ADV_POOL, have = 0;
+        int minlen = 33;
+
+        /* -- the longest prefixes, shortening until there are enough -- */
+        for (i = 0; i < n; i++)
+        { bylen[t[i].len]++; }
+        while (minlen > 0 && have < want)
+        { have += bylen[--minlen]; }
+        pool = malloc(n * sizeof(uint32_t));
+        for (i = 0; i < n; i++)
+        { if (t[i].len >= minlen) pool[npool++] = i; }
+    }
+
+    if ((fp = sr_dump_open(path, 0, fsize)) == 0)
+    { return -1; }
+
+    memset(frame, 0, sizeof(frame));
+    memcpy(eth->ether_dhost, "\x02\x00\x00\x00\x00\x01", ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, "\x02\xaa\x00\x00\x00\x01", ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(fsize - sizeof(sr_ethernet_hdr_t));
+    ip->ip_ttl = 64;
+    ip->ip_p = 17;
+    udp[0] = 0x30; udp[1] = 0x39;                       /* 12345 */
+    udp[2] = 0x00; udp[3] = 0x35;                       /* 53 */
+    udp[4] = (fsize - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t)) >> 8;
+    udp[5] = (fsize - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t)) & 0xff;
+
+    for (i = 0; i < npkts; i++)
+    {
+        uint32_t dst;
+
+        if (dist == DIST_UNIFORM)
+        { dst = addr_in(&t[rng() % n]); }
+        else if (dist == DIST_ADVERSARIAL)
+        { dst = addr_in(&t[pool[rng() % npool]]); }
+        else
+        {
+            double u = (rng() / 4294967296.0) * cdf[ndests - 1];
+            uint32_t lo = 0, hi = ndests - 1;
+
+            while (lo < hi)
+            {
+                uint32_t mid = (lo + hi) / 2;
+                if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+            }
+            dst = dests[lo];
+        }
+
+        ip->ip_id = htons(i & 0xffff);
+        ip->ip_src = htonl(iface_net(1) | (2 + i % 253));
+        ip->ip_dst = htonl(dst);
+        ip->ip_sum = 0;
+        ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+        h.ts.tv_sec = i / 1000000;
+        h.ts.tv_usec = i % 1000000;
+        h.caplen = h.len = fsize;
+        sr_dump(fp, &h, frame);
+    }
+    sr_dump_close(fp);
+
+    free(dests);
+    free(cdf);
+    free(pool);
+    return 0;
+}
+
+static void usage(char* argv0)
+{
+    printf("Benchmark input generator\n");
+    printf("Format: %s [-s seed] [-n prefixes] [-l bgp|uniform|long|len[-len]:weight,...]\n", argv0);
+    printf("           [-k interfaces] [-g gateways] [-r rtable] [-c interface file] [-t trace]\n");
+    printf("           [-p packets] [-d uniform|zipf[:s]|adversarial] \n");
+    printf("           [-u zipf destinations] [-z frame size]\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t seed = 1;
+    uint32_t nprefix = 10000, npkts = 100000, ndests = 100000, fsize = 64;
+    uint32_t n;
+    int k = 3, g = 8, c;
+    char* rtable = 0;
+    char* ifconfig = 0;
+    char* trace = 0;
+    enum gen_dist dist = DIST_UNIFORM;
+    double s = 1.0;
+    struct gen_prefix* t;
+
+    parse_lengths("bgp");
+    while ((c = getopt(argc, argv, "hs:n:l:k:g:r:c:t:p:d:u:z:")) != EOF)
+    {
+        switch (c)
+        {
+            case 's': seed = strtoull(optarg, 0, 0); break;
+            case 'n': nprefix = strtoul(optarg, 0, 0); break;
+            case 'k': k = atoi(optarg); break;
+            case 'g': g = atoi(optarg); break;
+            case 'r': rtable = optarg; break;
+            case 'c': ifconfig = optarg; break;
+            case 't': trace = optarg; break;
+            case 'p': npkts = strtoul(optarg, 0, 0); break;
+            case 'u': ndests = strtoul(optarg, 0, 0); break;
+            case 'z': fsize = strtoul(optarg, 0, 0); break;
+            case 'l':
+                if (parse_lengths(optarg) != 0)
+                { fprintf(stderr, "Bad prefix lengths %s\n", optarg); return 1; }
+                break;
+            case 'd':
+                if (!strcmp(optarg, "uniform"))
+                { dist = DIST_UNIFORM; }
+                else if (!strcmp(optarg, "adversarial"))
+                { dist = DIST_ADVERSARIAL; }
+                else if (!strncmp(optarg, "zipf", 4) &&
+                         (optarg[4] == 0 || (optarg[4] == ':' && (s = atof(optarg + 5)) > 0)))
+                { dist = DIST_ZIPF; }
+                else
+                { fprintf(stderr, "Unknown distribution %s\n", optarg); return 1; }
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!rtable && !ifconfig && !trace)
+    { usage(argv[0]); return 1; }
+    if (k < 1 || k > GEN_MAX_IFACES)
+    { fprintf(stderr, "interfaces must be 1..%d\n", GEN_MAX_IFACES); return 1; }
+    if (g < 1 || g > 253)
+    { fprintf(stderr, "gateways must be 1..253\n"); return 1; }
+    if (fsize < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8 ||
+        fsize > GEN_MAX_FRAME)
+    { fprintf(stderr, "frame size must be %u..%d\n", (unsigned)(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8), GEN_MAX_FRAME); return 1; }
+    if (ndests == 0 || npkts == 0)
+    { fprintf(stderr, "need at least one packet and destination\n"); return 1; }
+
+    rng_state = seed * 0x9e3779b97f4a7c15ULL + 1;
+    t = make_table(nprefix, k, g, &n);
+
+    if (rtable && write_rtable(rtable, t, n) != 0)
+    { return 1; }
+    if (ifconfig && write_ifconfig(ifconfig, k) != 0)
+    { return 1; }
+    if (trace && write_trace(trace, t, n, npkts, dist, s, ndests, fsize) != 0)
+    { return 1; }
+
+    fprintf(stderr, "%u prefixes, %d interfaces, seed %llu\n", n, k,
+            (unsigned long long)seed);
+    free(t);
+    return 0;
+}
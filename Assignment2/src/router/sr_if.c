@@ -22,6 +22,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_stats.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_get_interface
@@ -34,23 +35,35 @@
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
-    struct sr_if* if_walker = 0;
+    int id = sr_interface_id(sr, name);
+
+    return id < 0 ? 0 : sr->if_table[id];
+} /* -- sr_get_interface -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_interface_id
+ * Scope: Global
+ *
+ * Given an interface name return its id, or -1 if it doesn't exist.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_interface_id(struct sr_instance* sr, const char* name)
+{
+    int i;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
-    if_walker = sr->if_list;
-
-    while(if_walker)
+    for(i = 0; i < sr->if_count; i++)
     {
-       if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
-        { return if_walker; }
-        if_walker = if_walker->next;
+        if(!strncmp(sr->if_table[i]->name,name,sr_IFACE_NAMELEN))
+        { return i; }
     }
 
-    return 0;
-} /* -- sr_get_interface -- */
+    return -1;
+} /* -- sr_interface_id -- */
 
 /*---------------------------------------------------------------------
  * Method: sr_get_interface_from_ip
@@ -116,26 +129,39 @@ struct sr_if *get_interface_from_eth(struct sr_instance *sr, uint8_t *eth_addres
  * Method: sr_add_interface(..)
  * Scope: Global
  *
- * Add and interface to the router's list
+ * Add and interface to the router's list. Interfaces beyond SR_IF_MAX
+ * are logged and ignored; returns -1 for those, 0 otherwise.
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_interface(struct sr_instance* sr, const char* name)
+int sr_add_interface(struct sr_instance* sr, const char* name)
 {
     struct sr_if* if_walker = 0;
+    struct sr_if* new_if = 0;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
+    if(sr->if_count == SR_IF_MAX)
+    {
+        fprintf(stderr, "More than %d interfaces, ignoring %.*s\n",
+                SR_IF_MAX, sr_IFACE_NAMELEN - 1, name);
+        return -1;
+    }
+
+    new_if = (struct sr_if*)calloc(1, sizeof(struct sr_if));
+    assert(new_if);
+    memcpy(new_if->name, name, strnlen(name, sr_IFACE_NAMELEN - 1));
+    new_if->id = sr->if_count;
+    sr->if_table[sr->if_count++] = new_if;
+    sr_stats_name_interface(new_if->id, new_if->name);
+
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
-        assert(sr->if_list);
-        sr->if_list->next = 0;
-        strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
-        return;
+        sr->if_list = new_if;
+        return 0;
     }
 
     /* -- find the end of the list -- */
@@ -143,11 +169,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
-    assert(if_walker->next);
-    if_walker = if_walker->next;
-    strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
-    if_walker->next = 0;
+    if_walker->next = new_if;
+    return 0;
 } /* -- sr_add_interface -- */
 
 /*---------------------------------------------------------------------
@@ -163,11 +186,9 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
     struct sr_if* if_walker = 0;
 
     /* -- REQUIRES -- */
-    assert(sr->if_list);
+    assert(sr->if_count > 0);
 
-    if_walker = sr->if_list;
-    while(if_walker->next)
-    {if_walker = if_walker->next; }
+    if_walker = sr->if_table[sr->if_count - 1];
 
     /* -- copy address -- */
     memcpy(if_walker->addr,addr,6);
@@ -187,11 +208,9 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
     struct sr_if* if_walker = 0;
 
     /* -- REQUIRES -- */
-    assert(sr->if_list);
+    assert(sr->if_count > 0);
 
-    if_walker = sr->if_list;
-    while(if_walker->next)
-    {if_walker = if_walker->next; }
+    if_walker = sr->if_table[sr->if_count - 1];
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
@@ -26,11 +26,18 @@
 
 struct sr_instance;
 
+#define SR_IF_MAX 16    /* interfaces a router can have */
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
  * Node in the interface list for each router
  *
+ * Interfaces are numbered 0, 1, ... in the order VNS reports them and
+ * sr->if_table[id] points back at each. The packet path, routes and the
+ * ARP queue refer to interfaces by id; names are only looked up for
+ * frames coming from, and filled in for frames going to, VNS.
+ *
  * -------------------------------------------------------------------------- */
 
 struct sr_if
@@ -39,13 +46,15 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  int id;                   /* index in sr->if_table */
   struct sr_if* next;
 };
 
 struct sr_if *sr_get_interface(struct sr_instance* sr, const char* name);
+int sr_interface_id(struct sr_instance* sr, const char* name); /* -1 if unknown */
 struct sr_if *get_interface_from_ip(struct sr_instance *, uint32_t);
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
-void sr_add_interface(struct sr_instance*, const char*);
+int  sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
@@ -0,0 +1,511 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Asynchronous logger, see sr_log.h.
+ *
+ * Each logging thread owns one ring of SR_LOG_RING records; it is the
+ * only producer and the logger thread the only consumer, so a record is
+ * published with one release store of tail. Rings are created on a
+ * thread's first message and are never freed, so the logger can walk the
+ * list without a lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "sr_log.h"
+#include "sr_ring.h"
+#include "sr_utils.h"
+
+#define SR_LOG_RING   1024   /* records per thread, a power of two */
+#define SR_LOG_REC_SZ 192
+#define SR_LOG_DATA   (SR_LOG_REC_SZ - 16)
+#define SR_LOG_STR    63     /* longest string argument kept */
+
+#define SR_LOG_KIND_MSG  0
+#define SR_LOG_KIND_HDRS 1
+
+struct sr_log_rec
+{
+    const char* fmt;
+    uint32_t    frame_len;   /* SR_LOG_KIND_HDRS: length of the whole frame */
+    uint16_t    len;         /* bytes of data used */
+    uint8_t     level;
+    uint8_t     kind;
+    uint8_t     data[SR_LOG_DATA];
+};
+
+typedef char sr_log_rec_check[(sizeof(struct sr_log_rec) == SR_LOG_REC_SZ) ? 1 : -1];
+
+struct sr_log_ring
+{
+    struct sr_log_ring* next;
+    uint64_t dropped;
+    uint32_t head __attribute__ ((aligned (SR_CACHE_LINE)));   /* logger */
+    uint32_t tail __attribute__ ((aligned (SR_CACHE_LINE)));   /* owner */
+    struct sr_log_rec recs[SR_LOG_RING];
+};
+
+/* One conversion of a format string, split up so it can be rebuilt. */
+struct sr_log_spec
+{
+    char flags[8];
+    int  width_star;
+    char width[12];
+    int  has_prec;
+    int  prec_star;
+    char prec[12];
+    char len[3];
+    char conv;
+};
+
+int sr_log_level = SR_LOG_INFO;
+
+static struct sr_log_ring* rings;   /* every thread's ring */
+static __thread struct sr_log_ring* my_ring;
+static pthread_t logger;
+static int running;
+static int stopping;
+
+static const char* level_names[] = { "error", "warn", "info", "debug" };
+
+int sr_log_parse_level(const char* name)
+{
+    int i;
+
+    for (i = 0; i <= SR_LOG_DEBUG; i++)
+    {
+        if (strcasecmp(name, level_names[i]) == 0)
+        { return i; }
+    }
+    if (name[0] >= '0' && name[0] <= '9')
+    { return atoi(name); }
+    return -1;
+} /* -- sr_log_parse_level -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_parse_spec(..)
+ * Scope: Local
+ *
+ * Parse the conversion after a '%'. Advances *pp past it; returns 0 at
+ * the end of the string.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_log_parse_spec(const char** pp, struct sr_log_spec* s)
+{
+    const char* p = *pp;
+    int n;
+
+    memset(s, 0, sizeof(*s));
+    for (n = 0; *p && strchr("-+ #0'", *p) && n < 7; p++)
+    { s->flags[n++] = *p; }
+    if (*p == '*')
+    {
+        s->width_star = 1;
+        p++;
+    }
+    for (n = 0; *p >= '0' && *p <= '9' && n < 11; p++)
+    { s->width[n++] = *p; }
+    if (*p == '.')
+    {
+        s->has_prec = 1;
+        p++;
+        if (*p == '*')
+        {
+            s->prec_star = 1;
+            p++;
+        }
+        for (n = 0; *p >= '0' && *p <= '9' && n < 11; p++)
+        { s->prec[n++] = *p; }
+    }
+    for (n = 0; *p && strchr("hljztLq", *p) && n < 2; p++)
+    { s->len[n++] = *p; }
+    if (!*p)
+    {
+        *pp = p;
+        return 0;
+    }
+    s->conv = *p++;
+    *pp = p;
+    return 1;
+}
+
+static int sr_log_put(struct sr_log_rec* r, const void* v, unsigned int n)
+{
+    if (r->len + n > SR_LOG_DATA)
+    { return -1; }
+    memcpy(r->data + r->len, v, n);
+    r->len += n;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_capture(..)
+ * Scope: Local
+ *
+ * Copy the arguments of a message into r, each by the type its
+ * conversion says: integers widened to 64 bits, doubles as doubles,
+ * strings as a length byte and the characters. Stops when the record
+ * is full; the formatter then stops at the same place.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_log_capture(struct sr_log_rec* r, const char* fmt, va_list ap)
+{
+    const char* p = fmt;
+    struct sr_log_spec s;
+
+    while ((p = strchr(p, '%')) != 0)
+    {
+        int64_t i = 0;
+        double d;
+        int ok = 0;
+
+        p++;
+        if (*p == '%')
+        {
+            p++;
+            continue;
+        }
+        if (!sr_log_parse_spec(&p, &s))
+        { break; }
+
+        if (s.width_star)
+        {
+            i = va_arg(ap, int);
+            if (sr_log_put(r, &i, 8) != 0) { break; }
+        }
+        if (s.prec_star)
+        {
+            i = va_arg(ap, int);
+            if (sr_log_put(r, &i, 8) != 0) { break; }
+        }
+
+        switch (s.conv)
+        {
+            case 'd': case 'i':
+                if (s.len[0] == 'l' && s.len[1] == 'l') i = va_arg(ap, long long);
+                else if (s.len[0] == 'l')               i = va_arg(ap, long);
+                else if (s.len[0] == 'j')               i = va_arg(ap, int64_t);
+                else if (s.len[0] == 'z' || s.len[0] == 't') i = va_arg(ap, ptrdiff_t);
+                else if (s.len[0] == 'q')               i = va_arg(ap, long long);
+                else                                    i = va_arg(ap, int);
+                ok = sr_log_put(r, &i, 8);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                if (s.len[0] == 'l' && s.len[1] == 'l') i = va_arg(ap, unsigned long long);
+                else if (s.len[0] == 'l')               i = va_arg(ap, unsigned long);
+                else if (s.len[0] == 'j')               i = va_arg(ap, uint64_t);
+                else if (s.len[0] == 'z' || s.len[0] == 't') i = va_arg(ap, size_t);
+                else if (s.len[0] == 'q')               i = va_arg(ap, unsigned long long);
+                else                                    i = va_arg(ap, unsigned int);
+                ok = sr_log_put(r, &i, 8);
+                break;
+            case 'c':
+                i = va_arg(ap, int);
+                ok = sr_log_put(r, &i, 8);
+                break;
+            case 'p':
+                i = (int64_t)(uintptr_t)va_arg(ap, void*);
+                ok = sr_log_put(r, &i, 8);
+                break;
+            case 'n':
+                (void)va_arg(ap, void*);
+                break;
+            case 's':
+            {
+                const char* str = va_arg(ap, const char*);
+                size_t n = str ? strnlen(str, SR_LOG_STR) : 6;
+                uint8_t n8 = n;
+                ok = sr_log_put(r, &n8, 1);
+                if (ok == 0)
+                { ok = sr_log_put(r, str ? str : "(null)", n); }
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E':
+            case 'g': case 'G': case 'a': case 'A':
+                d = s.len[0] == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+                ok = sr_log_put(r, &d, 8);
+                break;
+            default:
+                break;
+        }
+        if (ok != 0)
+        { break; }
+    }
+}
+
+static int sr_log_get(const struct sr_log_rec* r, unsigned int* off, void* v, unsigned int n)
+{
+    if (*off + n > r->len)
+    { return -1; }
+    memcpy(v, r->data + *off, n);
+    *off += n;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_format(..)
+ * Scope: Local
+ *
+ * Print a message record: literal text as it is, each conversion
+ * rebuilt with its captured argument ('*' replaced by the value, length
+ * modifiers by the width the argument was stored with).
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_log_format(FILE* fp, const struct sr_log_rec* r)
+{
+    const char* p = r->fmt;
+    unsigned int off = 0;
+    struct sr_log_spec s;
+
+    while (*p)
+    {
+        const char* pct = strchr(p, '%');
+        char spec[64];
+        int64_t i, w = 0, pr = 0;
+        double d;
+        int n;
+
+        if (!pct)
+        {
+            fputs(p, fp);
+            break;
+        }
+        fwrite(p, 1, pct - p, fp);
+        p = pct + 1;
+        if (*p == '%')
+        {
+            fputc('%', fp);
+            p++;
+            continue;
+        }
+        if (!sr_log_parse_spec(&p, &s))
+        { break; }
+
+        if ((s.width_star && sr_log_get(r, &off, &w, 8) != 0) ||
+            (s.prec_star && sr_log_get(r, &off, &pr, 8) != 0))
+        { goto truncated; }
+
+        n = snprintf(spec, sizeof(spec), "%%%s", s.flags);
+        if (s.width_star)
+        { n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)w); }
+        else
+        { n += snprintf(spec + n, sizeof(spec) - n, "%s", s.width); }
+        if (s.prec_star)
+        { n += snprintf(spec + n, sizeof(spec) - n, ".%d", (int)pr); }
+        else if (s.has_prec)
+        { n += snprintf(spec + n, sizeof(spec) - n, ".%s", s.prec); }
+
+        switch (s.conv)
+        {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+                if (sr_log_get(r, &off, &i, 8) != 0) { goto truncated; }
+                snprintf(spec + n, sizeof(spec) - n, "ll%c", s.conv);
+                fprintf(fp, spec, (long long)i);
+                break;
+            case 'c':
+                if (sr_log_get(r, &off, &i, 8) != 0) { goto truncated; }
+                snprintf(spec + n, sizeof(spec) - n, "c");
+                fprintf(fp, spec, (int)i);
+                break;
+            case 'p':
+                if (sr_log_get(r, &off, &i, 8) != 0) { goto truncated; }
+                snprintf(spec + n, sizeof(spec) - n, "p");
+                fprintf(fp, spec, (void*)(uintptr_t)i);
+                break;
+            case 's':
+            {
+                char str[SR_LOG_STR + 1];
+                uint8_t len;
+                if (sr_log_get(r, &off, &len, 1) != 0 ||
+                    sr_log_get(r, &off, str, len) != 0) { goto truncated; }
+                str[len] = 0;
+                snprintf(spec + n, sizeof(spec) - n, "s");
+                fprintf(fp, spec, str);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E':
+            case 'g': case 'G': case 'a': case 'A':
+                if (sr_log_get(r, &off, &d, 8) != 0) { goto truncated; }
+                snprintf(spec + n, sizeof(spec) - n, "%c", s.conv);
+                fprintf(fp, spec, d);
+                break;
+            default:
+                break;
+        }
+    }
+    return;
+
+truncated:
+    fputs("[...]\n", fp);
+}
+
+static void sr_log_print(const struct sr_log_rec* r)
+{
+    flockfile(stderr);
+    if (r->kind == SR_LOG_KIND_HDRS)
+    { print_hdrs((uint8_t*)r->data, r->len < r->frame_len ? r->len : r->frame_len); }
+    else
+    { sr_log_format(stderr, r); }
+    funlockfile(stderr);
+}
+
+/* This thread's ring, made on first use; NULL if out of memory. */
+static struct sr_log_ring* sr_log_my_ring(void)
+{
+    struct sr_log_ring* ring = my_ring;
+
+    if (!ring)
+    {
+        if ((ring = calloc(1, sizeof(struct sr_log_ring))) == 0)
+        { return 0; }
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        { }
+        my_ring = ring;
+    }
+    return ring;
+}
+
+/* Slot for a new record, or NULL to log synchronously into *tmp / drop. */
+static struct sr_log_rec* sr_log_begin(struct sr_log_rec* tmp)
+{
+    struct sr_log_ring* ring;
+    uint32_t tail;
+
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE) || (ring = sr_log_my_ring()) == 0)
+    { return tmp; }
+
+    tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == SR_LOG_RING)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return &ring->recs[tail & (SR_LOG_RING - 1)];
+}
+
+static void sr_log_commit(struct sr_log_rec* r, struct sr_log_rec* tmp)
+{
+    if (r == tmp)
+    { sr_log_print(r); }
+    else
+    { __atomic_store_n(&my_ring->tail, my_ring->tail + 1, __ATOMIC_RELEASE); }
+}
+
+void sr_log_write(int level, const char* fmt, ...)
+{
+    struct sr_log_rec tmp;
+    struct sr_log_rec* r = sr_log_begin(&tmp);
+    va_list ap;
+
+    if (!r)
+    { return; }
+    r->fmt = fmt;
+    r->len = 0;
+    r->level = level;
+    r->kind = SR_LOG_KIND_MSG;
+    va_start(ap, fmt);
+    sr_log_capture(r, fmt, ap);
+    va_end(ap);
+    sr_log_commit(r, &tmp);
+} /* -- sr_log_write -- */
+
+void sr_log_write_hdrs(int level, const uint8_t* buf, uint32_t len)
+{
+    struct sr_log_rec tmp;
+    struct sr_log_rec* r = sr_log_begin(&tmp);
+
+    if (!r)
+    { return; }
+    r->fmt = 0;
+    r->frame_len = len;
+    r->len = len < SR_LOG_DATA ? len : SR_LOG_DATA;
+    r->level = level;
+    r->kind = SR_LOG_KIND_HDRS;
+    memcpy(r->data, buf, r->len);
+    sr_log_commit(r, &tmp);
+} /* -- sr_log_write_hdrs -- */
+
+/* Format everything queued on every ring; returns the number of records. */
+static unsigned int sr_log_drain(void)
+{
+    struct sr_log_ring* ring;
+    unsigned int n = 0;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++, n++)
+        {
+            sr_log_print(&ring->recs[head & (SR_LOG_RING - 1)]);
+            /* -- free each slot as soon as it is printed -- */
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return n;
+}
+
+static void* sr_log_main(void* arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int last = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        if (sr_log_drain() == 0)
+        {
+            if (last)
+            { break; }
+            usleep(1000);
+        }
+    }
+    return 0;
+}
+
+void sr_log_start(void)
+{
+    if (running)
+    { return; }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&logger, 0, sr_log_main, 0) != 0)
+    {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        fprintf(stderr, "sr_log: no logger thread, logging synchronously\n");
+    }
+} /* -- sr_log_start -- */
+
+void sr_log_stop(void)
+{
+    struct sr_log_ring* ring;
+    uint64_t dropped = 0;
+
+    if (!running)
+    { return; }
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(logger, 0);
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    /* -- anything that raced with the last pass -- */
+    sr_log_drain();
+
+    for (ring = rings; ring; ring = ring->next)
+    { dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED); }
+    if (dropped)
+    { fprintf(stderr, "sr_log: %llu messages dropped\n", (unsigned long long)dropped); }
+} /* -- sr_log_stop -- */
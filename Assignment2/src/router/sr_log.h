@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ * Description:
+ *
+ * Leveled logging for the packet path.
+ *
+ * A message is not formatted by the thread that logs it. sr_log() copies
+ * the format pointer and the arguments (strings by value, truncated) into
+ * a fixed-size binary record on a ring owned by the calling thread, and
+ * the logger thread started by sr_log_start() formats records to stderr.
+ * sr_log_hdrs() records the first bytes of a frame the same way and has
+ * print_hdrs() run on them later. A full ring drops the record rather
+ * than block; sr_log_stop() reports how many were lost.
+ *
+ * Levels above SR_LOG_COMPILE_LEVEL are compiled out. The rest cost one
+ * compare against sr_log_level when disabled at run time (-L). Before
+ * sr_log_start, and in programs that never call it, records are
+ * formatted on the spot.
+ *
+ * Format strings must be literals (only the pointer is kept). Supported
+ * conversions: d i u o x X c p s and the floating point ones, with the
+ * usual flags, width, precision and length modifiers. Messages from
+ * different threads come out in per-thread order only.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_LOG_H
+#define sr_LOG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_LOG_ERR   0
+#define SR_LOG_WARN  1
+#define SR_LOG_INFO  2
+#define SR_LOG_DEBUG 3
+
+#ifndef SR_LOG_COMPILE_LEVEL
+#ifdef _DEBUG_
+#define SR_LOG_COMPILE_LEVEL SR_LOG_DEBUG
+#else
+#define SR_LOG_COMPILE_LEVEL SR_LOG_INFO
+#endif
+#endif
+
+extern int sr_log_level;   /* run-time threshold, SR_LOG_INFO by default */
+
+#define sr_log(level, ...) \
+    do { if ((level) <= SR_LOG_COMPILE_LEVEL && (level) <= sr_log_level) \
+             sr_log_write((level), __VA_ARGS__); } while (0)
+
+#define sr_log_hdrs(level, buf, len) \
+    do { if ((level) <= SR_LOG_COMPILE_LEVEL && (level) <= sr_log_level) \
+             sr_log_write_hdrs((level), (buf), (len)); } while (0)
+
+void sr_log_write(int level, const char* fmt, ...)
+     __attribute__ ((format (printf, 2, 3)));
+void sr_log_write_hdrs(int level, const uint8_t* buf, uint32_t len);
+
+/* "error", "warn", "info", "debug" or a number; -1 if unknown */
+int  sr_log_parse_level(const char* name);
+
+void sr_log_start(void);
+/* Format everything still queued and stop the logger thread. */
+void sr_log_stop(void);
+
+#endif  /* --  sr_LOG_H -- */
@@ -27,8 +27,15 @@
 #endif /* _LINUX_ */
 
 #include "sr_dumper.h"
+#include "sr_filter.h"
+#include "sr_flow.h"
 #include "sr_router.h"
+#include "sr_pool.h"
+#include "sr_pipeline.h"
+#include "sr_ctl.h"
+#include "sr_log.h"
 #include "sr_rt.h"
+#include "sr_stats.h"
 
 extern char* optarg;
 
@@ -59,14 +66,26 @@ int main(int argc, char **argv)
     char *server = DEFAULT_SERVER;
     char *rtable = DEFAULT_RTABLE;
     char *template = NULL;
+    char *image = NULL;
+    char *control = NULL;
+    char *stats = SR_STATS_NAME;
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    struct sr_capture_opts capture_opts;
+    struct sr_ratelimit_opts icmp_opts;
+    struct sr_arpq_limits arpq_limits;
+    int fib_engine = SR_FIB_ENGINE_DEFAULT;
+    unsigned int arp_capacity = SR_ARPCACHE_SZ;
+    unsigned int workers = 0;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
+    sr_capture_default_opts(&capture_opts, PACKET_DUMP_SIZE);
+    sr_ratelimit_default_opts(&icmp_opts);
+    sr_arpq_default_limits(&arpq_limits);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:S:c:m:l:C:f:T:F:a:Q:w:E:L:")) != EOF)
     {
         switch (c)
         {
@@ -92,17 +111,102 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'C':
+                if(sr_capture_parse_opts(&capture_opts, optarg) != 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'f':
+                sr_filter_free(capture_opts.filter);
+                if((capture_opts.filter = sr_filter_compile(optarg)) == 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
             case 'r':
                 rtable = optarg;
                 break;
+            case 'S':
+                image = optarg;
+                break;
+            case 'c':
+                control = optarg;
+                break;
+            case 'm':
+                stats = optarg;
+                break;
             case 'T':
                 template = optarg;
                 break;
+            case 'F':
+                if((fib_engine = sr_fib_engine_parse(optarg)) < 0)
+                {
+                    fprintf(stderr,"Unknown FIB engine %s\n", optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'a':
+                if(sr_arpcache_parse_capacity(&arp_capacity, optarg) != 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'Q':
+                if(sr_arpq_parse_limits(&arpq_limits, optarg) != 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                {
+                    char* end;
+                    unsigned long n = strtoul(optarg, &end, 10);
+
+                    if(optarg[0] == '-' || end == optarg || *end ||
+                       n < 1 || n > SR_PIPE_MAX_WORKERS)
+                    {
+                        fprintf(stderr,"Worker threads must be 1 to %d, not %s\n",
+                                SR_PIPE_MAX_WORKERS, optarg);
+                        usage(argv[0]);
+                        exit(1);
+                    }
+                    workers = n;
+                }
+                break;
+            case 'E':
+                if(sr_ratelimit_parse_opts(&icmp_opts, optarg) != 0)
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'L':
+                if((sr_log_level = sr_log_parse_level(optarg)) < 0)
+                {
+                    fprintf(stderr,"Unknown log level %s\n", optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
+    /* -- packet path messages are formatted by a background thread -- */
+    sr_log_start();
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.fib_engine = fib_engine;
+    sr.arp_capacity = arp_capacity;
+    sr.arpq_limits = arpq_limits;
+    if(sr_ratelimit_init(&sr.icmp_limit, &icmp_opts) != 0)
+    { exit(1); }
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -110,21 +214,36 @@ int main(int argc, char **argv)
         sr_load_rt_wrap(&sr, rtable);
     }
     else
-        strncpy(sr.template, template, 30);
+        snprintf(sr.template, sizeof(sr.template), "%s", template);
+
+    /* -- -S only converts the routing table to an image -- */
+    if(image)
+    {
+        if(template != NULL || sr_save_rt(&sr, image) != 0)
+        {
+            fprintf(stderr,"Error saving routing table image %s\n", image);
+            exit(1);
+        }
+        exit(0);
+    }
+
+    /* -- counters go where sr_stat can read them, or stay private -- */
+    if(sr_stats_open(stats) != 0)
+    { fprintf(stderr,"Counters are not exported\n"); }
 
     sr.topo_id = topo;
-    strncpy(sr.host,host,32);
+    snprintf(sr.host, sizeof(sr.host), "%s", host);
 
     if(! user )
     { sr_set_user(&sr); }
     else
-    { strncpy(sr.user, user, 32); }
+    { snprintf(sr.user, sizeof(sr.user), "%s", user); }
 
-    /* -- set up file pointer for logging of raw packets -- */
+    /* -- set up capture of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.capture = sr_capture_open(logfile, &capture_opts);
+        if(!sr.capture)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -156,6 +275,14 @@ int main(int argc, char **argv)
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- hand packets to worker threads if asked to -- */
+    if(workers && sr_pipeline_start(&sr, workers) != 0)
+    { return 1; }
+
+    /* -- routes can be changed from now on -- */
+    if(control && sr_ctl_start(&sr, control) != 0)
+    { return 1; }
+
     /* -- whizbang main loop ;-) */
     while( sr_read_from_server(&sr) == 1);
 
@@ -174,10 +301,25 @@ static void usage(char* argv0)
     printf("Simple Router Client\n");
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
-    printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
-    printf("   defaults server=%s port=%d host=%s  \n",
-            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
+    printf("           [-t topo id] [-r routing table or image] \n");
+    printf("           [-S image: save the routing table as one and exit] \n");
+    printf("           [-c route control socket] [-m counters segment] \n");
+    printf("           [-l log file] [-F list|poptrie|dir24-8]\n");
+    printf("           [-a arp cache entries] [-w worker threads] \n");
+    printf("           [-Q ARP queue: pkts=N,bytes=N,reqpkts=N,reqbytes=N,taildrop|headdrop,\n");
+    printf("               arprate=N,arpburst=N requests per second, 0 unlimited] \n");
+    printf("           [-L error|warn|info|debug] \n");
+    printf("           [-E ICMP errors: rate=N,burst=N,src=N,srcburst=N per second, 0 unlimited] \n");
+    printf("           [-C pcap|pcapng,snaplen=N,size=N[kmg],secs=N] \n");
+    printf("           [-f capture filter, e.g. \"icmp or tcp port 80\"] \n");
+    printf("   defaults server=%s port=%d host=%s counters=%s \n",
+            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, SR_STATS_NAME );
+    printf("   ICMP errors rate=%d,burst=%d,src=%d,srcburst=%d \n",
+            SR_RATELIMIT_RATE, SR_RATELIMIT_BURST,
+            SR_RATELIMIT_SRC_RATE, SR_RATELIMIT_SRC_BURST );
+    printf("   ARP queue pkts=%d,bytes=%d,reqpkts=%d,reqbytes=%d,taildrop,arprate=%d,arpburst=%d \n",
+            SR_ARPQ_PKTS, SR_ARPQ_BYTES, SR_ARPQ_REQ_PKTS, SR_ARPQ_REQ_BYTES,
+            SR_ARPREQ_RATE, SR_ARPREQ_BURST );
 } /* -- usage -- */
 
 /*-----------------------------------------------------------------------------
@@ -196,11 +338,11 @@ void sr_set_user(struct sr_instance* sr)
     if(( pw = getpwuid(uid) ) == 0)
     {
         fprintf (stderr, "Error getting username, using something silly\n");
-        strncpy(sr->user, "something_silly", 32);
+        snprintf(sr->user, sizeof(sr->user), "%s", "something_silly");
     }
     else
     {
-        strncpy(sr->user, pw->pw_name, 32);
+        snprintf(sr->user, sizeof(sr->user), "%s", pw->pw_name);
     }
 
 } /* -- sr_set_user -- */
@@ -217,11 +359,20 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    sr_pipeline_stop(sr);
+    sr_log_stop();
+
+    if(sr->capture)
     {
-        sr_dump_close(sr->logfile);
+        sr_capture_close(sr->capture);
     }
 
+    sr_pool_print_stats(stderr);
+    sr_flow_print_stats(stderr);
+    sr_arpcache_print_queue_stats(&(sr->cache), stderr);
+    sr_stats_print(stderr);
+    sr_stats_close();
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -244,8 +395,19 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
+    sr->if_count = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->rt_block = 0;
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr->fib = 0;
+    sr->fib_engine = SR_FIB_ENGINE_DEFAULT;
+    sr->route_gen = 0;
+    sr->arp_capacity = SR_ARPCACHE_SZ;
+    sr_arpq_default_limits(&(sr->arpq_limits));
+    memset(&(sr->icmp_limit), 0, sizeof(sr->icmp_limit));
+    sr->capture = 0;
+    sr->vns = 0;
+    sr->pipeline = 0;
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -254,7 +416,7 @@ static void sr_init_instance(struct sr_instance* sr)
  *
  * make sure the routing table is consistent with the interface list by
  * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
+ * in the hardware, and give each route the id of its interface.
  *
  * RETURN VALUES:
  *
@@ -266,7 +428,6 @@ static void sr_init_instance(struct sr_instance* sr)
 int sr_verify_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
     int ret = 0;
 
     /* -- REQUIRES --*/
@@ -277,25 +438,23 @@ int sr_verify_routing_table(struct sr_instance* sr)
         return 999; /* doh! */
     }
 
+    pthread_mutex_lock(&(sr->rt_lock));
     rt_walker = sr->routing_table;
 
     while(rt_walker)
     {
         /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
+        rt_walker->ifid = sr_interface_id(sr, rt_walker->interface);
+        if(rt_walker->ifid < 0)
         { ret++; } /* -- interface not found! -- */
 
         rt_walker = rt_walker->next;
     } /* -- while -- */
 
+    /* -- cached destinations may have been found before the ids were -- */
+    __atomic_add_fetch(&sr->route_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
     return ret;
 } /* -- sr_verify_routing_table -- */
 
@@ -0,0 +1,458 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.c
+ *
+ * Description:
+ *
+ * Reader / worker / TX threads connected by rings, see sr_pipeline.h.
+ *
+ * Every frame in flight lives in one pool buffer:
+ *
+ *   0                  struct sr_pipe_meta (received frames)
+ *   SR_PIPE_HDR_OFF    VNS packet header, filled in when the frame is sent
+ *   SR_PIPE_FRAME_OFF  the Ethernet frame
+ *
+ * so a worker forwards a frame by rewriting it in place and passing the
+ * same buffer on to TX, which frees it once it is written.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sr_pipeline.h"
+#include "sr_pool.h"
+#include "sr_ring.h"
+#include "sr_stats.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "vnscommand.h"
+
+#define SR_PIPE_HDR_OFF   64
+#define SR_PIPE_FRAME_OFF (SR_PIPE_HDR_OFF + SR_PACKET_HEADROOM)
+#define SR_PIPE_FRAME_MAX (SR_POOL_BUF_SZ - SR_PIPE_FRAME_OFF)
+#define SR_PIPE_TX_BATCH  64    /* frames a worker sends before handing them over */
+#define SR_PIPE_TX_IOV    64    /* frames per writev */
+
+struct sr_pipe_meta
+{
+    unsigned int len;
+    int iface;          /* id of the receiving interface */
+};
+
+typedef char sr_pipe_meta_check[(sizeof(struct sr_pipe_meta) <= SR_PIPE_HDR_OFF) ? 1 : -1];
+
+struct sr_pipe_worker
+{
+    struct sr_pipeline* pipe;
+    unsigned int id;
+    pthread_t thread;
+    struct sr_ring* rx;    /* reader -> worker */
+    struct sr_ring* tx;    /* worker -> TX */
+
+    /* -- worker thread only -- */
+    uint8_t* burst[SR_BURST_MAX];  /* buffers being handled */
+    uint8_t  sent[SR_BURST_MAX];   /* ... and already passed to TX */
+    unsigned int nburst;
+    uint8_t* pending[SR_PIPE_TX_BATCH];
+    unsigned int npending;
+    uint64_t frames;
+
+    /* -- reader thread only -- */
+    uint8_t* rx_pending[SR_BURST_MAX];
+    unsigned int nrx_pending;
+} __attribute__ ((aligned (SR_CACHE_LINE)));
+
+struct sr_pipeline
+{
+    struct sr_instance* sr;
+    unsigned int nworkers;
+    struct sr_pipe_worker workers[SR_PIPE_MAX_WORKERS];
+    struct sr_mpsc_ring* other_tx;  /* sends from any other thread */
+    pthread_t tx_thread;
+    int stop_workers;
+    int stop_tx;
+    uint64_t rx_drops;    /* reader: no buffer or frame too long */
+    uint64_t tx_drops;    /* senders: no buffer or ring full */
+};
+
+static __thread struct sr_pipe_worker* pipe_self;
+
+static void sr_pipe_idle(unsigned int* spins)
+{
+    if ( ++(*spins) < 128 )
+    { sched_yield(); }
+    else
+    { usleep(100); }
+}
+
+static uint8_t* sr_pipe_base(uint8_t* frame)
+{
+    return frame - SR_PIPE_FRAME_OFF;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_flow_hash(..)
+ * Scope: Local
+ *
+ * Worker for a frame: IPv4 by source, destination and protocol (not
+ * ports, so fragments of a datagram stay together), everything else to
+ * worker 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_pipe_flow_hash(const uint8_t* frame, unsigned int len,
+                                      unsigned int nworkers)
+{
+    const sr_ip_hdr_t* ip;
+    uint32_t h;
+
+    if ( nworkers == 1 ||
+         len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+         ethertype((uint8_t*)frame) != ethertype_ip )
+    { return 0; }
+
+    ip = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    h = ip->ip_src ^ (ip->ip_dst * 0x9e3779b1u) ^ ip->ip_p;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h % nworkers;
+}
+
+/* Block until all of bufs is on the ring. */
+static void sr_pipe_push(struct sr_ring* ring, uint8_t** bufs, unsigned int n)
+{
+    unsigned int spins = 0;
+
+    while ( n > 0 )
+    {
+        unsigned int k = sr_ring_enqueue_burst(ring, (void* const*)bufs, n);
+        bufs += k;
+        n -= k;
+        if ( n > 0 )
+        { sr_pipe_idle(&spins); }
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_rx(..)
+ * Scope: Global
+ *
+ * Reader thread. Copy a received frame out of the socket buffer and
+ * queue it for its worker; queued frames are handed over SR_BURST_MAX at
+ * a time, or by sr_pipeline_rx_flush.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pipeline_rx(struct sr_instance* sr, const uint8_t* frame,
+                    unsigned int len, int iface)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    struct sr_pipe_worker* w;
+    struct sr_pipe_meta* meta;
+    uint8_t* buf;
+
+    if ( len > SR_PIPE_FRAME_MAX || (buf = sr_pool_get()) == 0 )
+    {
+        pipe->rx_drops++;
+        sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+        return;
+    }
+
+    meta = (struct sr_pipe_meta*)buf;
+    meta->len = len;
+    meta->iface = iface;
+    memcpy(buf + SR_PIPE_FRAME_OFF, frame, len);
+
+    w = &pipe->workers[sr_pipe_flow_hash(frame, len, pipe->nworkers)];
+    w->rx_pending[w->nrx_pending++] = buf;
+    if ( w->nrx_pending == SR_BURST_MAX )
+    {
+        sr_pipe_push(w->rx, w->rx_pending, w->nrx_pending);
+        w->nrx_pending = 0;
+    }
+} /* -- sr_pipeline_rx -- */
+
+void sr_pipeline_rx_flush(struct sr_instance* sr)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    unsigned int i;
+
+    for ( i = 0; i < pipe->nworkers; i++ )
+    {
+        struct sr_pipe_worker* w = &pipe->workers[i];
+        if ( w->nrx_pending )
+        {
+            sr_pipe_push(w->rx, w->rx_pending, w->nrx_pending);
+            w->nrx_pending = 0;
+        }
+    }
+} /* -- sr_pipeline_rx_flush -- */
+
+static void sr_pipe_tx_flush(struct sr_pipe_worker* w)
+{
+    sr_pipe_push(w->tx, w->pending, w->npending);
+    w->npending = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipeline_send(..)
+ * Scope: Global
+ *
+ * Queue a frame for the TX thread. A frame sent in place by a worker
+ * must be one of the frames it is handling; its buffer is passed on as
+ * it is, with the VNS header the caller wrote into the headroom. Any
+ * other frame is copied into a new buffer. Workers queue on their own
+ * ring, everybody else on the shared one.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pipeline_send(struct sr_instance* sr, uint8_t* frame,
+                     unsigned int len, int iface, int inplace)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    struct sr_pipe_worker* w = pipe_self;
+    c_packet_header* hdr;
+    uint8_t* buf;
+    unsigned int i;
+
+    if ( inplace && w )
+    {
+        buf = sr_pipe_base(frame);
+        for ( i = 0; i < w->nburst; i++ )
+        {
+            if ( w->burst[i] == buf && !w->sent[i] )
+            { break; }
+        }
+        if ( i < w->nburst )
+        {
+            w->sent[i] = 1;
+            w->pending[w->npending++] = buf;
+            if ( w->npending == SR_PIPE_TX_BATCH )
+            { sr_pipe_tx_flush(w); }
+            return 0;
+        }
+    }
+
+    if ( len > SR_PIPE_FRAME_MAX || (buf = sr_pool_get()) == 0 )
+    {
+        __atomic_add_fetch(&pipe->tx_drops, 1, __ATOMIC_RELAXED);
+        sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+        return -1;
+    }
+    hdr = (c_packet_header*)(buf + SR_PIPE_HDR_OFF);
+    sr_fill_packet_header(hdr, len + sizeof(c_packet_header),
+                          sr_get_interface_by_id(sr, iface)->name);
+    memcpy(buf + SR_PIPE_FRAME_OFF, frame, len);
+
+    if ( w )
+    {
+        w->pending[w->npending++] = buf;
+        if ( w->npending == SR_PIPE_TX_BATCH )
+        { sr_pipe_tx_flush(w); }
+    }
+    else if ( sr_mpsc_enqueue(pipe->other_tx, buf) != 0 )
+    {
+        sr_pool_put(buf);
+        __atomic_add_fetch(&pipe->tx_drops, 1, __ATOMIC_RELAXED);
+        sr_stats_add(SR_STAT_DROP_QUEUE_FULL, 1);
+        return -1;
+    }
+    return 0;
+} /* -- sr_pipeline_send -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_worker_main(..)
+ * Scope: Local
+ *
+ * Run bursts from the worker's ring through the router. Frames that
+ * were not sent in place are freed afterwards; everything sent goes to
+ * TX at the end of the burst.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipe_worker_main(void* arg)
+{
+    struct sr_pipe_worker* w = arg;
+    struct sr_pipeline* pipe = w->pipe;
+    uint8_t* frames[SR_BURST_MAX];
+    unsigned int lens[SR_BURST_MAX];
+    int ifaces[SR_BURST_MAX];
+    unsigned int i, n, spins = 0;
+    int stopping;
+
+    pipe_self = w;
+
+    while ( 1 )
+    {
+        /* -- the flag is read first, so an empty ring after it is final -- */
+        stopping = __atomic_load_n(&pipe->stop_workers, __ATOMIC_ACQUIRE);
+        n = sr_ring_dequeue_burst(w->rx, (void**)w->burst, SR_BURST_MAX);
+        if ( n == 0 )
+        {
+            if ( stopping )
+            { break; }
+            sr_pipe_idle(&spins);
+            continue;
+        }
+        spins = 0;
+
+        for ( i = 0; i < n; i++ )
+        {
+            struct sr_pipe_meta* meta = (struct sr_pipe_meta*)w->burst[i];
+            frames[i] = w->burst[i] + SR_PIPE_FRAME_OFF;
+            lens[i] = meta->len;
+            ifaces[i] = meta->iface;
+            w->sent[i] = 0;
+        }
+        w->nburst = n;
+        sr_handlepacket_burst(pipe->sr, frames, lens, ifaces, n);
+        w->nburst = 0;
+
+        for ( i = 0; i < n; i++ )
+        {
+            if ( !w->sent[i] )
+            { sr_pool_put(w->burst[i]); }
+        }
+        if ( w->npending )
+        { sr_pipe_tx_flush(w); }
+        w->frames += n;
+    }
+
+    pipe_self = 0;
+    return 0;
+} /* -- sr_pipe_worker_main -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pipe_tx_main(..)
+ * Scope: Local
+ *
+ * Gather queued frames from every ring into one writev, then free them.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_pipe_tx_main(void* arg)
+{
+    struct sr_pipeline* pipe = arg;
+    uint8_t* bufs[SR_PIPE_TX_IOV];
+    struct iovec iov[SR_PIPE_TX_IOV];
+    unsigned int i, n, spins = 0, next = 0;
+    int stopping;
+
+    while ( 1 )
+    {
+        stopping = __atomic_load_n(&pipe->stop_tx, __ATOMIC_ACQUIRE);
+        n = 0;
+        for ( i = 0; i < pipe->nworkers && n < SR_PIPE_TX_IOV; i++ )
+        {
+            struct sr_pipe_worker* w = &pipe->workers[(next + i) % pipe->nworkers];
+            n += sr_ring_dequeue_burst(w->tx, (void**)bufs + n, SR_PIPE_TX_IOV - n);
+        }
+        next++;
+        if ( n < SR_PIPE_TX_IOV )
+        { n += sr_mpsc_dequeue_burst(pipe->other_tx, (void**)bufs + n, SR_PIPE_TX_IOV - n); }
+
+        if ( n == 0 )
+        {
+            if ( stopping )
+            { break; }
+            sr_pipe_idle(&spins);
+            continue;
+        }
+        spins = 0;
+
+        for ( i = 0; i < n; i++ )
+        {
+            c_packet_header* hdr = (c_packet_header*)(bufs[i] + SR_PIPE_HDR_OFF);
+            iov[i].iov_base = hdr;
+            iov[i].iov_len = ntohl(hdr->mLen);
+        }
+        sr_vns_writev(pipe->sr, iov, n);
+        for ( i = 0; i < n; i++ )
+        { sr_pool_put(bufs[i]); }
+    }
+    return 0;
+} /* -- sr_pipe_tx_main -- */
+
+int sr_pipeline_start(struct sr_instance* sr, unsigned int n)
+{
+    struct sr_pipeline* pipe;
+    unsigned int i;
+
+    if ( n == 0 )
+    { return 0; }
+    if ( n > SR_PIPE_MAX_WORKERS )
+    { n = SR_PIPE_MAX_WORKERS; }
+
+    if ( posix_memalign((void**)&pipe, SR_CACHE_LINE, sizeof(struct sr_pipeline)) != 0 )
+    { return -1; }
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->sr = sr;
+    pipe->nworkers = n;
+    if ( (pipe->other_tx = sr_mpsc_ring_create(SR_PIPE_RING_SZ)) == 0 )
+    { goto fail; }
+    for ( i = 0; i < n; i++ )
+    {
+        pipe->workers[i].pipe = pipe;
+        pipe->workers[i].id = i;
+        if ( (pipe->workers[i].rx = sr_ring_create(SR_PIPE_RING_SZ)) == 0 ||
+             (pipe->workers[i].tx = sr_ring_create(SR_PIPE_RING_SZ)) == 0 )
+        { goto fail; }
+    }
+
+    /* -- sends from here on go through the rings -- */
+    sr->pipeline = pipe;
+    sr_send_flush(sr);
+    pthread_create(&pipe->tx_thread, &(sr->attr), sr_pipe_tx_main, pipe);
+    for ( i = 0; i < n; i++ )
+    { pthread_create(&pipe->workers[i].thread, &(sr->attr), sr_pipe_worker_main, &pipe->workers[i]); }
+
+    printf("Forwarding with %u worker threads\n", n);
+    return 0;
+
+fail:
+    fprintf(stderr, "Error: out of memory (sr_pipeline_start)\n");
+    for ( i = 0; i < n; i++ )
+    {
+        sr_ring_destroy(pipe->workers[i].rx);
+        sr_ring_destroy(pipe->workers[i].tx);
+    }
+    sr_mpsc_ring_destroy(pipe->other_tx);
+    free(pipe);
+    return -1;
+} /* -- sr_pipeline_start -- */
+
+void sr_pipeline_stop(struct sr_instance* sr)
+{
+    struct sr_pipeline* pipe = sr->pipeline;
+    unsigned int i;
+
+    if ( !pipe )
+    { return; }
+
+    sr_pipeline_rx_flush(sr);
+    __atomic_store_n(&pipe->stop_workers, 1, __ATOMIC_RELEASE);
+    for ( i = 0; i < pipe->nworkers; i++ )
+    { pthread_join(pipe->workers[i].thread, 0); }
+    __atomic_store_n(&pipe->stop_tx, 1, __ATOMIC_RELEASE);
+    pthread_join(pipe->tx_thread, 0);
+
+    for ( i = 0; i < pipe->nworkers; i++ )
+    {
+        fprintf(stderr, "Worker %u: %llu frames\n", i,
+                (unsigned long long)pipe->workers[i].frames);
+    }
+    fprintf(stderr, "Pipeline drops: %llu received, %llu sent\n",
+            (unsigned long long)pipe->rx_drops,
+            (unsigned long long)pipe->tx_drops);
+    /* -- the rings stay: the ARP thread may still be sending -- */
+} /* -- sr_pipeline_stop -- */
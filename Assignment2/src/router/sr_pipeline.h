@@ -0,0 +1,62 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pipeline.h
+ * Description:
+ *
+ * Multi-threaded forwarding (-w N). The thread reading the VNS socket
+ * copies each received frame into a pool buffer and hands it, over a
+ * single-producer ring, to one of N worker threads picked by a hash of
+ * the IPv4 source, destination and protocol, so the packets of a flow
+ * are always handled by the same worker and stay in order. Workers run
+ * sr_handlepacket_burst and pass the frames they send to one TX thread,
+ * which writes them to the socket with writev. Threads that are not
+ * workers (the ARP timer thread) send through a multi-producer ring.
+ *
+ *   reader --spsc--> worker[i] --spsc--> TX --writev--> socket
+ *   ARP thread -----------------mpsc---> TX
+ *
+ * Without -w (sr->pipeline == NULL) the reader handles packets itself.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_PIPELINE_H
+#define sr_PIPELINE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <sys/uio.h>
+
+#include "vnscommand.h"
+
+#define SR_PIPE_MAX_WORKERS 16
+#define SR_PIPE_RING_SZ     256   /* frames queued per ring */
+
+struct sr_instance;
+struct sr_pipeline;
+
+/* Start n workers and the TX thread. Call after sr_init. */
+int  sr_pipeline_start(struct sr_instance* sr, unsigned int n);
+/* Drain the rings, stop the threads and print per-worker counts. */
+void sr_pipeline_stop(struct sr_instance* sr);
+
+/* -- reader side -- */
+void sr_pipeline_rx(struct sr_instance* sr, const uint8_t* frame,
+                    unsigned int len, int iface);
+void sr_pipeline_rx_flush(struct sr_instance* sr);
+
+/* -- send side: called by sr_send_packet{,_inplace} after their checks -- */
+int  sr_pipeline_send(struct sr_instance* sr, uint8_t* frame,
+                      unsigned int len, int iface, int inplace);
+
+/* -- sr_vns_comm.c: write all of iov, which may be modified -- */
+int  sr_vns_writev(struct sr_instance* sr, struct iovec* iov, int n);
+/* -- and the header VNS wants in front of a frame sent out of iface -- */
+void sr_fill_packet_header(c_packet_header* hdr, unsigned int total_len,
+                           const char* iface);
+
+#endif  /* --  sr_PIPELINE_H -- */
@@ -0,0 +1,142 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.c
+ *
+ * Description:
+ *
+ * Packet buffer pool, see sr_pool.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sr_pool.h"
+
+struct sr_pool
+{
+    uint8_t*        arena;
+    uint8_t**       free_bufs;  /* shared free list, a stack */
+    uint32_t        nfree;
+    pthread_mutex_t lock;
+    struct sr_pool_stats stats;
+};
+
+struct sr_pool_cache
+{
+    uint32_t n;
+    uint8_t* bufs[SR_POOL_CACHE];
+};
+
+static struct sr_pool pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static __thread struct sr_pool_cache cache;
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_create(..)
+ * Scope: Local
+ *
+ * Allocate the arena. Runs once, on the first sr_pool_get.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pool_create(void)
+{
+    uint32_t i;
+
+    pthread_mutex_init(&pool.lock, 0);
+    pool.stats.nbufs = 0;
+    if (posix_memalign((void**)&pool.arena, 64,
+                       (size_t)SR_POOL_NBUFS * SR_POOL_BUF_SZ) != 0 ||
+        (pool.free_bufs = malloc(SR_POOL_NBUFS * sizeof(uint8_t*))) == 0)
+    {
+        fprintf(stderr, "sr_pool: out of memory for %u buffers\n", SR_POOL_NBUFS);
+        return;
+    }
+
+    /* -- hand out low addresses first -- */
+    for (i = 0; i < SR_POOL_NBUFS; i++)
+    { pool.free_bufs[i] = pool.arena + (size_t)(SR_POOL_NBUFS - 1 - i) * SR_POOL_BUF_SZ; }
+    pool.nfree = SR_POOL_NBUFS;
+    pool.stats.nbufs = SR_POOL_NBUFS;
+} /* -- sr_pool_create -- */
+
+/* Move up to half a cache from the shared free list to this thread. */
+static void sr_pool_refill(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.stats.refills++;
+    while (pool.nfree > 0 && cache.n < SR_POOL_CACHE / 2)
+    { cache.bufs[cache.n++] = pool.free_bufs[--pool.nfree]; }
+    if (cache.n == 0)
+    { pool.stats.exhausted++; }
+    pool.stats.out = pool.stats.nbufs - pool.nfree;
+    if (pool.stats.out > pool.stats.high_water)
+    { pool.stats.high_water = pool.stats.out; }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Give half of this thread's cache back to the shared free list. */
+static void sr_pool_spill(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    while (cache.n > SR_POOL_CACHE / 2)
+    { pool.free_bufs[pool.nfree++] = cache.bufs[--cache.n]; }
+    pool.stats.out = pool.stats.nbufs - pool.nfree;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+uint8_t* sr_pool_get(void)
+{
+    if (cache.n == 0)
+    {
+        pthread_once(&pool_once, sr_pool_create);
+        sr_pool_refill();
+        if (cache.n == 0)
+        { return 0; }
+    }
+    return cache.bufs[--cache.n];
+} /* -- sr_pool_get -- */
+
+void sr_pool_put(uint8_t* buf)
+{
+    if (!buf)
+    { return; }
+    assert(sr_pool_base(buf) == buf);
+
+    if (cache.n == SR_POOL_CACHE)
+    { sr_pool_spill(); }
+    cache.bufs[cache.n++] = buf;
+} /* -- sr_pool_put -- */
+
+uint8_t* sr_pool_base(const void* p)
+{
+    const uint8_t* b = p;
+    size_t off;
+
+    if (!pool.arena || b < pool.arena ||
+        b >= pool.arena + (size_t)SR_POOL_NBUFS * SR_POOL_BUF_SZ)
+    { return 0; }
+    off = (size_t)(b - pool.arena);
+    return pool.arena + off - off % SR_POOL_BUF_SZ;
+} /* -- sr_pool_base -- */
+
+void sr_pool_get_stats(struct sr_pool_stats* stats)
+{
+    pthread_once(&pool_once, sr_pool_create);
+    pthread_mutex_lock(&pool.lock);
+    *stats = pool.stats;
+    pthread_mutex_unlock(&pool.lock);
+} /* -- sr_pool_get_stats -- */
+
+void sr_pool_print_stats(FILE* fp)
+{
+    struct sr_pool_stats s;
+
+    sr_pool_get_stats(&s);
+    fprintf(fp, "Packet pool: %u of %u buffers out (high water %u), "
+            "%llu refills, %llu allocation failures\n",
+            s.out, s.nbufs, s.high_water,
+            (unsigned long long)s.refills, (unsigned long long)s.exhausted);
+} /* -- sr_pool_print_stats -- */
@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.h
+ * Description:
+ *
+ * Fixed-size packet buffer pool. All buffers come from one arena that is
+ * allocated the first time a buffer is asked for, so memory on the packet
+ * path is bounded by SR_POOL_NBUFS * SR_POOL_BUF_SZ and sustained load
+ * causes no malloc/free traffic.
+ *
+ * Each thread keeps a small cache of free buffers and only goes to the
+ * shared free list, under its lock, to move half a cache at a time.
+ * Buffers may be freed by a different thread than the one that got them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_POOL_H
+#define sr_POOL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_POOL_BUF_SZ 2048   /* VNS header + largest Ethernet frame, rounded up */
+#define SR_POOL_NBUFS  4096
+#define SR_POOL_CACHE  64     /* free buffers a thread may hold on to */
+
+struct sr_pool_stats
+{
+    uint32_t nbufs;        /* buffers in the arena */
+    uint32_t out;          /* buffers taken from the shared free list */
+    uint32_t high_water;   /* largest out ever seen */
+    uint64_t refills;      /* trips to the shared free list */
+    uint64_t exhausted;    /* sr_pool_get calls that found no buffer */
+};
+
+/* A buffer of SR_POOL_BUF_SZ bytes, or NULL if the pool is exhausted. */
+uint8_t* sr_pool_get(void);
+void     sr_pool_put(uint8_t* buf);
+
+/* Start of the buffer containing p, or NULL if p is not in the arena. */
+uint8_t* sr_pool_base(const void* p);
+
+void     sr_pool_get_stats(struct sr_pool_stats* stats);
+void     sr_pool_print_stats(FILE* fp);
+
+#endif  /* --  sr_POOL_H -- */
@@ -0,0 +1,134 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ratelimit.c
+ *
+ * Description:
+ *
+ * ICMP error token buckets, see sr_ratelimit.h.
+ *
+ * A bucket with 'burst' tokens that gains one every 'interval' is full
+ * at time full_at. It is empty once full_at is more than
+ * (burst - 1) * interval ('slack') in the future, and taking a token
+ * moves full_at one interval further, starting from now if the bucket
+ * was full already.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_ratelimit.h"
+
+#define SRC_SLOTS (1u << SR_RATELIMIT_SRC_BITS)
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void sr_ratelimit_default_opts(struct sr_ratelimit_opts* opts)
+{
+    opts->rate = SR_RATELIMIT_RATE;
+    opts->burst = SR_RATELIMIT_BURST;
+    opts->src_rate = SR_RATELIMIT_SRC_RATE;
+    opts->src_burst = SR_RATELIMIT_SRC_BURST;
+} /* -- sr_ratelimit_default_opts -- */
+
+int sr_ratelimit_parse_opts(struct sr_ratelimit_opts* opts, const char* spec)
+{
+    char *copy = strdup(spec), *save = 0, *item;
+    int ret = 0;
+
+    for (item = strtok_r(copy, ",", &save); item; item = strtok_r(0, ",", &save))
+    {
+        if (strncmp(item, "rate=", 5) == 0)
+        { opts->rate = strtoul(item + 5, 0, 10); }
+        else if (strncmp(item, "burst=", 6) == 0)
+        { opts->burst = strtoul(item + 6, 0, 10); }
+        else if (strncmp(item, "src=", 4) == 0)
+        { opts->src_rate = strtoul(item + 4, 0, 10); }
+        else if (strncmp(item, "srcburst=", 9) == 0)
+        { opts->src_burst = strtoul(item + 9, 0, 10); }
+        else
+        {
+            fprintf(stderr, "sr_ratelimit: unknown option %s\n", item);
+            ret = -1;
+        }
+    }
+    free(copy);
+    return ret;
+} /* -- sr_ratelimit_parse_opts -- */
+
+int sr_ratelimit_init(struct sr_ratelimit* rl, const struct sr_ratelimit_opts* opts)
+{
+    memset(rl, 0, sizeof(*rl));
+    if (opts->rate)
+    {
+        rl->interval = 1000000000ull / opts->rate;
+        rl->slack = (opts->burst ? opts->burst - 1 : 0) * rl->interval;
+    }
+    if (opts->src_rate)
+    {
+        rl->src_interval = 1000000000ull / opts->src_rate;
+        rl->src_slack = (opts->src_burst ? opts->src_burst - 1 : 0) * rl->src_interval;
+        if ((rl->src_full_at = calloc(SRC_SLOTS, sizeof(uint64_t))) == 0)
+        {
+            fprintf(stderr, "sr_ratelimit: out of memory\n");
+            return -1;
+        }
+    }
+    return 0;
+} /* -- sr_ratelimit_init -- */
+
+void sr_ratelimit_destroy(struct sr_ratelimit* rl)
+{
+    free(rl->src_full_at);
+    memset(rl, 0, sizeof(*rl));
+} /* -- sr_ratelimit_destroy -- */
+
+static int bucket_take(uint64_t* full_at, uint64_t now, uint64_t interval,
+                       uint64_t slack)
+{
+    uint64_t old = __atomic_load_n(full_at, __ATOMIC_RELAXED), t;
+
+    do
+    {
+        t = old > now ? old : now;
+        if (t - now > slack)
+        { return 0; }
+    } while (!__atomic_compare_exchange_n(full_at, &old, t + interval, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+} /* -- bucket_take -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ratelimit_take(..)
+ * Scope: Global
+ *
+ * The source's bucket is tried first, so a single busy source runs dry
+ * on its own bucket without draining the global one.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ratelimit_take(struct sr_ratelimit* rl, uint32_t src)
+{
+    uint64_t now;
+
+    if (!rl->interval && !rl->src_full_at)
+    { return SR_RATELIMIT_OK; }
+    now = now_ns();
+    if (rl->src_full_at)
+    {
+        uint32_t slot = (src * 0x9e3779b1u) >> (32 - SR_RATELIMIT_SRC_BITS);
+
+        if (!bucket_take(&rl->src_full_at[slot], now, rl->src_interval, rl->src_slack))
+        { return SR_RATELIMIT_SRC; }
+    }
+    if (rl->interval && !bucket_take(&rl->full_at, now, rl->interval, rl->slack))
+    { return SR_RATELIMIT_GLOBAL; }
+    return SR_RATELIMIT_OK;
+} /* -- sr_ratelimit_take -- */
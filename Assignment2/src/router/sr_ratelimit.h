@@ -0,0 +1,73 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ratelimit.h
+ * Description:
+ *
+ * Token buckets limiting how many ICMP errors the router generates: one
+ * for each source address the errors go back to and one for all of them
+ * together, so a scan or a traceroute storm costs a bounded amount of
+ * work however many bad packets it sends.
+ *
+ * A bucket holds up to 'burst' tokens and gains 'rate' a second; an
+ * error takes one token from its source's bucket and one from the
+ * global one, and is suppressed if either is empty. A bucket is kept as
+ * the time at which it will be full again, one word that threads update
+ * with compare-and-swap, so checking costs no lock. Sources share a
+ * fixed table of buckets by hash: two sources that collide share a
+ * limit, and no source can make the table grow.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_RATELIMIT_H
+#define sr_RATELIMIT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_RATELIMIT_SRC_BITS 12    /* 4096 source buckets */
+
+/* Defaults, a rate of 0 means no limit */
+#define SR_RATELIMIT_RATE      1000
+#define SR_RATELIMIT_BURST     50
+#define SR_RATELIMIT_SRC_RATE  20
+#define SR_RATELIMIT_SRC_BURST 10
+
+#define SR_RATELIMIT_OK     0
+#define SR_RATELIMIT_SRC    1   /* the source's bucket was empty */
+#define SR_RATELIMIT_GLOBAL 2   /* the global one was */
+
+struct sr_ratelimit_opts
+{
+    uint32_t rate;         /* errors a second, all sources together */
+    uint32_t burst;
+    uint32_t src_rate;     /* errors a second to one source */
+    uint32_t src_burst;
+};
+
+struct sr_ratelimit
+{
+    uint64_t  full_at __attribute__((aligned(64)));  /* global bucket, ns */
+    uint64_t  interval;        /* ns per token, 0: no global limit */
+    uint64_t  slack;           /* ns a full bucket is ahead of now */
+    uint64_t  src_interval;    /* the same for the source buckets */
+    uint64_t  src_slack;
+    uint64_t* src_full_at;     /* NULL: no source limit */
+};
+
+void sr_ratelimit_default_opts(struct sr_ratelimit_opts* opts);
+/* "rate=N,burst=N,src=N,srcburst=N", any of them */
+int  sr_ratelimit_parse_opts(struct sr_ratelimit_opts* opts, const char* spec);
+
+int  sr_ratelimit_init(struct sr_ratelimit* rl, const struct sr_ratelimit_opts* opts);
+void sr_ratelimit_destroy(struct sr_ratelimit* rl);
+
+/* Take a token for an error to src (network byte order). Returns
+   SR_RATELIMIT_OK if it may be sent. A zeroed sr_ratelimit allows
+   everything. */
+int  sr_ratelimit_take(struct sr_ratelimit* rl, uint32_t src);
+
+#endif  /* --  sr_RATELIMIT_H -- */
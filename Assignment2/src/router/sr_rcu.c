@@ -0,0 +1,73 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.c
+ *
+ * Description:
+ *
+ * Grace periods for sr_rcu.h. Reader records are allocated the first
+ * time a thread reads and live as long as the process, like the flow
+ * caches, so sr_rcu_synchronize can walk them without locking against
+ * thread exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sr_rcu.h"
+
+uint64_t sr_rcu_epoch = 1;
+__thread struct sr_rcu_reader* sr_rcu_self;
+
+static struct sr_rcu_reader* all_readers;
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct sr_rcu_reader* sr_rcu_register(void)
+{
+    struct sr_rcu_reader* r;
+
+    /* -- a thread that can't get a record has to stop here -- */
+    if (posix_memalign((void**)&r, 64, sizeof(*r)) != 0)
+    {
+        fprintf(stderr, "sr_rcu_register: out of memory\n");
+        abort();
+    }
+    r->epoch = 0;
+    pthread_mutex_lock(&all_lock);
+    r->next = all_readers;
+    __atomic_store_n(&all_readers, r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&all_lock);
+    sr_rcu_self = r;
+    return r;
+} /* -- sr_rcu_register -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_synchronize(void)
+ * Scope: Global
+ *
+ * Open a new epoch and wait until no reader is in a section that began
+ * in an earlier one. Readers that register meanwhile start in the new
+ * epoch or later, so they need no waiting for.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_synchronize(void)
+{
+    struct sr_rcu_reader* r;
+    uint64_t target;
+    struct timespec nap = { 0, 50000 };
+
+    target = __atomic_add_fetch(&sr_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    /* -- pairs with the fence in sr_rcu_read_lock -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (r = __atomic_load_n(&all_readers, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        uint64_t e;
+
+        while ((e = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE)) != 0 &&
+               e < target)
+        { nanosleep(&nap, 0); }
+    }
+} /* -- sr_rcu_synchronize -- */
@@ -0,0 +1,65 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.h
+ * Description:
+ *
+ * Read-copy-update for data the forwarding threads read and the control
+ * plane replaces, such as the FIB. An updater builds a new version off to
+ * the side, publishes it with one atomic pointer store and then waits in
+ * sr_rcu_synchronize() until no reader can still hold the old one, after
+ * which it is free to reclaim it. Readers never block and never write
+ * shared cache lines: a read-side section is two stores to the calling
+ * thread's own record and a fence.
+ *
+ * Every reading thread gets a record the first time it enters a section.
+ * The record holds 0 outside a section and, inside, the grace period
+ * epoch the section started in; sr_rcu_synchronize() opens a new epoch
+ * and waits until every record is 0 or at least that new epoch. Sections
+ * must not nest and should be short: a thread that blocks inside one
+ * holds up every updater.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_RCU_H
+#define sr_RCU_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_rcu_reader
+{
+    uint64_t              epoch;   /* 0 outside a read-side section */
+    struct sr_rcu_reader* next;    /* all readers, for sr_rcu_synchronize */
+    char pad[64 - sizeof(uint64_t) - sizeof(void*)];
+};
+
+extern uint64_t sr_rcu_epoch;
+extern __thread struct sr_rcu_reader* sr_rcu_self;
+
+struct sr_rcu_reader* sr_rcu_register(void);
+
+static inline void sr_rcu_read_lock(void)
+{
+    struct sr_rcu_reader* r = sr_rcu_self ? sr_rcu_self : sr_rcu_register();
+
+    __atomic_store_n(&r->epoch, __atomic_load_n(&sr_rcu_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    /* -- the epoch must be visible before anything published is read -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void sr_rcu_read_unlock(void)
+{
+    __atomic_store_n(&sr_rcu_self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Wait for every read-side section that started before the call. Pointers
+   unpublished before it can no longer be held by any reader afterwards.
+   Updaters may call it concurrently. */
+void sr_rcu_synchronize(void);
+
+#endif  /* --  sr_RCU_H -- */
@@ -0,0 +1,180 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Lock-free rings for the forwarding pipeline, see sr_ring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_ring.h"
+
+static uint32_t ring_size(uint32_t size)
+{
+    uint32_t n = 2;
+    while (n < size)
+    { n <<= 1; }
+    return n;
+}
+
+struct sr_ring* sr_ring_create(uint32_t size)
+{
+    struct sr_ring* ring;
+
+    if (posix_memalign((void**)&ring, SR_CACHE_LINE, sizeof(struct sr_ring)) != 0)
+    { return 0; }
+    memset(ring, 0, sizeof(*ring));
+    size = ring_size(size);
+    if ((ring->slots = calloc(size, sizeof(void*))) == 0)
+    {
+        free(ring);
+        return 0;
+    }
+    ring->mask = size - 1;
+    return ring;
+} /* -- sr_ring_create -- */
+
+void sr_ring_destroy(struct sr_ring* ring)
+{
+    if (!ring)
+    { return; }
+    free(ring->slots);
+    free(ring);
+} /* -- sr_ring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_enqueue_burst(..)
+ * Scope: Global
+ *
+ * The slots are written first and published with one release store of
+ * tail; head is only re-read when the cached copy says the ring is full.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_ring_enqueue_burst(struct sr_ring* ring, void* const* objs,
+                                   unsigned int n)
+{
+    uint32_t tail = ring->tail;
+    uint32_t space = ring->mask + 1 - (tail - ring->head_cache);
+    unsigned int i;
+
+    if (space < n)
+    {
+        ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        space = ring->mask + 1 - (tail - ring->head_cache);
+        if (n > space)
+        { n = space; }
+    }
+    for (i = 0; i < n; i++)
+    { ring->slots[(tail + i) & ring->mask] = objs[i]; }
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+} /* -- sr_ring_enqueue_burst -- */
+
+unsigned int sr_ring_dequeue_burst(struct sr_ring* ring, void** objs,
+                                   unsigned int n)
+{
+    uint32_t head = ring->head;
+    uint32_t avail = ring->tail_cache - head;
+    unsigned int i;
+
+    if (avail < n)
+    {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        avail = ring->tail_cache - head;
+        if (n > avail)
+        { n = avail; }
+    }
+    for (i = 0; i < n; i++)
+    { objs[i] = ring->slots[(head + i) & ring->mask]; }
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+} /* -- sr_ring_dequeue_burst -- */
+
+struct sr_mpsc_ring* sr_mpsc_ring_create(uint32_t size)
+{
+    struct sr_mpsc_ring* ring;
+    uint32_t i;
+
+    if (posix_memalign((void**)&ring, SR_CACHE_LINE, sizeof(struct sr_mpsc_ring)) != 0)
+    { return 0; }
+    memset(ring, 0, sizeof(*ring));
+    size = ring_size(size);
+    if ((ring->slots = calloc(size, sizeof(struct sr_mpsc_slot))) == 0)
+    {
+        free(ring);
+        return 0;
+    }
+    /* -- slot i is free for the producer that claims position i -- */
+    for (i = 0; i < size; i++)
+    { ring->slots[i].seq = i; }
+    ring->mask = size - 1;
+    return ring;
+} /* -- sr_mpsc_ring_create -- */
+
+void sr_mpsc_ring_destroy(struct sr_mpsc_ring* ring)
+{
+    if (!ring)
+    { return; }
+    free(ring->slots);
+    free(ring);
+} /* -- sr_mpsc_ring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_mpsc_enqueue(..)
+ * Scope: Global
+ *
+ * A slot is free for position pos when its seq equals pos, and holds a
+ * published object when seq is pos + 1. The consumer frees it again by
+ * setting seq to pos + size.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_mpsc_enqueue(struct sr_mpsc_ring* ring, void* obj)
+{
+    uint32_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct sr_mpsc_slot* slot;
+
+    while (1)
+    {
+        int32_t diff;
+
+        slot = &ring->slots[pos & ring->mask];
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if (diff < 0)
+        { return -1; }  /* full */
+        else
+        { pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED); }
+    }
+
+    slot->obj = obj;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+} /* -- sr_mpsc_enqueue -- */
+
+unsigned int sr_mpsc_dequeue_burst(struct sr_mpsc_ring* ring, void** objs,
+                                   unsigned int n)
+{
+    uint32_t head = ring->head;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_mpsc_slot* slot = &ring->slots[(head + i) & ring->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + i + 1)
+        { break; }
+        objs[i] = slot->obj;
+        __atomic_store_n(&slot->seq, head + i + ring->mask + 1, __ATOMIC_RELEASE);
+    }
+    ring->head = head + i;
+    return i;
+} /* -- sr_mpsc_dequeue_burst -- */
@@ -0,0 +1,84 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ * Description:
+ *
+ * Bounded lock-free rings of pointers, used to hand packet buffers between
+ * the stages of the forwarding pipeline (sr_pipeline.c).
+ *
+ *  - struct sr_ring:      one producer thread, one consumer thread. The
+ *                         producer only writes tail and the consumer only
+ *                         writes head, each on its own cache line, and
+ *                         each side keeps a cached copy of the other's
+ *                         index so it rarely has to read the shared line.
+ *  - struct sr_mpsc_ring: any number of producers, one consumer. Producers
+ *                         claim a slot with a compare-and-swap on tail;
+ *                         every slot carries a sequence number that says
+ *                         whether it is free or published (Vyukov's
+ *                         bounded queue).
+ *
+ * Sizes are rounded up to a power of two.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_RING_H
+#define sr_RING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_CACHE_LINE 64
+
+struct sr_ring
+{
+    void**   slots;
+    uint32_t mask;
+
+    /* -- consumer side -- */
+    uint32_t head __attribute__ ((aligned (SR_CACHE_LINE)));
+    uint32_t tail_cache;
+
+    /* -- producer side -- */
+    uint32_t tail __attribute__ ((aligned (SR_CACHE_LINE)));
+    uint32_t head_cache;
+} __attribute__ ((aligned (SR_CACHE_LINE)));
+
+struct sr_mpsc_slot
+{
+    uint32_t seq;
+    void*    obj;
+};
+
+struct sr_mpsc_ring
+{
+    struct sr_mpsc_slot* slots;
+    uint32_t mask;
+
+    uint32_t head __attribute__ ((aligned (SR_CACHE_LINE)));  /* consumer */
+    uint32_t tail __attribute__ ((aligned (SR_CACHE_LINE)));  /* producers */
+} __attribute__ ((aligned (SR_CACHE_LINE)));
+
+struct sr_ring* sr_ring_create(uint32_t size);
+void            sr_ring_destroy(struct sr_ring* ring);
+
+/* Add up to n objects; returns how many fit. Producer thread only. */
+unsigned int    sr_ring_enqueue_burst(struct sr_ring* ring, void* const* objs,
+                                      unsigned int n);
+/* Take up to n objects; returns how many there were. Consumer thread only. */
+unsigned int    sr_ring_dequeue_burst(struct sr_ring* ring, void** objs,
+                                      unsigned int n);
+
+struct sr_mpsc_ring* sr_mpsc_ring_create(uint32_t size);
+void                 sr_mpsc_ring_destroy(struct sr_mpsc_ring* ring);
+
+/* Returns 0, or -1 if the ring is full. Any thread. */
+int                  sr_mpsc_enqueue(struct sr_mpsc_ring* ring, void* obj);
+/* Consumer thread only. */
+unsigned int         sr_mpsc_dequeue_burst(struct sr_mpsc_ring* ring,
+                                           void** objs, unsigned int n);
+
+#endif  /* --  sr_RING_H -- */
@@ -17,32 +17,45 @@
 
 #include "sr_if.h"
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_adj.h"
+#include "sr_flow.h"
+#include "sr_rcu.h"
+#include "sr_stats.h"
 #include "sr_router.h"
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_log.h"
 
 struct forward_item
 {
   uint32_t next_hop;
-  char *interface;
+  int iface;        // outgoing interface id
 };
 
 
-static int sr_handle_ip_packet(struct sr_instance* sr,
+static int sr_ip_input(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */,
-        struct sr_arpentry **entry,
-        char *if_name);
+        int iface);
+
+static struct sr_adj *sr_route_adjacency(struct sr_instance* sr,
+        struct sr_rt *rt,
+        uint32_t next_hop);
+
+static void sr_ip_output(struct sr_instance* sr,
+        uint8_t * frame/* lent */,
+        unsigned int len,
+        int in_iface,
+        struct forward_item *fi,
+        struct sr_arpentry *entry);
 
 static void sr_handle_arp_packet(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */);
-
+        int iface);
 
-static struct forward_item longest_prefix_match(struct sr_instance* sr, uint32_t ip);
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
  * Scope:  Global
@@ -57,7 +70,12 @@ void sr_init(struct sr_instance* sr)
     assert(sr);
 
     /* Initialize cache and cache cleanup thread */
-    sr_arpcache_init(&(sr->cache));
+    if (sr_arpcache_init(&(sr->cache), sr->arp_capacity, &(sr->arpq_limits)) != 0)
+    {
+        fprintf(stderr, "Can't set up the ARP cache\n");
+        exit(1);
+    }
+    sr->cache.sr = sr;
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
@@ -85,6 +103,15 @@ void sr_init(struct sr_instance* sr)
  * packet instead if you intend to keep it around beyond the scope of
  * the method call.
  *
+ * The frame is lent for modification and has SR_PACKET_HEADROOM bytes
+ * in front of it: forwarded frames, ARP replies and echo replies are
+ * rewritten in place and sent straight from the receive buffer with
+ * sr_send_packet_inplace, so nothing is copied or allocated. They go out
+ * when the reader flushes at the end of its batch.
+ *
+ * The interface is looked up by name once, and the frame is handled as
+ * a burst of one.
+ *
  *---------------------------------------------------------------------*/
 
 void sr_handlepacket(struct sr_instance* sr,
@@ -96,68 +123,224 @@ void sr_handlepacket(struct sr_instance* sr,
   assert(sr);
   assert(packet);
   assert(interface);  
-  printf("*** -> Received packet of length %d \n",len);
-  print_hdrs(packet, len);
-
-  // replicate the packet
-  uint8_t *packet_copy = (uint8_t *)malloc(len);
-  memcpy(packet_copy, packet, len);
-
-  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet_copy;
-  uint16_t ethtype = ntohs(eth_hdr->ether_type);
-  if (ethtype == ethertype_ip) {
-    struct sr_arpentry * entry = NULL;
-    char if_name[sr_IFACE_NAMELEN];
-    memset(if_name, 0, sr_IFACE_NAMELEN);
-    int res = sr_handle_ip_packet(sr, packet_copy+sizeof(sr_ethernet_hdr_t), len-sizeof(sr_ethernet_hdr_t), interface, &entry, if_name);
-    if ( res == 1 && entry) {
-      // send the packet
-      struct sr_if * out_if = sr_get_interface(sr, if_name);
-      memcpy(eth_hdr->ether_dhost, entry->mac, ETHER_ADDR_LEN);
-      memcpy(eth_hdr->ether_shost, out_if->addr, ETHER_ADDR_LEN);
-      sr_send_packet(sr, packet_copy, len, out_if->name);
-      free(entry);
+
+  int iface = sr_interface_id(sr, interface);
+  if (iface < 0) {
+    sr_log(SR_LOG_WARN, "*** Dropping packet from unknown interface %s\n", interface);
+    return;
+  }
+  sr_handlepacket_burst(sr, &packet, &len, &iface, 1);
+
+} /* end sr_handlepacket */
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket_burst(..)
+ * Scope:  Global
+ *
+ * Same processing as sr_handlepacket for n received frames, but the
+ * route lookups of all forwarded frames run together (prefetched and
+ * interleaved, see sr_fib_lookup_burst), and destinations the thread
+ * has forwarded to recently skip them (sr_flow.h). A frame whose next
+ * hop is resolved gets its Ethernet header in one copy from the
+ * adjacency (sr_adj.h); the ARP cache is only consulted for the others,
+ * in one read-side critical section for the whole burst.
+ *
+ * As with sr_handlepacket, the frames are rewritten in place and each
+ * must have SR_PACKET_HEADROOM writable bytes in front of it. ifaces[i]
+ * is the id of the interface packets[i] arrived on. Frames of other
+ * types and frames addressed to the router are handled in arrival order;
+ * forwarded frames keep their relative order.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_handlepacket_burst(struct sr_instance* sr,
+        uint8_t ** packets/* lent */,
+        unsigned int * lens,
+        int * ifaces,
+        unsigned int n)
+{
+  uint32_t dst[SR_BURST_MAX];
+  uint32_t next_hop[SR_BURST_MAX];
+  unsigned int fwd[SR_BURST_MAX];
+  unsigned int miss[SR_BURST_MAX];
+  struct sr_rt *rt[SR_BURST_MAX];
+  struct sr_adj *adj[SR_BURST_MAX];
+  struct forward_item fi[SR_BURST_MAX];
+  struct sr_arpentry entry[SR_BURST_MAX];
+  int ready[SR_BURST_MAX];
+  unsigned int i, k, m, nfwd, nroute, nmiss, nhit;
+  uint32_t gen;
+  struct sr_fib *fib;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(packets);
+
+  while (n > SR_BURST_MAX) {
+    sr_handlepacket_burst(sr, packets, lens, ifaces, SR_BURST_MAX);
+    packets += SR_BURST_MAX;
+    lens += SR_BURST_MAX;
+    ifaces += SR_BURST_MAX;
+    n -= SR_BURST_MAX;
+  }
+
+  // stage 1: validate, answer local traffic, collect destinations
+  nfwd = 0;
+  for (i = 0; i < n; i++) {
+    sr_log(SR_LOG_DEBUG, "*** -> Received packet of length %d \n",lens[i]);
+    sr_log_hdrs(SR_LOG_DEBUG, packets[i], lens[i]);
+    sr_stats_rx(ifaces[i], lens[i]);
+    if (lens[i] < sizeof(sr_ethernet_hdr_t)) {
+      sr_stats_add(SR_STAT_DROP_MALFORMED, 1);
+      continue;
     }
-    else if ( res == 1 && !entry){ // entry not found
-      // queue the packet
-      sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet_copy+sizeof(sr_ethernet_hdr_t));
-      struct sr_arpreq *req = sr_arpcache_queuereq(&(sr->cache), ip_hdr->ip_dst, packet_copy, len, if_name);
-      handle_arpreq(sr, req);
+    uint16_t ethtype = ethertype(packets[i]);
+    uint8_t *payload = packets[i] + sizeof(sr_ethernet_hdr_t);
+    unsigned int plen = lens[i] - sizeof(sr_ethernet_hdr_t);
+    if (ethtype == ethertype_ip) {
+      if (sr_ip_input(sr, payload, plen, ifaces[i])) {
+        dst[nfwd] = ((sr_ip_hdr_t *)payload)->ip_dst;
+        fwd[nfwd++] = i;
+      }
+    } else if (ethtype == ethertype_arp) {
+      sr_handle_arp_packet(sr, payload, plen, ifaces[i]);
+    } else {
+      sr_stats_add(SR_STAT_DROP_MALFORMED, 1);
     }
-  } else if (ethtype == ethertype_arp) {
-    sr_handle_arp_packet(sr, packet_copy+sizeof(sr_ethernet_hdr_t), len-sizeof(sr_ethernet_hdr_t), interface);
-  } 
+  }
+  if (nfwd == 0) {
+    return;
+  }
 
-  free(packet_copy);
-  /* fill in code here */
+  // stage 2: destinations this thread forwarded to recently come out of
+  // the flow cache, the rest are looked up together in the FIB. The routes
+  // can be swapped at any time (sr_rt_update), so everything read from
+  // them is read inside one RCU section; adjacencies outlive every route.
+  sr_rcu_read_lock();
+  gen = __atomic_load_n(&(sr->route_gen), __ATOMIC_ACQUIRE);
+  fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE);
+  nhit = sr_flow_lookup_burst(dst, adj, nfwd, gen);
+  if (nhit < nfwd) {
+    // with no hits at all, as while the cache is bypassed, the misses are
+    // the whole burst and need no gathering
+    nmiss = 0;
+    if (nhit) {
+      for (k = 0; k < nfwd; k++) {
+        if (!adj[k]) {
+          next_hop[nmiss] = dst[k];
+          miss[nmiss++] = k;
+        }
+      }
+    } else {
+      nmiss = nfwd;
+    }
+    if (fib) {
+      sr_fib_lookup_burst(fib, nhit ? next_hop : dst, rt, nmiss);
+    } else {
+      memset(rt, 0, nmiss * sizeof(rt[0]));
+    }
+    for (m = 0; m < nmiss; m++) {
+      k = nhit ? miss[m] : m;
+      // a route whose interface VNS didn't report counts as no route
+      if (!rt[m] || rt[m]->ifid < 0) {
+        fi[k].iface = -1;
+        continue;
+      }
+      // directly connected routes have no gateway, the destination is the next hop
+      fi[k].next_hop = rt[m]->gw.s_addr ? rt[m]->gw.s_addr : dst[k];
+      fi[k].iface = rt[m]->ifid;
+      if ((adj[k] = sr_route_adjacency(sr, rt[m], fi[k].next_hop))) {
+        sr_flow_insert(dst[k], adj[k], gen);
+      }
+    }
+  }
+  sr_rcu_read_unlock();
 
-} /* end sr_handlepacket */
+  nroute = 0;
+  for (k = 0; k < nfwd; k++) {
+    i = fwd[k];
+    if (adj[k]) {
+      fi[k].next_hop = adj[k]->ip;
+      fi[k].iface = adj[k]->iface;
+    } else if (fi[k].iface < 0) {
+      sr_stats_add(SR_STAT_DROP_NO_ROUTE, 1);
+      sr_send_icmp_packet(sr, packets[i] + sizeof(sr_ethernet_hdr_t),
+                          lens[i] - sizeof(sr_ethernet_hdr_t), ifaces[i], 3, 0);
+      continue;
+    }
+    // resolved next hop: a single header copy and the frame is ready to go,
+    // and the neighbour is in use (kept resolved, see sr_arpcache.h)
+    ready[nroute] = adj[k] && sr_adj_rewrite(adj[k], packets[i]);
+    if (ready[nroute]) {
+      sr_adj_touch(adj[k]);
+    }
+    fi[nroute] = fi[k];
+    fwd[nroute++] = i;
+  }
+
+  // stage 3: the frames still without a header go through the ARP cache in
+  // one pass, then everything is sent in order
+  nmiss = 0;
+  for (k = 0; k < nroute; k++) {
+    if (!ready[k]) {
+      next_hop[nmiss++] = fi[k].next_hop;
+    }
+  }
+  if (nmiss) {
+    sr_arpcache_lookup_burst(&(sr->cache), next_hop, entry, nmiss);
+  }
+  nhit = nroute - nmiss;
+  for (k = 0, m = 0; k < nroute; k++) {
+    i = fwd[k];
+    if (ready[k]) {
+      sr_send_packet_inplace(sr, packets[i], lens[i], fi[k].iface);
+    } else {
+      nhit += entry[m].valid;
+      sr_ip_output(sr, packets[i], lens[i], ifaces[i], &fi[k], entry[m].valid ? &entry[m] : NULL);
+      m++;
+    }
+  }
+  if (nroute) {
+    sr_stats_add(SR_STAT_ARP_HIT, nhit);
+    sr_stats_add(SR_STAT_ARP_MISS, nroute - nhit);
+  }
+} /* end sr_handlepacket_burst */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ip_input(..)
+ * Scope:  Local
+ *
+ * Validate an IP packet, decrement its TTL and answer it if it is
+ * addressed to one of our interfaces. Returns 1 if the packet should be
+ * forwarded, 0 if it has been consumed.
+ *
+ *---------------------------------------------------------------------*/
 
-static int sr_handle_ip_packet(struct sr_instance* sr,
+static int sr_ip_input(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */,
-        struct sr_arpentry **entry,
-        char *if_name)
+        int iface)
 { 
   sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)packet;  
   // check the length of the packet and send icmp packet if necessary
-  uint16_t tmp = ip_hdr->ip_sum;
-  ip_hdr->ip_sum = 0;
-  if (len < sizeof(sr_ip_hdr_t) || cksum(packet, sizeof(sr_ip_hdr_t)) != tmp) { 
-    sr_send_icmp_packet(sr, packet, len, interface, 3, 0);
+  if (len < sizeof(sr_ip_hdr_t) || !cksum_ok(packet, sizeof(sr_ip_hdr_t))) { 
+    sr_stats_add(SR_STAT_DROP_CKSUM, 1);
+    sr_send_icmp_packet(sr, packet, len, iface, 3, 0);
     return 0;
   }
-  ip_hdr->ip_sum = tmp;
 
+  // TTL shares a checksummed word with the protocol, patch the checksum
+  // for that word instead of summing the whole header again (RFC 1624)
+  uint16_t old_w, new_w;
+  memcpy(&old_w, &ip_hdr->ip_ttl, sizeof(old_w));
   ip_hdr->ip_ttl--;
   if (ip_hdr->ip_ttl == 0) {
-    sr_send_icmp_packet(sr, packet, len, interface, 11, 0);
+    sr_stats_add(SR_STAT_DROP_TTL, 1);
+    sr_send_icmp_packet(sr, packet, len, iface, 11, 0);
     return 0;
   }
-  // recomputing the checksum
-  ip_hdr->ip_sum = 0;
-  ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+  memcpy(&new_w, &ip_hdr->ip_ttl, sizeof(new_w));
+  ip_hdr->ip_sum = cksum_update16(ip_hdr->ip_sum, old_w, new_w);
 
   // check if it is icmp request and if it is sent to one of the interfaces
   if (ip_hdr->ip_p == ip_protocol_icmp) {
@@ -166,7 +349,7 @@ static int sr_handle_ip_packet(struct sr_instance* sr,
       struct sr_if *if_walker = sr->if_list;
       while (if_walker) {
         if (if_walker->ip == ip_hdr->ip_dst) {
-          sr_send_icmp_packet(sr, packet, len, interface, 0, 0);
+          sr_send_icmp_packet(sr, packet, len, iface, 0, 0);
           return 0;
         }
         if_walker = if_walker->next;
@@ -177,51 +360,108 @@ static int sr_handle_ip_packet(struct sr_instance* sr,
     struct sr_if *if_walker = sr->if_list;
     while (if_walker) {
       if (if_walker->ip == ip_hdr->ip_dst) {
-        sr_send_icmp_packet(sr, packet, len, interface, 3, 3);
+        sr_send_icmp_packet(sr, packet, len, iface, 3, 3);
         return 0;
       }
       if_walker = if_walker->next;
     }
   } else {
+    sr_stats_add(SR_STAT_DROP_MALFORMED, 1);
     return 0;
   }
 
-  struct forward_item fi = longest_prefix_match(sr, ip_hdr->ip_dst);
-  if (fi.next_hop == 0) {
-    sr_send_icmp_packet(sr, packet, len, interface, 3, 0);
-    return 0;
+  return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_route_adjacency(..)
+ * Scope:  Local
+ *
+ * Adjacency a routed frame leaves through. A route with a gateway keeps
+ * its own, bound the first time the route is used; on a directly
+ * connected network every destination that ARP has resolved has one.
+ * Returns NULL if the destination is unresolved or the adjacency table
+ * is full, and the frame then takes the ARP cache path.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_adj *sr_route_adjacency(struct sr_instance* sr,
+        struct sr_rt *rt,
+        uint32_t next_hop)
+{
+  struct sr_adj *adj;
+
+  if (rt->gw.s_addr && (adj = __atomic_load_n(&rt->adj, __ATOMIC_ACQUIRE))) {
+    return adj;
   }
+  adj = sr_arpcache_adjacency(&(sr->cache), next_hop, rt->ifid,
+                              sr_get_interface_by_id(sr, rt->ifid)->addr,
+                              !rt->gw.s_addr);
+  if (adj && rt->gw.s_addr) {
+    __atomic_store_n(&rt->adj, adj, __ATOMIC_RELEASE);
+  }
+  return adj;
+}
 
-  strcpy(if_name, fi.interface);
-  // check the arp cache
+/*---------------------------------------------------------------------
+ * Method: sr_ip_output(..)
+ * Scope:  Local
+ *
+ * Send a routed frame whose adjacency couldn't supply its header: from
+ * the ARP cache entry if there is one, otherwise park it on the ARP
+ * request queue until the next hop is resolved.
+ *
+ *---------------------------------------------------------------------*/
 
-  *entry = sr_arpcache_lookup(&(sr->cache), fi.next_hop);
-  return 1;
+static void sr_ip_output(struct sr_instance* sr,
+        uint8_t * frame/* lent */,
+        unsigned int len,
+        int in_iface,
+        struct forward_item *fi,
+        struct sr_arpentry *entry)
+{
+  sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)frame;
+  if (entry) {
+    // send the packet
+    struct sr_if * out_if = sr_get_interface_by_id(sr, fi->iface);
+    memcpy(eth_hdr->ether_dhost, entry->mac, ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, out_if->addr, ETHER_ADDR_LEN);
+    sr_send_packet_inplace(sr, frame, len, fi->iface);
+  } else {
+    // queue the packet; hold the lock so the retry timer can't free req under us
+    pthread_mutex_lock(&(sr->cache.lock));
+    struct sr_arpreq *req = sr_arpcache_queuereq(&(sr->cache), fi->next_hop, frame, len, fi->iface, in_iface);
+    if (req) {
+      handle_arpreq(sr, req);
+    }
+    pthread_mutex_unlock(&(sr->cache.lock));
+  }
 }
 
 static void sr_handle_arp_packet(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */)
+        int iface)
 { 
   sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)packet;
   sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)(packet - sizeof(sr_ethernet_hdr_t));
+  struct sr_if *in_if = sr_get_interface_by_id(sr, iface);
   
   if (arp_hdr->ar_op == htons(arp_op_request)) {
-    if (arp_hdr->ar_tip == sr_get_interface(sr, interface)->ip) {
+    if (arp_hdr->ar_tip == in_if->ip) {
       eth_hdr->ether_type = htons(ethertype_arp);
       for (int i = 0; i < ETHER_ADDR_LEN; i++) {
         eth_hdr->ether_dhost[i] = arp_hdr->ar_sha[i];
-        eth_hdr->ether_shost[i] = sr_get_interface(sr, interface)->addr[i];
+        eth_hdr->ether_shost[i] = in_if->addr[i];
       }
       arp_hdr->ar_op = htons(arp_op_reply);
       for (int i = 0; i < ETHER_ADDR_LEN; i++) {
         arp_hdr->ar_tha[i] = arp_hdr->ar_sha[i];
-        arp_hdr->ar_sha[i] = sr_get_interface(sr, interface)->addr[i];
+        arp_hdr->ar_sha[i] = in_if->addr[i];
       }
       arp_hdr->ar_tip = arp_hdr->ar_sip;
-      arp_hdr->ar_sip = sr_get_interface(sr, interface)->ip;
-      sr_send_packet(sr, packet-sizeof(sr_ethernet_hdr_t), len+sizeof(sr_ethernet_hdr_t), interface);
+      arp_hdr->ar_sip = in_if->ip;
+      sr_send_packet_inplace(sr, packet-sizeof(sr_ethernet_hdr_t), len+sizeof(sr_ethernet_hdr_t), iface);
     }
   } else if (arp_hdr->ar_op == htons(arp_op_reply)) {
     struct sr_arpreq *req = sr_arpcache_insert(&(sr->cache), arp_hdr->ar_sha, arp_hdr->ar_sip);
@@ -229,11 +469,12 @@ static void sr_handle_arp_packet(struct sr_instance* sr,
       struct sr_packet *pkt_walker = req->packets;
       while (pkt_walker) {
         sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)(pkt_walker->buf);
+        struct sr_if *out_if = sr_get_interface_by_id(sr, pkt_walker->iface);
         for (int i = 0; i < ETHER_ADDR_LEN; i++) {
           eth_hdr->ether_dhost[i] = arp_hdr->ar_sha[i];
-          eth_hdr->ether_shost[i] = sr_get_interface(sr, pkt_walker->iface)->addr[i];
+          eth_hdr->ether_shost[i] = out_if->addr[i];
         }
-        sr_send_packet(sr, pkt_walker->buf, pkt_walker->len, pkt_walker->iface);
+        sr_send_packet_id(sr, pkt_walker->buf, pkt_walker->len, pkt_walker->iface);
         pkt_walker = pkt_walker->next;
       }
       sr_arpreq_destroy(&(sr->cache), req);
@@ -242,51 +483,70 @@ static void sr_handle_arp_packet(struct sr_instance* sr,
   return;
 }
 
+/*---------------------------------------------------------------------
+ * Method: sr_send_icmp_packet(..)
+ * Scope:  Global
+ *
+ * Answer the IP packet at packet (its ethernet header sits right in
+ * front of it) with an ICMP message. An echo request is turned into the
+ * reply in place; error messages are built in a stack buffer and copied
+ * out by sr_send_packet. Neither allocates. Errors are rate limited per
+ * source and overall (sr_ratelimit.h), and the rest are dropped before
+ * anything is built.
+ *
+ *---------------------------------------------------------------------*/
+
 void sr_send_icmp_packet(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */,
+        int iface,
         uint8_t type,
         uint8_t code)
 { 
-  //malloc a new packet with ethernet header, ip header and icmp header
   sr_ethernet_hdr_t *ori_eth_hdr = (sr_ethernet_hdr_t *)(packet- sizeof(sr_ethernet_hdr_t));
   sr_ip_hdr_t *ori_ip_hdr = (sr_ip_hdr_t *)(packet);
-  sr_ethernet_hdr_t *eth_hdr;
   if (type == 0) { // echo reply
-    printf("icmp echo reply\n");
-    int total = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t);
-    eth_hdr = (sr_ethernet_hdr_t *)malloc(total);
-    memset(eth_hdr, 0, total);
-    // modify ethernet header
-    eth_hdr->ether_type = htons(ethertype_ip);
-    memcpy(eth_hdr->ether_shost, ori_eth_hdr->ether_dhost, sizeof(uint8_t) * ETHER_ADDR_LEN);
-    memcpy(eth_hdr->ether_dhost, ori_eth_hdr->ether_shost, sizeof(uint8_t) * ETHER_ADDR_LEN);
-    // modify ip header
-    sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)((void*)eth_hdr + sizeof(sr_ethernet_hdr_t));
-    ip_hdr->ip_v = ori_ip_hdr->ip_v;
-    ip_hdr->ip_hl = ori_ip_hdr->ip_hl;
-    ip_hdr->ip_tos = ori_ip_hdr->ip_tos;
-    ip_hdr->ip_len = ori_ip_hdr->ip_len;
-    ip_hdr->ip_id = ori_ip_hdr->ip_id;
-    ip_hdr->ip_off = ori_ip_hdr->ip_off;
-    ip_hdr->ip_p = ori_ip_hdr->ip_p;
-    ip_hdr->ip_ttl = INIT_TTL;
-    ip_hdr->ip_src = ori_ip_hdr->ip_dst;
-    ip_hdr->ip_dst = ori_ip_hdr->ip_src;
-    ip_hdr->ip_sum = 0;
-    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
-    // modify icmp header
-    sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(ip_hdr + sizeof(sr_ip_hdr_t));
+    sr_log(SR_LOG_DEBUG, "icmp echo reply\n");
+    unsigned int ip_len = ntohs(ori_ip_hdr->ip_len);
+    unsigned int hl = ori_ip_hdr->ip_hl * 4;
+    if (ip_len > len || hl + 8 > ip_len) {
+      sr_stats_add(SR_STAT_DROP_MALFORMED, 1);
+      return;
+    }
+    // turn the request around: swap addresses, keep id, sequence and data
+    uint8_t mac[ETHER_ADDR_LEN];
+    memcpy(mac, ori_eth_hdr->ether_dhost, ETHER_ADDR_LEN);
+    memcpy(ori_eth_hdr->ether_dhost, ori_eth_hdr->ether_shost, ETHER_ADDR_LEN);
+    memcpy(ori_eth_hdr->ether_shost, mac, ETHER_ADDR_LEN);
+    uint32_t src = ori_ip_hdr->ip_src;
+    ori_ip_hdr->ip_src = ori_ip_hdr->ip_dst;
+    ori_ip_hdr->ip_dst = src;
+    ori_ip_hdr->ip_ttl = INIT_TTL;
+    ori_ip_hdr->ip_sum = 0;
+    ori_ip_hdr->ip_sum = cksum(ori_ip_hdr, hl);
+    sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(packet + hl);
     icmp_hdr->icmp_type = type;
     icmp_hdr->icmp_code = code;
     icmp_hdr->icmp_sum = 0;
-    icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_hdr_t));
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, ip_len - hl);
+    if (sr_send_packet_inplace(sr, (uint8_t *)ori_eth_hdr, sizeof(sr_ethernet_hdr_t) + ip_len, iface) == 0) {
+      sr_stats_add(SR_STAT_ICMP_SENT, 1);
+    }
   } else { 
-    eth_hdr = (sr_ethernet_hdr_t *)malloc(sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t));
+    switch (sr_ratelimit_take(&(sr->icmp_limit), ori_ip_hdr->ip_src)) {
+    case SR_RATELIMIT_SRC:
+      sr_stats_add(SR_STAT_ICMP_LIMITED_SRC, 1);
+      return;
+    case SR_RATELIMIT_GLOBAL:
+      sr_stats_add(SR_STAT_ICMP_LIMITED, 1);
+      return;
+    }
+    struct sr_if *out_if = sr_get_interface_by_id(sr, iface);
+    uint8_t buf[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t)];
+    sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)buf;
     // modify ethernet header
     eth_hdr->ether_type = htons(ethertype_ip);
-    memcpy(eth_hdr->ether_shost, sr_get_interface(sr, interface)->addr, sizeof(uint8_t) * ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, out_if->addr, sizeof(uint8_t) * ETHER_ADDR_LEN);
     memcpy(eth_hdr->ether_dhost, ori_eth_hdr->ether_shost, sizeof(uint8_t) * ETHER_ADDR_LEN);
     // fill ip header and icmp header
     sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)((void*)eth_hdr + sizeof(sr_ethernet_hdr_t));
@@ -296,7 +556,7 @@ void sr_send_icmp_packet(struct sr_instance* sr,
     ip_hdr->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t));
     ip_hdr->ip_off = IP_DF;
     ip_hdr->ip_p = ip_protocol_icmp;
-    ip_hdr->ip_src = sr_get_interface(sr, interface)->ip;
+    ip_hdr->ip_src = out_if->ip;
     ip_hdr->ip_dst = ori_ip_hdr->ip_src;
     ip_hdr->ip_sum = 0;
     ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
@@ -304,29 +564,17 @@ void sr_send_icmp_packet(struct sr_instance* sr,
     sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)((void*)ip_hdr + sizeof(sr_ip_hdr_t));
     icmp_hdr->icmp_type = type;
     icmp_hdr->icmp_code = code;
+    icmp_hdr->unused = 0;
+    memcpy(icmp_hdr->data, packet, sizeof(sr_ip_hdr_t) + 8);
     icmp_hdr->icmp_sum = 0;
     icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_hdr_t));
-    memcpy(icmp_hdr->data, packet, sizeof(sr_ip_hdr_t) + 8);
+    if (sr_send_packet_id(sr, (uint8_t *)eth_hdr, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t), iface) == 0) {
+      sr_stats_add(SR_STAT_ICMP_SENT, 1);
+    }
   }
-  sr_send_packet(sr, (uint8_t *)eth_hdr, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t), interface);
-  free(eth_hdr);
   return;
 }
 
-
-static struct forward_item longest_prefix_match(struct sr_instance* sr, uint32_t ip)
-{
-  uint32_t next_hop_ip = 0;
-  struct sr_rt *rt_walker = sr->routing_table;
-  while (rt_walker) {
-    if ((rt_walker->mask.s_addr & ip) == rt_walker->dest.s_addr) {
-      next_hop_ip = rt_walker->gw.s_addr;
-      break;
-    }
-    rt_walker = rt_walker->next;
-  }
-  return (struct forward_item){next_hop_ip, rt_walker->interface};
-}
 /* Add any additional helper methods here & don't forget to also declare
 them in sr_router.h.
 
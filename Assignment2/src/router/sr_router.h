@@ -12,6 +12,8 @@
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_fib.h"
+#include "sr_ratelimit.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -26,10 +28,19 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define SR_BURST_MAX SR_FIB_BURST /* frames per sr_handlepacket_burst pass */
+
+/* Writable bytes in front of every received frame, where the VNS packet
+   header for sending it back out is written (see sr_send_packet_inplace) */
+#define SR_PACKET_HEADROOM 24
+#define SR_VNS_MAX_CMD     10000  /* largest command accepted from VNS */
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_vns_io;
+struct sr_pipeline;
+struct sr_capture;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -47,10 +58,22 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
+    struct sr_if* if_table[SR_IF_MAX]; /* the same, by id */
+    int if_count;
     struct sr_rt* routing_table; /* routing table */
+    struct sr_rt* rt_block; /* entries sr_load_rt allocated in one block */
+    pthread_mutex_t rt_lock; /* serialises routing table updates, see sr_rt.h */
+    struct sr_fib* fib; /* compiled from routing_table */
+    enum sr_fib_engine fib_engine; /* lookup structure to compile */
+    uint32_t route_gen; /* bumped when routes change, see sr_flow.h */
     struct sr_arpcache cache;   /* ARP cache */
+    unsigned int arp_capacity;  /* neighbours the ARP cache can hold */
+    struct sr_arpq_limits arpq_limits; /* on packets waiting for ARP */
+    struct sr_ratelimit icmp_limit; /* ICMP errors we may generate */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* -l packet capture, see sr_dumper.h */
+    struct sr_vns_io* vns; /* socket buffers, see sr_vns_comm.c */
+    struct sr_pipeline* pipeline; /* worker threads (-w), or NULL */
 };
 
 /* -- sr_main.c -- */
@@ -58,20 +81,30 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_id(struct sr_instance* , uint8_t* , unsigned int , int);
+int sr_send_packet_inplace(struct sr_instance* , uint8_t* , unsigned int , int);
+int sr_send_flush(struct sr_instance* );
+int sr_vns_init(struct sr_instance* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_handlepacket_burst(struct sr_instance* , uint8_t ** , unsigned int * , int * , unsigned int );
 
 /* Add additional helper method declarations here! */
-void sr_send_icmp_packet(struct sr_instance* , uint8_t *, unsigned int , char *, uint8_t , uint8_t );
+void sr_send_icmp_packet(struct sr_instance* , uint8_t *, unsigned int , int , uint8_t , uint8_t );
 /* -- sr_if.c -- */
 struct sr_if *sr_get_interface(struct sr_instance*, const char* );
+int sr_interface_id(struct sr_instance*, const char* );
+
+/* interface by id, see sr_if.h */
+static inline struct sr_if *sr_get_interface_by_id(struct sr_instance* sr, int id)
+{ return sr->if_table[id]; }
 struct sr_if *get_interface_from_ip(struct sr_instance*, uint32_t );
 struct sr_if *get_interface_from_eth(struct sr_instance *, uint8_t *);
-void sr_add_interface(struct sr_instance* , const char* );
+int sr_add_interface(struct sr_instance* , const char* );
 void sr_set_ether_ip(struct sr_instance* , uint32_t );
 void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
 void sr_print_if_list(struct sr_instance* );
@@ -8,7 +8,10 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
-
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -16,116 +19,681 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_rcu.h"
 #include "sr_router.h"
 
+#define SR_RT_PRINT_MAX 64  /* routes sr_print_routing_table shows */
+
+static double rt_elapsed_ms(const struct timeval* start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, 0);
+    return (end.tv_sec - start->tv_sec) * 1e3 +
+           (end.tv_usec - start->tv_usec) / 1e3;
+}
+
 /*---------------------------------------------------------------------
- * Method:
+ * Method: rt_parse_ip(..)
+ * Scope: Local
+ *
+ * Convert the len characters at p to an address. Plain dotted quads
+ * are converted here; anything else goes to inet_aton, which accepts
+ * the other forms a routing table line may use. That includes octets
+ * with a leading zero, which inet_aton reads as octal.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static int rt_parse_ip(const char* p, unsigned int len, struct in_addr* addr)
 {
-    FILE* fp;
-    char  line[BUFSIZ];
-    char  dest[32];
-    char  gw[32];
-    char  mask[32];
-    char  iface[32];
-    struct in_addr dest_addr;
-    struct in_addr gw_addr;
-    struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    char buf[32];
+    uint32_t ip = 0, octet = 0;
+    unsigned int i, dots = 0, digits = 0;
 
-    /* -- REQUIRES -- */
-    assert(filename);
-    if( access(filename,R_OK) != 0)
+    for (i = 0; i < len; i++)
     {
-        perror("access");
-        return -1;
+        if (p[i] >= '0' && p[i] <= '9' && digits < 3 && !(digits && octet == 0))
+        {
+            octet = octet * 10 + (p[i] - '0');
+            digits++;
+        }
+        else if (p[i] == '.' && digits && dots < 3 && octet < 256)
+        {
+            ip = ip << 8 | octet;
+            octet = digits = 0;
+            dots++;
+        }
+        else
+        { break; }
+    }
+    if (i == len && dots == 3 && digits && octet < 256)
+    {
+        addr->s_addr = htonl(ip << 8 | octet);
+        return 1;
     }
 
-    fp = fopen(filename,"r");
+    if (len >= sizeof(buf))
+    { return 0; }
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    return inet_aton(buf, addr);
+} /* -- rt_parse_ip -- */
+
+/*---------------------------------------------------------------------
+ * Method: rt_bind_block(..)
+ * Scope: Local
+ *
+ * Link the n routes of a block in order and look up their interfaces.
+ *
+ *---------------------------------------------------------------------*/
 
-    while( fgets(line,BUFSIZ,fp) != 0)
+static void rt_bind_block(struct sr_instance* sr, struct sr_rt* block,
+                          uint32_t n)
+{
+    const char* last = "";
+    int last_id = -1;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
-        if(inet_aton(dest,&dest_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    dest);
-            return -1; 
+        /* -- tables mostly repeat a handful of names -- */
+        if (strcmp(block[i].interface, last) != 0)
+        {
+            last = block[i].interface;
+            last_id = sr_interface_id(sr, last);
+        }
+        block[i].ifid = last_id;
+        block[i].next = (i + 1 < n) ? &block[i + 1] : 0;
+    }
+} /* -- rt_bind_block -- */
+
+/*---------------------------------------------------------------------
+ * Method: rt_load_text(..)
+ * Scope: Local
+ *
+ * Parse a routing table file, one "dest gw mask iface" route per line,
+ * into one block of entries. Blank lines and lines starting with '#'
+ * are skipped. Returns the number of routes, or -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static long rt_load_text(struct sr_instance* sr, const char* text, size_t len,
+                         struct sr_rt** block)
+{
+    const char* p = text;
+    const char* end = text + len;
+    const char* tok[4];
+    unsigned int toklen[4];
+    struct sr_rt* rt;
+    uint32_t n = 0, lines = 1, lineno = 0;
+    size_t i;
+    int t;
+
+    /* -- one route per line at most -- */
+    for (i = 0; i < len; i++)
+    { lines += text[i] == '\n'; }
+    *block = rt = malloc(lines * sizeof(struct sr_rt));
+    if (!rt)
+    {
+        fprintf(stderr, "Error loading routing table, out of memory\n");
+        return -1;
+    }
+
+    while (p < end)
+    {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol)
+        { eol = end; }
+        lineno++;
+
+        /* -- split the line into its first four fields -- */
+        for (t = 0; t < 4; t++)
+        {
+            while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+            { p++; }
+            if (p == eol || (t == 0 && *p == '#'))
+            { break; }
+            tok[t] = p;
+            while (p < eol && *p != ' ' && *p != '\t' && *p != '\r')
+            { p++; }
+            toklen[t] = p - tok[t];
         }
-        if(inet_aton(gw,&gw_addr) == 0)
-        { 
+        p = eol + 1;
+
+        if (t == 0)
+        { continue; }
+        if (t < 4)
+        {
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    gw);
-            return -1; 
+                    "Error loading routing table, line %u is incomplete\n",
+                    lineno);
+            goto fail;
         }
-        if(inet_aton(mask,&mask_addr) == 0)
-        { 
+        if (!rt_parse_ip(tok[0], toklen[0], &rt[n].dest) ||
+            !rt_parse_ip(tok[1], toklen[1], &rt[n].gw) ||
+            !rt_parse_ip(tok[2], toklen[2], &rt[n].mask))
+        {
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    mask);
-            return -1; 
+                    "Error loading routing table, cannot convert line %u "
+                    "to valid IPs\n", lineno);
+            goto fail;
         }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
+        if (toklen[3] >= sr_IFACE_NAMELEN)
+        { toklen[3] = sr_IFACE_NAMELEN - 1; }
+        memcpy(rt[n].interface, tok[3], toklen[3]);
+        rt[n].interface[toklen[3]] = 0;
+        rt[n].adj = 0;
+        n++;
+    }
+
+    rt_bind_block(sr, rt, n);
+    return n;
+
+fail:
+    free(rt);
+    *block = 0;
+    return -1;
+} /* -- rt_load_text -- */
+
+/*---------------------------------------------------------------------
+ * Method: rt_load_image(..)
+ * Scope: Local
+ *
+ * Read the routes of a mapped routing table image into one block and,
+ * if the image holds them and the poptrie engine is selected, wrap its
+ * compiled arrays in *fib, which then owns the mapping. Returns the
+ * number of routes, or -1 if the image is malformed.
+ *
+ *---------------------------------------------------------------------*/
+
+static long rt_load_image(struct sr_instance* sr, void* map, size_t len,
+                          struct sr_rt** block, struct sr_fib** fib)
+{
+    const struct sr_rt_image_hdr* hdr = map;
+    const struct sr_rt_image_route* rec;
+    const char* names;
+    struct sr_rt* rt;
+    uint32_t i;
+
+    *block = 0;
+    *fib = 0;
+
+    /* -- every section must lie inside the file -- */
+#define RT_IMAGE_FITS(off, n, size) \
+    ((off) % SR_RT_IMAGE_ALIGN == 0 && (off) <= len && \
+     (uint64_t)(n) * (size) <= len - (off))
+
+    if (len < sizeof(*hdr) || hdr->bom != SR_RT_IMAGE_BOM ||
+        hdr->len != len ||
+        !RT_IMAGE_FITS(hdr->ifaces_off, hdr->nifaces, sr_IFACE_NAMELEN) ||
+        !RT_IMAGE_FITS(hdr->routes_off, hdr->nroutes,
+                       sizeof(struct sr_rt_image_route)) ||
+        ((hdr->flags & SR_RT_IMAGE_FIB) &&
+         (!RT_IMAGE_FITS(hdr->direct_off, 1 << SR_FIB_DIRECT_BITS,
+                         sizeof(uint32_t)) ||
+          !RT_IMAGE_FITS(hdr->nodes_off, hdr->nnodes,
+                         sizeof(struct sr_fib_node)) ||
+          !RT_IMAGE_FITS(hdr->leaves_off, hdr->nleaves, sizeof(uint32_t)))))
+    {
+        fprintf(stderr, "Error loading routing table, malformed image%s\n",
+                hdr->bom != SR_RT_IMAGE_BOM ? " (other byte order)" : "");
+        return -1;
+    }
+#undef RT_IMAGE_FITS
+
+    names = (const char*)map + hdr->ifaces_off;
+    for (i = 0; i < hdr->nifaces; i++)
+    {
+        if (memchr(names + i * sr_IFACE_NAMELEN, 0, sr_IFACE_NAMELEN) == 0)
+        {
+            fprintf(stderr, "Error loading routing table, malformed image\n");
+            return -1;
+        }
+    }
+
+    rec = (const struct sr_rt_image_route*)((const char*)map + hdr->routes_off);
+    *block = rt = malloc((hdr->nroutes ? hdr->nroutes : 1) * sizeof(struct sr_rt));
+    if (!rt)
+    {
+        fprintf(stderr, "Error loading routing table, out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < hdr->nroutes; i++)
+    {
+        if (rec[i].iface >= hdr->nifaces)
+        {
+            fprintf(stderr, "Error loading routing table, malformed image\n");
+            free(rt);
+            *block = 0;
+            return -1;
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
-    } /* -- while -- */
+        rt[i].dest.s_addr = rec[i].dest;
+        rt[i].gw.s_addr = rec[i].gw;
+        rt[i].mask.s_addr = rec[i].mask;
+        memcpy(rt[i].interface, names + rec[i].iface * sr_IFACE_NAMELEN,
+               sr_IFACE_NAMELEN);
+        rt[i].adj = 0;
+    }
+    rt_bind_block(sr, rt, hdr->nroutes);
+
+    if ((hdr->flags & SR_RT_IMAGE_FIB) &&
+        sr->fib_engine == sr_fib_engine_poptrie)
+    {
+        char* base = map;
+        *fib = sr_fib_attach(hdr->nroutes ? rt : 0, hdr->nroutes,
+                             (uint32_t*)(base + hdr->direct_off),
+                             (struct sr_fib_node*)(base + hdr->nodes_off),
+                             hdr->nnodes,
+                             (uint32_t*)(base + hdr->leaves_off),
+                             hdr->nleaves, map, len);
+        if (!*fib)
+        { fprintf(stderr, "Routing table image has a corrupt FIB, rebuilding it\n"); }
+    }
+    return hdr->nroutes;
+} /* -- rt_load_image -- */
+
+/*---------------------------------------------------------------------
+ * Method: rt_publish(..)
+ * Scope: Local
+ *
+ * Make the n routes of block and the FIB compiled from them the current
+ * version, then free the old one once no forwarding thread can still
+ * be reading it. Called with sr->rt_lock held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void rt_publish(struct sr_instance* sr, struct sr_rt* block, uint32_t n,
+                       struct sr_fib* fib)
+{
+    struct sr_rt* old_block = sr->rt_block;
+    struct sr_fib* old_fib = sr->fib;
+
+    __atomic_store_n(&sr->routing_table, n ? block : 0, __ATOMIC_RELEASE);
+    sr->rt_block = block;
+    __atomic_store_n(&sr->fib, fib, __ATOMIC_RELEASE);
+    /* -- after the new FIB is in place, so a stale lookup can't be cached -- */
+    __atomic_add_fetch(&sr->route_gen, 1, __ATOMIC_RELEASE);
+
+    sr_rcu_synchronize();
+    sr_fib_destroy(old_fib);
+    free(old_block);
+} /* -- rt_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ * Scope: Global
+ *
+ * Replace the routing table with the one in filename, either text or
+ * an image written by sr_save_rt, and compile its FIB. The file is
+ * mapped and parsed in one pass into a single block of entries, and
+ * the new table replaces the old one as an update would, without
+ * stopping the forwarding threads. On error the current table is left
+ * in place.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    int fd;
+    struct stat st;
+    void* map = 0;
+    struct sr_rt* block = 0;
+    struct sr_fib* fib = 0;
+    long n;
+    int image = 0;
+    struct timeval start;
+    double load_ms;
+
+    /* -- REQUIRES -- */
+    assert(filename);
+    if( access(filename,R_OK) != 0)
+    {
+        perror("access");
+        return -1;
+    }
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        perror("open");
+        if(fd >= 0)
+        { close(fd); }
+        return -1;
+    }
+    gettimeofday(&start, 0);
+    if(st.st_size > 0 &&
+       (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if((size_t)st.st_size >= sizeof(struct sr_rt_image_hdr) &&
+       memcmp(map, SR_RT_IMAGE_MAGIC, 8) == 0)
+    {
+        image = 1;
+        n = rt_load_image(sr, map, st.st_size, &block, &fib);
+    }
+    else
+    {
+        n = rt_load_text(sr, map, st.st_size, &block);
+    }
+    /* -- a FIB made from the image keeps the mapping -- */
+    if(map && !fib)
+    { munmap(map, st.st_size); }
+    if(n < 0)
+    { return -1; }
+    load_ms = rt_elapsed_ms(&start);
+
+    if(n > 0)
+    { printf("Loading routing table from server, clear local routing table.\n"); }
+
+    /* -- compile the forwarding table from the new list -- */
+    gettimeofday(&start, 0);
+    if(!fib && (fib = sr_fib_build(n ? block : 0, sr->fib_engine)) == 0)
+    {
+        free(block);
+        return -1;
+    }
+
+    printf("Routing table: %ld routes from %s %s in %.3f ms\n", n,
+           image ? "image" : "text", filename, load_ms);
+    printf("FIB: %s engine, %u routes, %s in %.3f ms, %.1f KB\n",
+           sr_fib_engine_name(fib->engine), fib->nroutes - 1,
+           fib->map ? "mapped" : "built", rt_elapsed_ms(&start),
+           sr_fib_memory(fib) / 1024.0);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    rt_publish(sr, block, n, fib);
+    pthread_mutex_unlock(&(sr->rt_lock));
 
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
+/* (dest, mask) -> index + 1 of a route in an update's copy of the table */
+struct rt_index
+{
+    uint64_t* keys;
+    uint32_t* idx;      /* 0: empty slot */
+    uint32_t  mask;
+};
+
+#define RT_KEY(d, m) ((uint64_t)(d) << 32 | (m))
+#define RT_GONE      0xffffffffu      /* slot of a deleted route */
+
+static uint32_t* rt_index_slot(struct rt_index* ix, uint64_t key, int insert)
+{
+    uint32_t h = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & ix->mask;
+    uint32_t* gone = 0;
+
+    while (ix->idx[h])
+    {
+        if (ix->idx[h] == RT_GONE)
+        {
+            if (!gone)
+            { gone = &ix->idx[h]; }
+        }
+        else if (ix->keys[h] == key)
+        { return &ix->idx[h]; }
+        h = (h + 1) & ix->mask;
+    }
+    if (!insert)
+    { return 0; }
+    if (gone)
+    { h = gone - ix->idx; }
+    ix->keys[h] = key;
+    ix->idx[h] = 0;
+    return &ix->idx[h];
+}
+
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_update(..)
+ * Scope: Global
+ *
+ * Apply n route changes as one new version of the table, see sr_rt.h.
+ * Returns the number of changes that took effect (deleting a route that
+ * isn't there doesn't), or -1 if the new version couldn't be built, in
+ * which case the current one stays.
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
-struct in_addr gw, struct in_addr mask,char* if_name)
+int sr_rt_update(struct sr_instance* sr, const struct sr_rt_change* changes,
+                 unsigned int n)
 {
-    struct sr_rt* rt_walker = 0;
+    struct rt_index ix;
+    struct sr_rt* rt_walker;
+    struct sr_rt* block = 0;
+    uint8_t* dead = 0;
+    struct sr_fib* fib;
+    uint32_t count = 0, m = 0, live = 0, slots = 64, i;
+    int applied = 0;
 
-    /* -- REQUIRES -- */
-    assert(if_name);
-    assert(sr);
+    pthread_mutex_lock(&(sr->rt_lock));
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
+    for (rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    { count++; }
+    while (slots < 2 * ((uint64_t)count + n))
+    { slots <<= 1; }
+    ix.mask = slots - 1;
+    ix.keys = malloc(slots * sizeof(uint64_t));
+    ix.idx = calloc(slots, sizeof(uint32_t));
+    block = malloc(((size_t)count + n + 1) * sizeof(struct sr_rt));
+    dead = calloc(count + n + 1, 1);
+    if (!ix.keys || !ix.idx || !block || !dead)
+    { goto fail; }
+
+    /* -- copy the current version. Of routes with the same prefix only
+          the first is ever used, so the others are dropped here and a
+          prefix names one route -- */
+    for (rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        uint32_t* slot;
 
-        return;
+        block[m] = *rt_walker;
+        block[m].adj = __atomic_load_n(&rt_walker->adj, __ATOMIC_ACQUIRE);
+        slot = rt_index_slot(&ix, RT_KEY(rt_walker->dest.s_addr,
+                                         rt_walker->mask.s_addr), 1);
+        if (*slot == 0)
+        { *slot = m + 1; }
+        else
+        { dead[m] = 1; }
+        m++;
     }
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
+    for (i = 0; i < n; i++)
+    {
+        const struct sr_rt_change* c = &changes[i];
+        uint64_t key = RT_KEY(c->dest.s_addr, c->mask.s_addr);
+        uint32_t* slot = rt_index_slot(&ix, key, c->op == SR_RT_ADD);
+        struct sr_rt* r;
+
+        if (c->op != SR_RT_ADD)
+        {
+            if (slot && *slot)
+            {
+                dead[*slot - 1] = 1;
+                *slot = RT_GONE;
+                applied++;
+            }
+            continue;
+        }
+        if (*slot == 0)
+        { *slot = ++m; }
+        r = &block[*slot - 1];
+        r->dest = c->dest;
+        r->gw = c->gw;
+        r->mask = c->mask;
+        memset(r->interface, 0, sr_IFACE_NAMELEN);
+        strncpy(r->interface, c->interface, sr_IFACE_NAMELEN - 1);
+        r->adj = 0;
+        applied++;
+    }
+
+    /* -- close the gaps deletions left, keeping the order -- */
+    for (i = 0; i < m; i++)
+    {
+        if (!dead[i])
+        { block[live++] = block[i]; }
+    }
+    rt_bind_block(sr, block, live);
+
+    if ((fib = sr_fib_build(live ? block : 0, sr->fib_engine)) == 0)
+    { goto fail; }
+    rt_publish(sr, block, live, fib);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    free(ix.keys);
+    free(ix.idx);
+    free(dead);
+    return applied;
+
+fail:
+    pthread_mutex_unlock(&(sr->rt_lock));
+    fprintf(stderr, "sr_rt_update: out of memory\n");
+    free(ix.keys);
+    free(ix.idx);
+    free(block);
+    free(dead);
+    return -1;
+} /* -- sr_rt_update -- */
+
+/*---------------------------------------------------------------------
+ * Method: rt_write_section(..)
+ * Scope: Local
+ *
+ * Pad the image to the next section boundary, then write len bytes.
+ * *off is the file offset, advanced past them.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t rt_write_section(FILE* fp, uint64_t* off, const void* data,
+                                 size_t len)
+{
+    static const char zero[SR_RT_IMAGE_ALIGN];
+    uint64_t at = (*off + SR_RT_IMAGE_ALIGN - 1) & ~(uint64_t)(SR_RT_IMAGE_ALIGN - 1);
+
+    fwrite(zero, 1, at - *off, fp);
+    if (len)
+    { fwrite(data, 1, len, fp); }
+    *off = at + len;
+    return at;
+} /* -- rt_write_section -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_save_rt(..)
+ * Scope: Global
+ *
+ * Write the routing table and its poptrie as an image sr_load_rt can
+ * map, see sr_rt.h.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_save_rt(struct sr_instance* sr, const char* filename)
+{
+    struct sr_rt_image_hdr hdr;
+    struct sr_rt_image_route* rec = 0;
+    char (*names)[sr_IFACE_NAMELEN] = 0;
+    struct sr_fib* fib;
+    struct sr_rt* rt_walker;
+    uint32_t n = 0, i, last = 0;
+    uint64_t off = sizeof(hdr);
+    FILE* fp;
+    int ret = -1;
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    for (rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    { n++; }
+
+    /* -- the image holds a poptrie of exactly these routes, whatever
+          engine is in use -- */
+    fib = sr->fib;
+    if (!fib || fib->engine != sr_fib_engine_poptrie || fib->nroutes != n + 1)
+    {
+        if ((fib = sr_fib_build(sr->routing_table, sr_fib_engine_poptrie)) == 0)
+        {
+            pthread_mutex_unlock(&(sr->rt_lock));
+            return -1;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_RT_IMAGE_MAGIC, 8);
+    hdr.bom = SR_RT_IMAGE_BOM;
+    hdr.flags = SR_RT_IMAGE_FIB;
+
+    rec = malloc((n ? n : 1) * sizeof(*rec));
+    names = malloc((n ? n : 1) * sizeof(*names));
+    if (!rec || !names)
+    { goto done; }
+
+    for (rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next, hdr.nroutes++)
+    {
+        struct sr_rt_image_route* r = &rec[hdr.nroutes];
+
+        r->dest = rt_walker->dest.s_addr;
+        r->gw = rt_walker->gw.s_addr;
+        r->mask = rt_walker->mask.s_addr;
+
+        /* -- intern the interface name -- */
+        if (hdr.nifaces && strncmp(names[last], rt_walker->interface, sr_IFACE_NAMELEN) == 0)
+        { r->iface = last; continue; }
+        for (i = 0; i < hdr.nifaces; i++)
+        {
+            if (strncmp(names[i], rt_walker->interface, sr_IFACE_NAMELEN) == 0)
+            { break; }
+        }
+        if (i == hdr.nifaces)
+        {
+            size_t len = strnlen(rt_walker->interface, sr_IFACE_NAMELEN - 1);
+
+            memset(names[i], 0, sr_IFACE_NAMELEN);
+            memcpy(names[i], rt_walker->interface, len);
+            hdr.nifaces++;
+        }
+        r->iface = last = i;
     }
+    hdr.nnodes = fib->nnodes;
+    hdr.nleaves = fib->nleaves;
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    if ((fp = fopen(filename, "wb")) == 0)
+    {
+        perror(filename);
+        goto done;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    hdr.ifaces_off = rt_write_section(fp, &off, names,
+                                      (size_t)hdr.nifaces * sr_IFACE_NAMELEN);
+    hdr.routes_off = rt_write_section(fp, &off, rec, (size_t)n * sizeof(*rec));
+    hdr.direct_off = rt_write_section(fp, &off, fib->direct,
+                                      (1 << SR_FIB_DIRECT_BITS) * sizeof(uint32_t));
+    hdr.nodes_off = rt_write_section(fp, &off, fib->nodes,
+                                     (size_t)fib->nnodes * sizeof(struct sr_fib_node));
+    hdr.leaves_off = rt_write_section(fp, &off, fib->leaves,
+                                      (size_t)fib->nleaves * sizeof(uint32_t));
+    hdr.len = off;
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    /* -- the offsets are known now -- */
+    rewind(fp);
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    if (ferror(fp) | (fclose(fp) != 0))
+    {
+        fprintf(stderr, "Error writing routing table image %s\n", filename);
+        goto done;
+    }
+    printf("Saved %u routes and a %.1f KB FIB to %s\n", n,
+           sr_fib_memory(fib) / 1024.0, filename);
+    ret = 0;
 
-} /* -- sr_add_entry -- */
+done:
+    if (fib != sr->fib)
+    { sr_fib_destroy(fib); }
+    pthread_mutex_unlock(&(sr->rt_lock));
+    free(rec);
+    free(names);
+    return ret;
+} /* -- sr_save_rt -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -135,6 +703,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
 void sr_print_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
+    unsigned int shown = 0, hidden = 0;
 
     if(sr->routing_table == 0)
     {
@@ -150,6 +719,17 @@ void sr_print_routing_table(struct sr_instance* sr)
     while(rt_walker->next)
     {
         rt_walker = rt_walker->next; 
+        if(++shown == SR_RT_PRINT_MAX)
+        {
+            /* -- a generated table can have a million of them -- */
+            while(rt_walker)
+            {
+                hidden++;
+                rt_walker = rt_walker->next;
+            }
+            printf("... and %u more\n", hidden);
+            break;
+        }
         sr_print_routing_entry(rt_walker);
     }
 
@@ -17,6 +17,8 @@
 
 #include "sr_if.h"
 
+struct sr_adj;
+
 /* ----------------------------------------------------------------------------
  * struct sr_rt
  *
@@ -30,13 +32,88 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    int    ifid;        /* id of interface, -1 until it is known */
+    struct sr_adj* adj; /* adjacency of gw, bound on first use */
     struct sr_rt* next;
 };
 
 
+/* ----------------------------------------------------------------------------
+ * Routing table image
+ *
+ * Binary form of a loaded routing table, written by sr_save_rt. sr_load_rt
+ * recognises it by its magic and maps it instead of parsing text: a header,
+ * the interface names, one record per route in table order and, if
+ * SR_RT_IMAGE_FIB is set, the poptrie arrays compiled from those routes
+ * (sr_fib.h), which the FIB then uses in place. Every section starts on a
+ * SR_RT_IMAGE_ALIGN boundary. Images are in the byte order of the host
+ * that wrote them and are refused by a host of the other order.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_IMAGE_MAGIC "SRRTIMG1"
+#define SR_RT_IMAGE_BOM   0x1a2b3c4du
+#define SR_RT_IMAGE_ALIGN 64
+#define SR_RT_IMAGE_FIB   0x1    /* poptrie arrays follow the routes */
+
+struct sr_rt_image_hdr
+{
+    char     magic[8];
+    uint32_t bom;
+    uint32_t flags;
+    uint32_t nroutes;
+    uint32_t nifaces;      /* names of sr_IFACE_NAMELEN bytes each */
+    uint32_t nnodes;
+    uint32_t nleaves;
+    uint64_t ifaces_off;   /* offsets from the start of the file */
+    uint64_t routes_off;
+    uint64_t direct_off;   /* 1 << SR_FIB_DIRECT_BITS entries */
+    uint64_t nodes_off;
+    uint64_t leaves_off;
+    uint64_t len;          /* of the whole file */
+};
+
+struct sr_rt_image_route
+{
+    uint32_t dest;          /* network byte order */
+    uint32_t gw;
+    uint32_t mask;
+    uint32_t iface;         /* index into the names */
+};
+
+/* ----------------------------------------------------------------------------
+ * Route updates
+ *
+ * The forwarding threads read sr->fib, and the routes through it, inside
+ * RCU read-side sections (sr_rcu.h), so the table is never changed in
+ * place once it is in use. An update copies the table, applies its
+ * changes to the copy, compiles a FIB for it off to the side and
+ * publishes both with a pointer swap; the old version is freed after a
+ * grace period. One batch costs one copy and one FIB build however many
+ * changes it holds, so bulk changes should go in together. sr_load_rt
+ * swaps in a whole new table the same way. Updates are serialised by
+ * sr->rt_lock and never make a forwarding thread wait.
+ *
+ * A route is identified by its destination and mask: adding one that
+ * exists replaces it.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_ADD 1
+#define SR_RT_DEL 2
+
+struct sr_rt_change
+{
+    int            op;         /* SR_RT_ADD or SR_RT_DEL */
+    struct in_addr dest;
+    struct in_addr gw;         /* SR_RT_ADD only */
+    struct in_addr mask;
+    char           interface[sr_IFACE_NAMELEN];   /* SR_RT_ADD only */
+};
+
 int sr_load_rt(struct sr_instance*,const char*);
-void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
-                  struct in_addr, char*);
+int sr_save_rt(struct sr_instance*,const char*);
+int sr_rt_update(struct sr_instance*, const struct sr_rt_change*, unsigned int);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
@@ -0,0 +1,177 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stat.c
+ *
+ * Description:
+ *
+ * Shows the counters of a running router (sr_stats.h). The counter
+ * segment is mapped read-only and summed here, so polling costs the
+ * router nothing however often it is done.
+ *
+ * Every interval, one line per interface with its packet and bit rates
+ * in both directions, and one line with the drop and other counters
+ * that moved, per second. With -o, the totals once.
+ * Usage: sr_stat [-m segment] [-i interval ms] [-n count] [-o]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_stats.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int router_gone(const struct sr_stats_shm* shm)
+{
+    return kill((pid_t)shm->hdr.pid, 0) != 0 && errno == ESRCH;
+}
+
+static void print_totals(const struct sr_stats_shm* shm)
+{
+    struct sr_stats_block t;
+    uint32_t i;
+
+    sr_stats_sum(shm, &t);
+    /* -- a router that died without closing leaves its segment behind -- */
+    if (router_gone(shm))
+    { printf("router pid %lld has exited, final counts\n", (long long)shm->hdr.pid); }
+    else
+    {
+        printf("router pid %lld, up %lld s\n", (long long)shm->hdr.pid,
+               (long long)(time(0) - shm->hdr.started));
+    }
+    for (i = 0; i < shm->hdr.nifaces && i < SR_IF_MAX; i++)
+    {
+        printf("%-8s rx %12llu pkts %15llu bytes   tx %12llu pkts %15llu bytes\n",
+               shm->hdr.ifnames[i],
+               (unsigned long long)t.ifc[i][SR_STAT_RX_PKTS],
+               (unsigned long long)t.ifc[i][SR_STAT_RX_BYTES],
+               (unsigned long long)t.ifc[i][SR_STAT_TX_PKTS],
+               (unsigned long long)t.ifc[i][SR_STAT_TX_BYTES]);
+    }
+    for (i = 0; i < SR_STAT_NCOUNTERS; i++)
+    { printf("%-14s %llu\n", sr_stat_names[i], (unsigned long long)t.c[i]); }
+}
+
+/* -- rates between two sums dt seconds apart -- */
+static void print_rates(const struct sr_stats_shm* shm, const struct sr_stats_block* a,
+                        const struct sr_stats_block* b, double dt)
+{
+    uint32_t i;
+    int any = 0;
+
+    for (i = 0; i < shm->hdr.nifaces && i < SR_IF_MAX; i++)
+    {
+        const uint64_t* x = a->ifc[i];
+        const uint64_t* y = b->ifc[i];
+
+        printf("%-8s rx %10.0f pps %9.2f Mbit/s   tx %10.0f pps %9.2f Mbit/s\n",
+               shm->hdr.ifnames[i],
+               (y[SR_STAT_RX_PKTS] - x[SR_STAT_RX_PKTS]) / dt,
+               (y[SR_STAT_RX_BYTES] - x[SR_STAT_RX_BYTES]) * 8e-6 / dt,
+               (y[SR_STAT_TX_PKTS] - x[SR_STAT_TX_PKTS]) / dt,
+               (y[SR_STAT_TX_BYTES] - x[SR_STAT_TX_BYTES]) * 8e-6 / dt);
+    }
+    for (i = 0; i < SR_STAT_NCOUNTERS; i++)
+    {
+        if (b->c[i] != a->c[i])
+        {
+            printf("%s%s %.0f/s", any++ ? ", " : "", sr_stat_names[i],
+                   (b->c[i] - a->c[i]) / dt);
+        }
+    }
+    printf("%s\n", any ? "" : "no drops");
+}
+
+static void usage(char* argv0)
+{
+    printf("Router counters\n");
+    printf("Format: %s [-m segment] [-i interval ms] [-n count] [-o]\n", argv0);
+    printf("   defaults segment=%s interval=1000, count=0 (forever)\n", SR_STATS_NAME);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = SR_STATS_NAME;
+    const struct sr_stats_shm* shm;
+    struct sr_stats_block sum[2];
+    unsigned int interval = 1000, count = 0, n;
+    int once = 0, c, cur = 0;
+    double t0, t1;
+
+    while ((c = getopt(argc, argv, "hm:i:n:o")) != EOF)
+    {
+        switch (c)
+        {
+            case 'm': name = optarg; break;
+            case 'i': interval = strtoul(optarg, 0, 10); break;
+            case 'n': count = strtoul(optarg, 0, 10); break;
+            case 'o': once = 1; break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (interval == 0)
+    { interval = 1; }
+
+    if ((shm = sr_stats_attach(name)) == 0)
+    {
+        fprintf(stderr, "no router counters in %s\n", name);
+        return 1;
+    }
+    if (once)
+    {
+        print_totals(shm);
+        sr_stats_detach(shm);
+        return 0;
+    }
+
+    sr_stats_sum(shm, &sum[cur]);
+    t0 = now_sec();
+    for (n = 0; count == 0 || n < count; n++)
+    {
+        struct timespec nap = { interval / 1000, (interval % 1000) * 1000000L };
+
+        nanosleep(&nap, 0);
+        /* -- a restarted router has a new segment under the same name -- */
+        if (router_gone(shm))
+        {
+            const struct sr_stats_shm* again = sr_stats_attach(name);
+
+            if (again && again->hdr.pid != shm->hdr.pid)
+            {
+                printf("router restarted, pid %lld\n", (long long)again->hdr.pid);
+                sr_stats_detach(shm);
+                shm = again;
+                sr_stats_sum(shm, &sum[cur]);
+                t0 = now_sec();
+                continue;
+            }
+            if (again)
+            { sr_stats_detach(again); }
+        }
+        sr_stats_sum(shm, &sum[!cur]);
+        t1 = now_sec();
+        print_rates(shm, &sum[cur], &sum[!cur], t1 - t0);
+        fflush(stdout);
+        cur = !cur;
+        t0 = t1;
+    }
+    sr_stats_detach(shm);
+    return 0;
+}
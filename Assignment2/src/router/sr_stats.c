@@ -0,0 +1,261 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Counter blocks and the segment they live in, see sr_stats.h. A block
+ * is never given back: a thread that exits leaves its counts behind, and
+ * readers can add up every handed out block without locking against
+ * thread exit.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_stats.h"
+
+const char* const sr_stat_names[SR_STAT_NCOUNTERS] =
+{
+    "bad checksum", "ttl expired", "no route", "arp timeout", "queue full",
+    "malformed", "icmp sent", "icmp src limited",
+    "icmp limited", "arp hits", "arp misses",
+    "arp refreshes", "arp expired in use", "arp requests",
+    "arp deferred"
+};
+
+__thread struct sr_stats_block* sr_stats_self;
+
+static struct sr_stats_shm* stats;
+static char* stats_name;       /* of the segment we created, until closed */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stats_init_hdr(struct sr_stats_shm* shm)
+{
+    shm->hdr.version = SR_STATS_VERSION;
+    shm->hdr.ncounters = SR_STAT_NCOUNTERS;
+    shm->hdr.nifcounters = SR_STAT_IF_NCOUNTERS;
+    shm->hdr.pid = getpid();
+    shm->hdr.started = time(0);
+    /* -- last, a reader that sees it sees the rest -- */
+    __atomic_store_n(&shm->hdr.magic, SR_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_open(const char* name)
+ * Scope: Global
+ *
+ * Create the segment, readable by everybody and writable by us only.
+ * An old segment of the same name, left by an earlier run, is unlinked
+ * first: readers still mapping it keep the old counts.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_open(const char* name)
+{
+    struct sr_stats_shm* shm;
+    int fd;
+
+    pthread_mutex_lock(&stats_lock);
+    if (stats)
+    {
+        pthread_mutex_unlock(&stats_lock);
+        fprintf(stderr, "sr_stats_open: counting has already started\n");
+        return -1;
+    }
+    shm_unlink(name);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+    {
+        pthread_mutex_unlock(&stats_lock);
+        fprintf(stderr, "sr_stats_open: %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct sr_stats_shm)) != 0 ||
+        (shm = mmap(0, sizeof(struct sr_stats_shm), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "sr_stats_open: %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        pthread_mutex_unlock(&stats_lock);
+        return -1;
+    }
+    close(fd);
+
+    stats_init_hdr(shm);
+    stats = shm;
+    stats_name = strdup(name);
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+} /* -- sr_stats_open -- */
+
+void sr_stats_close(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    if (stats_name)
+    {
+        shm_unlink(stats_name);
+        free(stats_name);
+        stats_name = 0;
+    }
+    pthread_mutex_unlock(&stats_lock);
+} /* -- sr_stats_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_register(void)
+ * Scope: Global
+ *
+ * Hand the calling thread its block, in private memory if nobody opened
+ * a segment. Threads beyond SR_STATS_THREADS share the last block and
+ * may lose counts to each other.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_stats_block* sr_stats_register(void)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&stats_lock);
+    if (!stats)
+    {
+        /* -- a thread that can't count has to stop here -- */
+        if ((stats = mmap(0, sizeof(struct sr_stats_shm), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        {
+            fprintf(stderr, "sr_stats_register: out of memory\n");
+            abort();
+        }
+        stats_init_hdr(stats);
+    }
+    i = stats->hdr.nblocks;
+    __atomic_store_n(&stats->hdr.nblocks, i + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stats_lock);
+
+    sr_stats_self = &stats->blocks[i < SR_STATS_THREADS ? i : SR_STATS_THREADS - 1];
+    return sr_stats_self;
+} /* -- sr_stats_register -- */
+
+void sr_stats_name_interface(int ifid, const char* name)
+{
+    if (!sr_stats_self)
+    { sr_stats_register(); }
+    if (ifid < 0 || ifid >= SR_IF_MAX)
+    { return; }
+
+    pthread_mutex_lock(&stats_lock);
+    strncpy(stats->hdr.ifnames[ifid], name, sr_IFACE_NAMELEN - 1);
+    if ((uint32_t)ifid >= stats->hdr.nifaces)
+    { __atomic_store_n(&stats->hdr.nifaces, ifid + 1, __ATOMIC_RELEASE); }
+    pthread_mutex_unlock(&stats_lock);
+} /* -- sr_stats_name_interface -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_sum(..)
+ * Scope: Global
+ *
+ * Add up the blocks handed out so far. Safe against the threads that
+ * are counting, which the sum may or may not include the latest counts
+ * of.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_sum(const struct sr_stats_shm* shm, struct sr_stats_block* out)
+{
+    uint32_t n = __atomic_load_n(&shm->hdr.nblocks, __ATOMIC_ACQUIRE);
+    uint32_t b, i, j;
+
+    memset(out, 0, sizeof(*out));
+    if (n > SR_STATS_THREADS)
+    { n = SR_STATS_THREADS; }
+    for (b = 0; b < n; b++)
+    {
+        const struct sr_stats_block* blk = &shm->blocks[b];
+
+        for (i = 0; i < SR_STAT_NCOUNTERS; i++)
+        { out->c[i] += __atomic_load_n(&blk->c[i], __ATOMIC_RELAXED); }
+        for (i = 0; i < SR_IF_MAX; i++)
+            for (j = 0; j < SR_STAT_IF_NCOUNTERS; j++)
+            { out->ifc[i][j] += __atomic_load_n(&blk->ifc[i][j], __ATOMIC_RELAXED); }
+    }
+} /* -- sr_stats_sum -- */
+
+void sr_stats_get(struct sr_stats_block* out)
+{
+    if (!sr_stats_self)
+    { sr_stats_register(); }
+    sr_stats_sum(stats, out);
+} /* -- sr_stats_get -- */
+
+void sr_stats_print(FILE* fp)
+{
+    struct sr_stats_block t;
+    uint32_t i, nifaces;
+
+    sr_stats_get(&t);
+    nifaces = __atomic_load_n(&stats->hdr.nifaces, __ATOMIC_ACQUIRE);
+    for (i = 0; i < nifaces; i++)
+    {
+        fprintf(fp, "Interface %s: %llu packets (%llu bytes) in, "
+                "%llu packets (%llu bytes) out\n", stats->hdr.ifnames[i],
+                (unsigned long long)t.ifc[i][SR_STAT_RX_PKTS],
+                (unsigned long long)t.ifc[i][SR_STAT_RX_BYTES],
+                (unsigned long long)t.ifc[i][SR_STAT_TX_PKTS],
+                (unsigned long long)t.ifc[i][SR_STAT_TX_BYTES]);
+    }
+    fprintf(fp, "Packet counters:");
+    for (i = 0; i < SR_STAT_NCOUNTERS; i++)
+    {
+        fprintf(fp, "%s %s %llu", i ? "," : "", sr_stat_names[i],
+                (unsigned long long)t.c[i]);
+    }
+    fprintf(fp, "\n");
+} /* -- sr_stats_print -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_attach(const char* name)
+ * Scope: Global
+ *
+ * Map a segment for reading. The mapping is read-only, so a reader
+ * can't disturb the router whatever it does.
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_stats_shm* sr_stats_attach(const char* name)
+{
+    struct sr_stats_shm* shm;
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+    { return 0; }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct sr_stats_shm) ||
+        (shm = mmap(0, sizeof(struct sr_stats_shm), PROT_READ, MAP_SHARED,
+                    fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    if (__atomic_load_n(&shm->hdr.magic, __ATOMIC_ACQUIRE) != SR_STATS_MAGIC || shm->hdr.version != SR_STATS_VERSION ||
+        shm->hdr.ncounters != SR_STAT_NCOUNTERS ||
+        shm->hdr.nifcounters != SR_STAT_IF_NCOUNTERS)
+    {
+        munmap(shm, sizeof(struct sr_stats_shm));
+        return 0;
+    }
+    return shm;
+} /* -- sr_stats_attach -- */
+
+void sr_stats_detach(const struct sr_stats_shm* shm)
+{
+    munmap((void*)shm, sizeof(struct sr_stats_shm));
+} /* -- sr_stats_detach -- */
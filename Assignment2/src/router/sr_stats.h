@@ -0,0 +1,142 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ * Description:
+ *
+ * Packet counters: received and sent per interface, drops by reason,
+ * ICMP messages generated, ARP cache hits and misses and ARP requests.
+ *
+ * Each thread that counts gets a block of its own, cache line aligned,
+ * the first time it counts something, and only ever writes to that
+ * block, with plain stores: counting costs an add and a store to a line
+ * no other thread writes. Nothing is summed on the packet path. The
+ * blocks live in a shared memory segment (sr_stats_open) that other
+ * processes map read-only and add up whenever they like, so sr_stat can
+ * poll a running router as often as it wants without the router doing
+ * anything for it. Without sr_stats_open the blocks are in private
+ * memory and only sr_stats_get sees them.
+ *
+ * Counters are 64 bit and only grow; readers get each one whole, but a
+ * set of counters read together is not a snapshot.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_STATS_H
+#define sr_STATS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#include "sr_if.h"
+
+#define SR_STATS_NAME    "/sr_stats"    /* default segment */
+#define SR_STATS_MAGIC   0x54535253u    /* "SRST" */
+#define SR_STATS_VERSION 4
+#define SR_STATS_THREADS 64   /* blocks in a segment; later threads share the last */
+
+enum sr_stat
+{
+    SR_STAT_DROP_CKSUM,        /* IP header too short or bad checksum */
+    SR_STAT_DROP_TTL,          /* TTL expired */
+    SR_STAT_DROP_NO_ROUTE,
+    SR_STAT_DROP_ARP_TIMEOUT,  /* next hop never answered */
+    SR_STAT_DROP_QUEUE_FULL,   /* no buffer, or no room on a queue */
+    SR_STAT_DROP_MALFORMED,    /* runt frames, types and protocols we don't handle */
+    SR_STAT_ICMP_SENT,
+    SR_STAT_ICMP_LIMITED_SRC,  /* errors suppressed by their source's bucket */
+    SR_STAT_ICMP_LIMITED,      /* and by the global one */
+    SR_STAT_ARP_HIT,           /* routed frames whose next hop was resolved */
+    SR_STAT_ARP_MISS,          /* and those queued for ARP */
+    SR_STAT_ARP_REFRESH,       /* unicast requests to neighbours in use */
+    SR_STAT_ARP_EXPIRED_USED,  /* neighbours in use that expired all the same */
+    SR_STAT_ARP_REQUEST,       /* broadcast requests sent */
+    SR_STAT_ARP_DEFERRED,      /* requests and refreshes the scheduler held back */
+    SR_STAT_NCOUNTERS
+};
+
+enum sr_stat_if
+{
+    SR_STAT_RX_PKTS,
+    SR_STAT_RX_BYTES,
+    SR_STAT_TX_PKTS,
+    SR_STAT_TX_BYTES,
+    SR_STAT_IF_NCOUNTERS
+};
+
+struct sr_stats_block
+{
+    uint64_t c[SR_STAT_NCOUNTERS];
+    uint64_t ifc[SR_IF_MAX][SR_STAT_IF_NCOUNTERS];
+} __attribute__((aligned(64)));
+
+struct sr_stats_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ncounters;        /* SR_STAT_NCOUNTERS of the writer */
+    uint32_t nifcounters;      /* SR_STAT_IF_NCOUNTERS of the writer */
+    uint32_t nblocks;          /* blocks handed out, may exceed SR_STATS_THREADS */
+    uint32_t nifaces;          /* interfaces named so far */
+    int64_t  pid;              /* of the router */
+    int64_t  started;          /* time() it opened the segment */
+    char     ifnames[SR_IF_MAX][sr_IFACE_NAMELEN];
+} __attribute__((aligned(64)));
+
+/* Layout of a segment */
+struct sr_stats_shm
+{
+    struct sr_stats_hdr   hdr;
+    struct sr_stats_block blocks[SR_STATS_THREADS];
+};
+
+extern const char* const sr_stat_names[SR_STAT_NCOUNTERS];
+extern __thread struct sr_stats_block* sr_stats_self;
+
+struct sr_stats_block* sr_stats_register(void);
+
+/* Count n of s in the calling thread's block */
+static inline void sr_stats_add(enum sr_stat s, uint64_t n)
+{
+    struct sr_stats_block* b = sr_stats_self ? sr_stats_self : sr_stats_register();
+
+    __atomic_store_n(&b->c[s], b->c[s] + n, __ATOMIC_RELAXED);
+}
+
+/* One frame of len bytes received or sent on interface ifid */
+static inline void sr_stats_if(int ifid, enum sr_stat_if pkts, unsigned int len)
+{
+    struct sr_stats_block* b = sr_stats_self ? sr_stats_self : sr_stats_register();
+    uint64_t* c = b->ifc[ifid];
+
+    __atomic_store_n(&c[pkts], c[pkts] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c[pkts + 1], c[pkts + 1] + len, __ATOMIC_RELAXED);
+}
+
+#define sr_stats_rx(ifid, len) sr_stats_if((ifid), SR_STAT_RX_PKTS, (len))
+#define sr_stats_tx(ifid, len) sr_stats_if((ifid), SR_STAT_TX_PKTS, (len))
+
+/* Put the counters in a new shared memory segment called name, replacing
+   any old one. Must come before anything is counted. 0 on success.
+   sr_stats_close removes the name on the way out; counting goes on in
+   the still mapped segment, and readers keep what they have mapped. */
+int  sr_stats_open(const char* name);
+void sr_stats_close(void);
+void sr_stats_name_interface(int ifid, const char* name);
+
+/* Totals of this process's counters */
+void sr_stats_get(struct sr_stats_block* out);
+void sr_stats_print(FILE* fp);
+
+/* For readers: map the segment called name read-only (NULL if it can't
+   be, or isn't a segment of this version), and add up its blocks. */
+const struct sr_stats_shm* sr_stats_attach(const char* name);
+void sr_stats_detach(const struct sr_stats_shm* shm);
+void sr_stats_sum(const struct sr_stats_shm* shm, struct sr_stats_block* out);
+
+#endif  /* --  sr_STATS_H -- */
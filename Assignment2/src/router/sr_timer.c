@@ -0,0 +1,162 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Timer wheel used for ARP expiry and retransmission, see sr_timer.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_timer.h"
+
+#define TIMER_MASK    (SR_TIMER_SLOTS - 1)
+#define TIMER_MAX_TTL ((1ULL << (SR_TIMER_LEVELS * SR_TIMER_BITS)) - 1)
+
+uint64_t sr_timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / SR_TIMER_TICK_MS;
+} /* -- sr_timer_now -- */
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = sr_timer_now();
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_init(struct sr_timer* timer, sr_timer_fn fn, void* arg)
+{
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+} /* -- sr_timer_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: timer_place(..)
+ * Scope: Local
+ *
+ * Link timer into the slot for its expiry: level 0 if it is due within
+ * 64 ticks, otherwise the first level whose span covers the distance.
+ *
+ *---------------------------------------------------------------------*/
+
+static void timer_place(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    uint64_t delta = timer->expires > wheel->now ?
+                     timer->expires - wheel->now : 0;
+    struct sr_timer** slot;
+    int level = 0;
+
+    if (delta > TIMER_MAX_TTL)
+    {
+        timer->expires = wheel->now + TIMER_MAX_TTL;
+        delta = TIMER_MAX_TTL;
+    }
+    while (level < SR_TIMER_LEVELS - 1 &&
+           delta >= (1ULL << ((level + 1) * SR_TIMER_BITS)))
+    { level++; }
+
+    slot = &wheel->slots[level][(timer->expires >> (level * SR_TIMER_BITS)) & TIMER_MASK];
+    timer->next = *slot;
+    if (timer->next)
+    { timer->next->pprev = &timer->next; }
+    timer->pprev = slot;
+    *slot = timer;
+} /* -- timer_place -- */
+
+static void timer_unlink(struct sr_timer* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+    { timer->next->pprev = timer->pprev; }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  uint32_t delay_ms)
+{
+    uint64_t ticks = (delay_ms + SR_TIMER_TICK_MS - 1) / SR_TIMER_TICK_MS;
+
+    assert(timer->fn);
+
+    if (sr_timer_pending(timer))
+    { timer_unlink(timer); }
+    else
+    { wheel->pending++; }
+
+    /* -- the current tick's slot has already been run -- */
+    timer->expires = wheel->now + (ticks ? ticks : 1);
+    timer_place(wheel, timer);
+} /* -- sr_timer_add -- */
+
+void sr_timer_cancel(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    if (!sr_timer_pending(timer))
+    { return; }
+    timer_unlink(timer);
+    wheel->pending--;
+} /* -- sr_timer_cancel -- */
+
+/* Move every timer of an upper-level slot down to where it now belongs. */
+static void timer_cascade(struct sr_timer_wheel* wheel, int level, uint32_t idx)
+{
+    struct sr_timer* timer = wheel->slots[level][idx];
+
+    wheel->slots[level][idx] = 0;
+    while (timer)
+    {
+        struct sr_timer* next = timer->next;
+        timer_place(wheel, timer);
+        timer = next;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_advance(..)
+ * Scope: Global
+ *
+ * Step the wheel one tick at a time up to now. At every 64-tick boundary
+ * the next slot of level 1 is cascaded, and so on upwards whenever a
+ * level wraps.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_advance(struct sr_timer_wheel* wheel, uint64_t now)
+{
+    while (wheel->now < now)
+    {
+        struct sr_timer* timer;
+        uint32_t idx;
+
+        wheel->now++;
+        if ((wheel->now & TIMER_MASK) == 0)
+        {
+            int level;
+            for (level = 1; level < SR_TIMER_LEVELS; level++)
+            {
+                idx = (wheel->now >> (level * SR_TIMER_BITS)) & TIMER_MASK;
+                timer_cascade(wheel, level, idx);
+                if (idx != 0)
+                { break; }
+            }
+        }
+
+        /* -- pop one at a time: callbacks may touch this very slot -- */
+        idx = wheel->now & TIMER_MASK;
+        while ((timer = wheel->slots[0][idx]) != 0)
+        {
+            timer_unlink(timer);
+            wheel->pending--;
+            timer->fn(timer, timer->arg);
+        }
+    }
+} /* -- sr_timer_advance -- */
@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ * Description:
+ *
+ * Hierarchical timer wheel (Varghese & Lauck, "Hashed and Hierarchical
+ * Timing Wheels", SOSP '87). Four levels of 64 slots cover 2^24 ticks;
+ * level 0 has one slot per tick and each level above covers 64 slots of
+ * the level below. Adding or cancelling a timer is O(1); a timer is moved
+ * down at most once per level as its expiry approaches.
+ *
+ * The wheel does no locking of its own. Whoever owns it serializes
+ * sr_timer_add, sr_timer_cancel and sr_timer_advance, and callbacks run
+ * under that same serialization.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_TIMER_H
+#define sr_TIMER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TIMER_TICK_MS 10
+#define SR_TIMER_LEVELS  4
+#define SR_TIMER_BITS    6
+#define SR_TIMER_SLOTS   (1 << SR_TIMER_BITS)
+
+struct sr_timer;
+typedef void (*sr_timer_fn)(struct sr_timer* timer, void* arg);
+
+/* ----------------------------------------------------------------------------
+ * struct sr_timer
+ *
+ * Embed one of these in the object being timed. pprev is NULL while the
+ * timer is not scheduled.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_timer
+{
+    struct sr_timer*  next;
+    struct sr_timer** pprev;
+    uint64_t          expires;  /* tick */
+    sr_timer_fn       fn;
+    void*             arg;
+};
+
+struct sr_timer_wheel
+{
+    uint64_t         now;       /* last tick processed */
+    uint32_t         pending;   /* timers currently scheduled */
+    struct sr_timer* slots[SR_TIMER_LEVELS][SR_TIMER_SLOTS];
+};
+
+/* Current monotonic time in ticks. */
+uint64_t sr_timer_now(void);
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel);
+void sr_timer_init(struct sr_timer* timer, sr_timer_fn fn, void* arg);
+
+/* Schedule timer to fire after delay_ms (rounded up to whole ticks, at
+   least one). Re-arms the timer if it is already pending. */
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  uint32_t delay_ms);
+void sr_timer_cancel(struct sr_timer_wheel* wheel, struct sr_timer* timer);
+
+/* Run every timer due up to tick now. Callbacks may add or cancel timers,
+   including the one that is firing. */
+void sr_timer_advance(struct sr_timer_wheel* wheel, uint64_t now);
+
+static inline int sr_timer_pending(const struct sr_timer* timer)
+{
+    return timer->pprev != 0;
+}
+
+#endif  /* --  sr_TIMER_H -- */
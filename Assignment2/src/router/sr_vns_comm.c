@@ -35,12 +35,17 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_pipeline.h"
+#include "sr_log.h"
+#include "sr_stats.h"
 #include "sha1.h"
 #include "vnscommand.h"
 
@@ -48,9 +53,36 @@ static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  int iface);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
+#define SR_VNS_RXBUF  (64 * 1024)  /* at least SR_VNS_MAX_CMD */
+#define SR_VNS_TXBUF  (64 * 1024)
+#define SR_VNS_TX_IOV 64
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_io
+ *
+ * Socket buffers. Commands are read a chunk at a time and handled where
+ * they land; frames to send are gathered on an iovec list and written
+ * with one writev per batch. Frames sent in place are referenced where
+ * they are, anything else is copied into the staging buffer first.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_vns_io
+{
+    uint8_t*        rx;          /* SR_VNS_RXBUF bytes */
+    uint32_t        rx_head;     /* first byte not yet handled */
+    uint32_t        rx_tail;     /* end of the bytes read */
+
+    pthread_mutex_t tx_lock;     /* the ARP thread sends too */
+    struct iovec    iov[SR_VNS_TX_IOV];
+    int             niov;
+    uint8_t*        stage;       /* SR_VNS_TXBUF bytes */
+    uint32_t        stage_len;
+};
+
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
  *
@@ -61,6 +93,32 @@ static void sr_session_closed_help()
 {
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_init()
+ * Scope: Global
+ *
+ * Allocate the socket buffers for sr->sockfd. Called by
+ * sr_connect_to_server; anything else driving the reader and sender over
+ * its own socket calls it once itself.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_init(struct sr_instance* sr)
+{
+    if ( sr->vns )
+    { return 0; }
+
+    sr->vns = (struct sr_vns_io*)calloc(1, sizeof(struct sr_vns_io));
+    if ( !sr->vns || !(sr->vns->rx = malloc(SR_VNS_RXBUF)) ||
+         !(sr->vns->stage = malloc(SR_VNS_TXBUF)) )
+    {
+        fprintf(stderr,"Error: out of memory (sr_vns_init)\n");
+        return -1;
+    }
+    pthread_mutex_init(&sr->vns->tx_lock, 0);
+    return 0;
+} /* -- sr_vns_init -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_connect_to_server()
  * Scope: Global
@@ -112,6 +170,9 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+    if ( sr_vns_init(sr) != 0 )
+    { return -1; }
+
     /* attempt to connect to the server */
     if (connect(sr->sockfd, (struct sockaddr *)&(sr->sr_addr),
                 sizeof(sr->sr_addr)) < 0)
@@ -177,6 +238,7 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
 {
     int num_entries;
     int i = 0;
+    int ignored = 0; /* the addresses that follow are of an ignored interface */
 
     /* REQUIRES */
     assert(sr);
@@ -196,7 +258,7 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
                 break;
             case HWINTERFACE:
                 /*Debug("INTERFACE: %s\n",hwinfo->mHWInfo[i].value);*/
-                sr_add_interface(sr,hwinfo->mHWInfo[i].value);
+                ignored = sr_add_interface(sr,hwinfo->mHWInfo[i].value) != 0;
                 break;
             case HWSPEED:
                 /* Debug("Speed: %d\n",
@@ -213,13 +275,15 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWETHIP:
                 /*Debug("IP: %s\n",inet_ntoa(
                             *((struct in_addr*)(hwinfo->mHWInfo[i].value))));*/
-                sr_set_ether_ip(sr,*((uint32_t*)hwinfo->mHWInfo[i].value));
+                if ( !ignored )
+                { sr_set_ether_ip(sr,*((uint32_t*)hwinfo->mHWInfo[i].value)); }
                 break;
             case HWETHER:
                 /*Debug("\tHardware Address: ");
                 DebugMAC(hwinfo->mHWInfo[i].value);
                 Debug("\n"); */
-                sr_set_ether_addr(sr,(unsigned char*)hwinfo->mHWInfo[i].value);
+                if ( !ignored )
+                { sr_set_ether_addr(sr,(unsigned char*)hwinfo->mHWInfo[i].value); }
                 break;
             default:
                 printf (" %d \n",ntohl(hwinfo->mHWInfo[i].mKey));
@@ -331,131 +395,84 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
     return sr_read_from_server_expect(sr, 0);
 }
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
-
-    /* REQUIRES */
-    assert(sr);
-
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
-
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
-    }
-
-    len = ntohl(len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_fill(..)
+ * Scope: Local
+ *
+ * Make sure at least need bytes past rx_head are buffered. Every recv
+ * asks for all the free space, so one call usually brings in many
+ * commands. The unparsed tail is moved to the front of the buffer when
+ * it would not otherwise fit; callers only get here once every frame
+ * sent from the buffer has been flushed.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
+static int sr_vns_fill(struct sr_instance* sr, uint32_t need)
+{
+    struct sr_vns_io* io = sr->vns;
+    ssize_t ret;
 
-    if((buf = malloc(len)) == 0)
+    if ( io->rx_head == io->rx_tail )
+    { io->rx_head = io->rx_tail = 0; }
+    else if ( io->rx_head + need > SR_VNS_RXBUF )
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        memmove(io->rx, io->rx + io->rx_head, io->rx_tail - io->rx_head);
+        io->rx_tail -= io->rx_head;
+        io->rx_head = 0;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
-
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    while ( io->rx_tail - io->rx_head < need )
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
-
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+        /* -- just in case SIGALRM breaks recv -- */
+        if((ret = recv(sr->sockfd, io->rx + io->rx_tail,
+                        SR_VNS_RXBUF - io->rx_tail, 0)) == -1)
+        {
+            if ( errno == EINTR )
+            { continue; }
 
-    /* make sure the command is what we expected if we were expecting something */
-    if(expected_cmd && command!=expected_cmd) {
-        if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
-            fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+            perror("recv(..):sr_client.c::sr_read_from_server");
             return -1;
         }
+        if ( ret == 0 )
+        {
+            fprintf(stderr,"Error: connection closed by server\n");
+            return -1;
+        }
+        io->rx_tail += ret;
     }
+    return 0;
+} /* -- sr_vns_fill -- */
 
-    ret = 1;
-    switch (command)
-    {
-        /* -------------        VNSPACKET     -------------------- */
-
-        case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+/* Length field of the command at buf, host byte order. */
+static int sr_vns_cmd_len(const uint8_t* buf)
+{
+    uint32_t len;
+    memcpy(&len, buf, 4);
+    return (int)ntohl(len);
+}
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_handle_command(..)
+ * Scope: Local
+ *
+ * Everything but packets. Returns 1 to keep going, 0 if the server
+ * closed the session, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-            break;
+static int sr_vns_handle_command(struct sr_instance* sr, unsigned char* buf,
+                                 int command)
+{
+    int ret = 1;
 
+    switch (command)
+    {
             /* -------------        VNSCLOSE      -------------------- */
 
         case VNSCLOSE:
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -501,8 +518,179 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
+    return ret;
+} /* -- sr_vns_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_iface_id(..)
+ * Scope: Local
+ *
+ * Id of the interface named in a VNS packet header (16 bytes, not
+ * necessarily terminated), or -1 if the router has no such interface.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_iface_id(struct sr_instance* sr, const char* name16)
+{
+    char name[sr_IFACE_NAMELEN];
+    int id;
+
+    memcpy(name, name16, 16);
+    name[16] = 0;
+    if ( (id = sr_interface_id(sr, name)) < 0 )
+    { sr_log(SR_LOG_WARN, "** Error, packet from unknown interface %s\n", name); }
+    return id;
+} /* -- sr_vns_iface_id -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: Global
+ *
+ * Block until one whole command is buffered, then handle it and every
+ * other whole command that arrived with it. Runs of packets go to the
+ * router together through sr_handlepacket_burst, straight from the
+ * receive buffer, and everything they sent is flushed at the end.
+ *
+ * During the handshake (expected_cmd set) only one command is handled
+ * per call; the rest stay buffered for the next.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    struct sr_vns_io* io;
+    uint8_t* frames[SR_BURST_MAX];
+    unsigned int lens[SR_BURST_MAX];
+    int ifaces[SR_BURST_MAX];
+    unsigned int nframes = 0;
+    int command, len, ifid;
+    unsigned char *buf = 0;
+    c_packet_ethernet_header* sr_pkt = 0;
+    int ret = 1;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->vns);
+    io = sr->vns;
+
+    /*---------------------------------------------------------------------------
+      Read at least one command from the server
+      -------------------------------------------------------------------------*/
+
+    if ( sr_vns_fill(sr, 4) != 0 )
+    { return -1; }
+
+    len = sr_vns_cmd_len(io->rx + io->rx_head);
+    if ( len > SR_VNS_MAX_CMD || len < 8 )
+    {
+        fprintf(stderr,"Error: command length to large %d\n",len);
+        close(sr->sockfd);
+        return -1;
+    }
+
+    if ( sr_vns_fill(sr, len) != 0 )
+    {
+        fprintf(stderr,"Error: failed reading command body\n");
+        close(sr->sockfd);
+        return -1;
+    }
+
+    while ( ret == 1 && io->rx_tail - io->rx_head >= 4 )
+    {
+        buf = io->rx + io->rx_head;
+        len = sr_vns_cmd_len(buf);
+        if ( len > SR_VNS_MAX_CMD || len < 8 )
+        {
+            fprintf(stderr,"Error: command length to large %d\n",len);
+            close(sr->sockfd);
+            ret = -1;
+            break;
+        }
+        if ( io->rx_tail - io->rx_head < (uint32_t)len )
+        { break; } /* -- the rest arrives with the next read -- */
+        io->rx_head += len;
+
+        /* My entry for most unreadable line of code - guido */
+        /* ... you win - mc                                  */
+        command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+
+        /* make sure the command is what we expected if we were expecting something */
+        if(expected_cmd && command!=expected_cmd) {
+            if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
+                fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+                ret = -1;
+                break;
+            }
+        }
+
+        if ( command == VNSPACKET )
+        {
+            sr_pkt = (c_packet_ethernet_header *)buf;
+
+            /* -- the only place a received frame's interface is named -- */
+            if ( (ifid = sr_vns_iface_id(sr, sr_pkt->mInterfaceName)) < 0 )
+            { continue; }
+
+            /* -- check if it is an ARP to another router if so drop   -- */
+            if ( sr_arp_req_not_for_us(sr,
+                    (buf+sizeof(c_packet_header)),
+                    len - sizeof(c_packet_ethernet_header) +
+                    sizeof(struct sr_ethernet_hdr),
+                    ifid) )
+            { continue; }
+
+            /* -- log packet -- */
+            sr_log_packet(sr, buf + sizeof(c_packet_header),
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+
+            /* -- with worker threads, the frame is copied out and queued -- */
+            if ( sr->pipeline )
+            {
+                sr_pipeline_rx(sr, buf + sizeof(c_packet_header),
+                               len - sizeof(c_packet_ethernet_header) +
+                               sizeof(struct sr_ethernet_hdr), ifid);
+                continue;
+            }
+
+            /* -- the header becomes headroom for the reply -- */
+            frames[nframes] = buf + sizeof(c_packet_header);
+            lens[nframes] = len - sizeof(c_packet_ethernet_header) +
+                            sizeof(struct sr_ethernet_hdr);
+            ifaces[nframes] = ifid;
+
+            /* -- pass to router, student's code should take over here -- */
+            if ( ++nframes == SR_BURST_MAX )
+            {
+                sr_handlepacket_burst(sr, frames, lens, ifaces, nframes);
+                nframes = 0;
+            }
+        }
+        else
+        {
+            /* -- keep packets and control commands in order -- */
+            if ( sr->pipeline )
+            { sr_pipeline_rx_flush(sr); }
+            if ( nframes )
+            {
+                sr_handlepacket_burst(sr, frames, lens, ifaces, nframes);
+                nframes = 0;
+            }
+            ret = sr_vns_handle_command(sr, buf, command);
+        }
+
+        if ( expected_cmd )
+        { break; }
+    }
+
+    if ( nframes )
+    { sr_handlepacket_burst(sr, frames, lens, ifaces, nframes); }
+    if ( sr->pipeline )
+    { sr_pipeline_rx_flush(sr); }
+
+    /* -- the frames sent in place live in the receive buffer -- */
+    if ( sr_send_flush(sr) != 0 && ret == 1 )
+    { ret = -1; }
+
     return ret;
 }/* -- sr_read_from_server -- */
 
@@ -517,26 +705,19 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 static int
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+                                struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
     assert(sr);
     assert(buf);
-    assert(name);
+    assert(iface);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
-
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
+        sr_log(SR_LOG_WARN, "** Error, source address does not match interface\n");
         return 0;
     }
 
@@ -550,66 +731,268 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/* -- the headroom reserved in front of frames is exactly one header -- */
+typedef char sr_headroom_check[(sizeof(c_packet_header) == SR_PACKET_HEADROOM) ? 1 : -1];
+
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
- * Scope: Global
+ * Method: sr_send_check(..)
+ * Scope: Local
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Checks shared by both send paths. Returns the interface to send the
+ * frame out of, or 0 if it may not be sent.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static struct sr_if* sr_send_check(struct sr_instance* sr, uint8_t* buf,
+                                   unsigned int len, int ifid)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct sr_if* iface;
 
     /* REQUIRES */
     assert(sr);
+    assert(sr->vns);
     assert(buf);
-    assert(iface);
 
-    printf("Sending packet out of interface: %s\n", iface);
-    print_hdrs(buf, len);
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
-        return -1;
+    if ( ifid < 0 || ifid >= sr->if_count ){
+        sr_log(SR_LOG_WARN, "** Error, interface %d, does not exist\n", ifid);
+        return 0;
     }
+    iface = sr_get_interface_by_id(sr, ifid);
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    sr_log(SR_LOG_DEBUG, "Sending packet out of interface: %s\n", iface->name);
+    sr_log_hdrs(SR_LOG_DEBUG, buf, len);
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ||
+         len + sizeof(c_packet_header) > SR_VNS_TXBUF ){
+        sr_log(SR_LOG_WARN, "** Error: packet is wayy to short \n");
+        return 0;
+    }
 
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
+        sr_log(SR_LOG_WARN, "*** Error: problem with ethernet header, check log\n");
+        return 0;
     }
+    return iface;
+} /* -- sr_send_check -- */
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+/* -- count a frame handed to the TX thread once it has been taken -- */
+static int sr_send_counted(int ret, int ifid, unsigned int len)
+{
+    if ( ret == 0 )
+    { sr_stats_tx(ifid, len); }
+    return ret;
+}
+
+void sr_fill_packet_header(c_packet_header* hdr, unsigned int total_len,
+                           const char* iface)
+{
+    size_t n = strnlen(iface, sizeof(hdr->mInterfaceName));
+
+    hdr->mLen  = htonl(total_len);
+    hdr->mType = htonl(VNSPACKET);
+    /* -- fixed width field, padded with NULs but not always terminated -- */
+    memcpy(hdr->mInterfaceName, iface, n);
+    memset(hdr->mInterfaceName + n, 0, sizeof(hdr->mInterfaceName) - n);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_writev(..)
+ * Scope: Global
+ *
+ * Write all of iov with as few writev calls as the socket allows. The
+ * entries are advanced past what was written.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_writev(struct sr_instance* sr, struct iovec* iov, int n)
+{
+    int ret = 0;
+
+    while ( n > 0 )
+    {
+        ssize_t w = writev(sr->sockfd, iov, n);
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            fprintf(stderr, "Error writing packet\n");
+            ret = -1;
+            break;
+        }
+        /* -- step over what went out, possibly part of one iovec -- */
+        while ( n > 0 && (size_t)w >= iov->iov_len )
+        {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if ( n > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
     }
+    return ret;
+} /* -- sr_vns_writev -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_flush_locked(..)
+ * Scope: Local
+ *
+ * Write everything queued. Must hold tx_lock.
+ *
+ *---------------------------------------------------------------------------*/
 
-    free(sr_pkt);
+static int sr_send_flush_locked(struct sr_instance* sr)
+{
+    struct sr_vns_io* io = sr->vns;
+    int ret = sr_vns_writev(sr, io->iov, io->niov);
 
-    return 0;
+    io->niov = 0;
+    io->stage_len = 0;
+    return ret;
+} /* -- sr_send_flush_locked -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_flush(..)
+ * Scope: Global
+ *
+ * Send every frame queued by sr_send_packet and sr_send_packet_inplace.
+ * Called at the end of each receive batch, and by the ARP thread after
+ * it has run its timers.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_flush(struct sr_instance* sr /* borrowed */)
+{
+    int ret;
+
+    if ( !sr->vns )
+    { return 0; }
+    pthread_mutex_lock(&sr->vns->tx_lock);
+    ret = sr_send_flush_locked(sr);
+    pthread_mutex_unlock(&sr->vns->tx_lock);
+    return ret;
+} /* -- sr_send_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) of length 'len' to the server
+ * to be injected onto the wire. The frame is copied, together with its
+ * VNS header, into the send staging buffer and goes out with the next
+ * flush; buf may be reused as soon as this returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(iface);
+
+    return sr_send_packet_id(sr, buf, len, sr_interface_id(sr, iface));
 } /* -- sr_send_packet -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_id(..)
+ * Scope: Global
+ *
+ * sr_send_packet for the interface with id 'ifid'.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_id(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         int ifid)
+{
+    struct sr_vns_io* io;
+    struct sr_if* iface;
+    c_packet_header* sr_pkt;
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct iovec* last;
+
+    if ( (iface = sr_send_check(sr, buf, len, ifid)) == 0 )
+    { return -1; }
+    if ( sr->pipeline )
+    { return sr_send_counted(sr_pipeline_send(sr, buf, len, ifid, 0), ifid, len); }
+    io = sr->vns;
+
+    pthread_mutex_lock(&io->tx_lock);
+    if ( io->niov == SR_VNS_TX_IOV || io->stage_len + total_len > SR_VNS_TXBUF )
+    { sr_send_flush_locked(sr); }
+
+    sr_pkt = (c_packet_header*)(io->stage + io->stage_len);
+    sr_fill_packet_header(sr_pkt, total_len, iface->name);
+    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header), buf, len);
+    io->stage_len += total_len;
+    sr_stats_tx(ifid, len);
+
+    /* -- back to back copies share one iovec -- */
+    last = io->niov ? &io->iov[io->niov - 1] : 0;
+    if ( last && (uint8_t*)last->iov_base + last->iov_len == (uint8_t*)sr_pkt )
+    { last->iov_len += total_len; }
+    else
+    {
+        io->iov[io->niov].iov_base = sr_pkt;
+        io->iov[io->niov++].iov_len = total_len;
+    }
+    pthread_mutex_unlock(&io->tx_lock);
+
+    return 0;
+} /* -- sr_send_packet_id -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_inplace(..)
+ * Scope: Global
+ *
+ * Like sr_send_packet_id, for a frame that has SR_PACKET_HEADROOM writable
+ * bytes in front of it (every frame handed to sr_handlepacket does). The
+ * VNS header is written into the headroom and the frame is queued where
+ * it is, so it must stay untouched until the next sr_send_flush. Frames
+ * in the receive buffer do: it is flushed before the buffer is reused.
+ * With worker threads the frame's buffer is passed to the TX thread,
+ * which may write and free it at once, so the caller must not touch the
+ * frame after this returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_inplace(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         int ifid)
+{
+    struct sr_vns_io* io;
+    struct sr_if* iface;
+    c_packet_header *sr_pkt = (c_packet_header *)(buf - sizeof(c_packet_header));
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+
+    if ( (iface = sr_send_check(sr, buf, len, ifid)) == 0 )
+    { return -1; }
+    io = sr->vns;
+
+    sr_fill_packet_header(sr_pkt, total_len, iface->name);
+    if ( sr->pipeline )
+    { return sr_send_counted(sr_pipeline_send(sr, buf, len, ifid, 1), ifid, len); }
+
+    pthread_mutex_lock(&io->tx_lock);
+    if ( io->niov == SR_VNS_TX_IOV )
+    { sr_send_flush_locked(sr); }
+    io->iov[io->niov].iov_base = sr_pkt;
+    io->iov[io->niov++].iov_len = total_len;
+    pthread_mutex_unlock(&io->tx_lock);
+    sr_stats_tx(ifid, len);
+
+    return 0;
+} /* -- sr_send_packet_inplace -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
  * Scope: Local
@@ -618,23 +1001,14 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->capture)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- buffered, the capture writer thread does the I/O -- */
+    sr_capture_packet(sr->capture, buf, len);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -646,9 +1020,9 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 int  sr_arp_req_not_for_us(struct sr_instance* sr,
                            uint8_t * packet /* lent */,
                            unsigned int len,
-                           char* interface  /* lent */)
+                           int ifid)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
+    struct sr_if* iface = sr_get_interface_by_id(sr, ifid);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 